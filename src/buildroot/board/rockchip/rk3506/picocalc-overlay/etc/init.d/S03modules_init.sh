@@ -1,11 +1,22 @@
 #!/bin/sh
+### BEGIN INIT INFO
+# Provides:          modules
+# Required-Start:
+# X-Start-Before:    udev
+### END INIT INFO
 #
 # Modules init
 #
-
+# modload loads what the present devices need, udev takes over for the
+# devices plugged in later. Falls back to loading everything.
+#
 
 start() {
-	find /lib/modules/$(uname -r)/kernel/ -name "*.ko" | xargs -I {} sh -c 'modprobe $(basename {})'
+	if [ -x /sbin/modload ]; then
+		/sbin/modload
+	else
+		find /lib/modules/$(uname -r)/kernel/ -name "*.ko" | xargs -I {} sh -c 'modprobe $(basename {})'
+	fi
 }
 
 stop() {
@@ -6,3 +6,6 @@ for file in `ls $TARGET_DIR/usr/lib/libretro/`
 do
     ln -sf /usr/lib/libretro/$file $TARGET_DIR/root/.config/retroarch/cores/$file
 done
+
+# pre_init mounts the overlay partition here, a squashfs root cannot mkdir it
+mkdir -p $TARGET_DIR/overlay
@@ -0,0 +1,39 @@
+################################################################################
+#
+# PICOCALC_ALSA
+#
+################################################################################
+PICOCALC_ALSA_DEPENDENCIES = alsa-lib
+
+# The sources are regular files kept in the package directory, there is
+# no upstream tarball, so they are built from there in place.
+PICOCALC_ALSA_SRC = $(PICOCALC_ALSA_PKGDIR)/src
+PICOCALC_ALSA_CFLAGS = $(TARGET_CFLAGS) -O2 -Wall -I$(PICOCALC_ALSA_SRC)
+
+ifeq ($(BR2_ARM_CPU_HAS_NEON),y)
+PICOCALC_ALSA_CFLAGS += -mfpu=neon-vfpv4
+endif
+
+define PICOCALC_ALSA_BUILD_CMDS
+	$(TARGET_CC) $(PICOCALC_ALSA_CFLAGS) -fPIC -shared $(TARGET_LDFLAGS) \
+		-o $(@D)/libasound_module_rate_picocalc.so \
+		$(PICOCALC_ALSA_SRC)/rate_picocalc.c $(PICOCALC_ALSA_SRC)/fir.c \
+		-lasound -lm
+	$(TARGET_CC) $(PICOCALC_ALSA_CFLAGS) -fPIC -shared $(TARGET_LDFLAGS) \
+		-o $(@D)/libasound_module_pcm_picocalc.so \
+		$(PICOCALC_ALSA_SRC)/pcm_picocalc.c -lasound
+	$(TARGET_CC) $(PICOCALC_ALSA_CFLAGS) $(TARGET_LDFLAGS) \
+		-o $(@D)/picocalc-pcm-bench \
+		$(PICOCALC_ALSA_SRC)/bench.c -lasound -lm
+endef
+
+define PICOCALC_ALSA_INSTALL_TARGET_CMDS
+	$(INSTALL) -D -m 0755 $(@D)/libasound_module_rate_picocalc.so \
+		$(TARGET_DIR)/usr/lib/alsa-lib/libasound_module_rate_picocalc.so
+	$(INSTALL) -D -m 0755 $(@D)/libasound_module_pcm_picocalc.so \
+		$(TARGET_DIR)/usr/lib/alsa-lib/libasound_module_pcm_picocalc.so
+	$(INSTALL) -D -m 0755 $(@D)/picocalc-pcm-bench \
+		$(TARGET_DIR)/usr/bin/picocalc-pcm-bench
+endef
+
+$(eval $(generic-package))
@@ -0,0 +1,293 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ * CPU cost and latency of the PicoCalc playback chains.
+ *
+ * By default, pushes a few seconds of S16 stereo through each chain into
+ * a null sink and reports the process CPU time spent per second of audio,
+ * i.e. the share of one A7 core the conversion costs during playback.
+ *
+ * With -l, plays through a real PCM (default: "default", i.e. dmix) and
+ * samples after every period written both snd_pcm_delay() and the frames
+ * the driver has already handed to the MCU. The latter can no longer be
+ * mixed into, so it is how late a second stream joining the mix is heard.
+ *
+ * usage: picocalc-pcm-bench [seconds [rate]]
+ *        picocalc-pcm-bench -l [pcm [seconds]]
+ *
+ * Copyright 2025 nekocharm <jumba.jookiba@outlook.com>
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <alsa/asoundlib.h>
+
+#define BENCH_CHANNELS	2
+#define BENCH_PERIOD	1024
+
+static const char bench_conf[] =
+	"pcm.sink { type null }\n"
+	/* the chain asound.conf used to set up: plug with linear rate to U8 */
+	"pcm.plug_linear_8k_u8 {\n"
+	"	type plug\n"
+	"	slave { pcm \"sink\" format U8 rate 8000 channels 1 }\n"
+	"	rate_converter \"linear\"\n"
+	"}\n"
+	"pcm.plug_linear_22k_s16 {\n"
+	"	type plug\n"
+	"	slave { pcm \"sink\" format S16_LE rate 22050 }\n"
+	"	rate_converter \"linear\"\n"
+	"}\n"
+	"pcm.picocalc_22k_s16 {\n"
+	"	type plug\n"
+	"	slave { pcm { type picocalc slave.pcm \"sink\" } rate 22050 }\n"
+	"	rate_converter \"picocalc\"\n"
+	"}\n"
+	"pcm.picocalc_11k_u8_mono {\n"
+	"	type plug\n"
+	"	slave {\n"
+	"		pcm { type picocalc slave.pcm \"sink\" channels 1 format U8 }\n"
+	"		rate 11025\n"
+	"	}\n"
+	"	rate_converter \"picocalc\"\n"
+	"}\n";
+
+static const char *const bench_pcms[] = {
+	"plug_linear_8k_u8",
+	"plug_linear_22k_s16",
+	"picocalc_22k_s16",
+	"picocalc_11k_u8_mono",
+};
+
+static double cpu_seconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* One second of a slow sweep with some noise, so no path is trivially idle */
+static int16_t *bench_signal(unsigned int rate)
+{
+	int16_t *buf = malloc(sizeof(int16_t) * BENCH_CHANNELS * rate);
+	double phase = 0.0;
+	unsigned int i;
+
+	if (!buf)
+		return NULL;
+	for (i = 0; i < rate; i++) {
+		double f = 100.0 + 9900.0 * i / rate;
+		int16_t v = 16000.0 * sin(phase) + (rand() % 512) - 256;
+
+		phase += 2.0 * M_PI * f / rate;
+		buf[i * BENCH_CHANNELS] = v;
+		buf[i * BENCH_CHANNELS + 1] = -v;
+	}
+	return buf;
+}
+
+static int bench_run(snd_config_t *top, const char *name, const int16_t *sig,
+		     unsigned int rate, unsigned int seconds)
+{
+	snd_pcm_uframes_t total = (snd_pcm_uframes_t)rate * seconds;
+	snd_pcm_uframes_t done = 0;
+	snd_pcm_t *pcm;
+	double start, used;
+	int err;
+
+	err = snd_pcm_open_lconf(&pcm, name, SND_PCM_STREAM_PLAYBACK, 0, top);
+	if (err < 0) {
+		fprintf(stderr, "%s: open: %s\n", name, snd_strerror(err));
+		return err;
+	}
+	err = snd_pcm_set_params(pcm, SND_PCM_FORMAT_S16_LE,
+				 SND_PCM_ACCESS_RW_INTERLEAVED, BENCH_CHANNELS,
+				 rate, 0, 100000);
+	if (err < 0) {
+		fprintf(stderr, "%s: params: %s\n", name, snd_strerror(err));
+		snd_pcm_close(pcm);
+		return err;
+	}
+
+	start = cpu_seconds();
+	while (done < total) {
+		snd_pcm_uframes_t pos = done % rate;
+		snd_pcm_uframes_t n = BENCH_PERIOD;
+		snd_pcm_sframes_t ret;
+
+		if (n > rate - pos)
+			n = rate - pos;
+		ret = snd_pcm_writei(pcm, sig + pos * BENCH_CHANNELS, n);
+		if (ret < 0) {
+			ret = snd_pcm_recover(pcm, ret, 0);
+			if (ret < 0) {
+				fprintf(stderr, "%s: write: %s\n", name,
+					snd_strerror(ret));
+				snd_pcm_close(pcm);
+				return ret;
+			}
+			continue;
+		}
+		done += ret;
+	}
+	used = cpu_seconds() - start;
+	snd_pcm_close(pcm);
+
+	printf("%-24s %8.3f ms CPU per second of audio (%5.2f%% of a core)\n",
+	       name, used * 1000.0 / seconds, used * 100.0 / seconds);
+	return 0;
+}
+
+struct latency_stat {
+	double sum, min, max;
+	unsigned long count;
+};
+
+static void latency_add(struct latency_stat *st, double ms)
+{
+	if (!st->count || ms < st->min)
+		st->min = ms;
+	if (ms > st->max)
+		st->max = ms;
+	st->sum += ms;
+	st->count++;
+}
+
+static void latency_print(const char *what, const struct latency_stat *st,
+			  double period_ms)
+{
+	if (!st->count)
+		return;
+	printf("%-10s min %6.1f ms, avg %6.1f ms, max %6.1f ms (%.2f periods)\n",
+	       what, st->min, st->sum / st->count, st->max, st->max / period_ms);
+}
+
+/* Frames the driver already handed to the MCU, i.e. no longer mixable */
+static long softpwm_queued(void)
+{
+	FILE *f = fopen("/proc/asound/card0/softpwm", "r");
+	char line[64];
+	long queued = -1;
+
+	if (!f)
+		return -1;
+	while (fgets(line, sizeof(line), f))
+		if (sscanf(line, "queued_frames: %ld", &queued) == 1)
+			break;
+	fclose(f);
+	return queued;
+}
+
+static int latency_run(const char *name, unsigned int seconds)
+{
+	snd_pcm_uframes_t buffer_size, period_size, done = 0;
+	unsigned int rate = 22050;
+	struct latency_stat delay_st = { 0 }, mcu_st = { 0 };
+	double period_ms;
+	snd_pcm_sframes_t delay;
+	int16_t *buf;
+	long queued;
+	int err;
+	snd_pcm_t *pcm;
+
+	err = snd_pcm_open(&pcm, name, SND_PCM_STREAM_PLAYBACK, 0);
+	if (err < 0) {
+		fprintf(stderr, "%s: open: %s\n", name, snd_strerror(err));
+		return 1;
+	}
+	err = snd_pcm_set_params(pcm, SND_PCM_FORMAT_S16_LE,
+				 SND_PCM_ACCESS_RW_INTERLEAVED, BENCH_CHANNELS,
+				 rate, 1, 50000);
+	if (err >= 0)
+		err = snd_pcm_get_params(pcm, &buffer_size, &period_size);
+	if (err < 0) {
+		fprintf(stderr, "%s: params: %s\n", name, snd_strerror(err));
+		snd_pcm_close(pcm);
+		return 1;
+	}
+
+	buf = calloc(period_size * BENCH_CHANNELS, sizeof(int16_t));
+	if (!buf) {
+		snd_pcm_close(pcm);
+		return 1;
+	}
+
+	while (done < (snd_pcm_uframes_t)rate * seconds) {
+		snd_pcm_sframes_t ret = snd_pcm_writei(pcm, buf, period_size);
+
+		if (ret < 0) {
+			if (snd_pcm_recover(pcm, ret, 0) < 0)
+				break;
+			continue;
+		}
+		done += ret;
+		/* skip the initial fill */
+		if (done < buffer_size)
+			continue;
+
+		if (snd_pcm_delay(pcm, &delay) == 0)
+			latency_add(&delay_st, delay * 1000.0 / rate);
+		queued = softpwm_queued();
+		if (queued >= 0)
+			latency_add(&mcu_st, queued * 1000.0 / rate);
+	}
+	snd_pcm_drop(pcm);
+	snd_pcm_close(pcm);
+	free(buf);
+
+	period_ms = period_size * 1000.0 / rate;
+	printf("%s: period %.1f ms, buffer %.1f ms\n", name, period_ms,
+	       buffer_size * 1000.0 / rate);
+	/* what this client waits for, and what a client joining the mix waits */
+	latency_print("delay", &delay_st, period_ms);
+	latency_print("mcu ring", &mcu_st, period_ms);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int seconds = argc > 1 ? atoi(argv[1]) : 30;
+	unsigned int rate = argc > 2 ? atoi(argv[2]) : 48000;
+	snd_config_t *top;
+	snd_input_t *in;
+	int16_t *sig;
+	unsigned int i;
+	int err;
+
+	if (argc > 1 && strcmp(argv[1], "-l") == 0)
+		return latency_run(argc > 2 ? argv[2] : "default",
+				   argc > 3 ? atoi(argv[3]) : 10);
+
+	if (!seconds || rate < 8000) {
+		fprintf(stderr, "usage: %s [seconds [rate]]\n"
+			"       %s -l [pcm [seconds]]\n", argv[0], argv[0]);
+		return 1;
+	}
+
+	err = snd_config_top(&top);
+	if (err >= 0)
+		err = snd_input_buffer_open(&in, bench_conf, -1);
+	if (err >= 0) {
+		err = snd_config_load(top, in);
+		snd_input_close(in);
+	}
+	if (err < 0) {
+		fprintf(stderr, "config: %s\n", snd_strerror(err));
+		return 1;
+	}
+
+	sig = bench_signal(rate);
+	if (!sig)
+		return 1;
+
+	printf("%u s of S16_LE stereo at %u Hz per chain\n", seconds, rate);
+	for (i = 0; i < sizeof(bench_pcms) / sizeof(bench_pcms[0]); i++)
+		bench_run(top, bench_pcms[i], sig, rate, seconds);
+
+	free(sig);
+	snd_config_delete(top);
+	return 0;
+}
@@ -0,0 +1,242 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ * Polyphase FIR resampler for the PicoCalc softpwm card.
+ *
+ * The filter is a Kaiser windowed sinc with its cutoff just below the
+ * lower of the two Nyquist frequencies, sampled at FIR_PHASES sub-sample
+ * offsets. An output frame picks the phase at or just before its position
+ * and runs one dot product per channel over the de-interleaved input,
+ * which is what the NEON path vectorises (8 taps per iteration).
+ *
+ * Copyright 2025 nekocharm <jumba.jookiba@outlook.com>
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include "fir.h"
+
+#define FIR_ROLLOFF	0.90	/* passband edge, fraction of the lower Nyquist */
+#define FIR_BETA	6.0	/* Kaiser beta, ~60 dB stopband */
+#define FIR_TAPS_MIN	16
+#define FIR_TAPS_MAX	128
+
+static double bessel_i0(double x)
+{
+	double sum = 1.0, term = 1.0;
+	int k;
+
+	for (k = 1; k < 32; k++) {
+		term *= (x / (2 * k)) * (x / (2 * k));
+		sum += term;
+		if (term < sum * 1e-12)
+			break;
+	}
+	return sum;
+}
+
+static double sinc(double x)
+{
+	return x == 0.0 ? 1.0 : sin(M_PI * x) / (M_PI * x);
+}
+
+static void fir_design(struct fir *f, double fc)
+{
+	unsigned int taps = f->taps;
+	double centre = taps / 2 - 1;
+	double half = taps / 2;
+	double i0_beta = bessel_i0(FIR_BETA);
+	double h[FIR_TAPS_MAX];
+	unsigned int p, j;
+
+	for (p = 0; p < FIR_PHASES; p++) {
+		double frac = (double)p / FIR_PHASES;
+		double sum = 0.0;
+
+		for (j = 0; j < taps; j++) {
+			double t = j - centre - frac;
+			double x = t / half;
+			double w = fabs(x) >= 1.0 ? 0.0 :
+				   bessel_i0(FIR_BETA * sqrt(1.0 - x * x)) / i0_beta;
+
+			h[j] = fc * sinc(fc * t) * w;
+			sum += h[j];
+		}
+
+		/* unity DC gain for every phase, so no phase-dependent ripple */
+		for (j = 0; j < taps; j++) {
+			long v = lrint(h[j] / sum * 32768.0);
+
+			if (v > 32767)
+				v = 32767;
+			else if (v < -32768)
+				v = -32768;
+			f->coef[p * taps + j] = v;
+		}
+	}
+}
+
+static int fir_grow(struct fir *f, unsigned int max_in);
+
+int fir_init(struct fir *f, unsigned int channels, unsigned int in_rate,
+	     unsigned int out_rate, unsigned int max_in)
+{
+	double ratio = (double)in_rate / out_rate;
+	unsigned int taps;
+
+	memset(f, 0, sizeof(*f));
+	if (!channels || !in_rate || !out_rate)
+		return -EINVAL;
+
+	/* ~16 taps per output sample period keeps the transition band narrow */
+	taps = (unsigned int)ceil((ratio > 1.0 ? ratio : 1.0) * 16.0);
+	taps = (taps + 7) & ~7u;
+	if (taps < FIR_TAPS_MIN)
+		taps = FIR_TAPS_MIN;
+	else if (taps > FIR_TAPS_MAX)
+		taps = FIR_TAPS_MAX;
+
+	f->channels = channels;
+	f->taps = taps;
+	f->coef = aligned_alloc(16, FIR_PHASES * taps * sizeof(int16_t));
+	if (!f->coef)
+		return -ENOMEM;
+
+	fir_design(f, FIR_ROLLOFF * (ratio > 1.0 ? 1.0 / ratio : 1.0));
+
+	if (fir_grow(f, max_in ? max_in : 1) < 0) {
+		fir_free(f);
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+void fir_free(struct fir *f)
+{
+	free(f->coef);
+	free(f->hist);
+	f->coef = NULL;
+	f->hist = NULL;
+	f->max_in = 0;
+}
+
+void fir_reset(struct fir *f)
+{
+	if (f->hist)
+		memset(f->hist, 0, (size_t)f->channels *
+		       (f->taps - 1 + f->max_in) * sizeof(int16_t));
+}
+
+static int fir_grow(struct fir *f, unsigned int max_in)
+{
+	unsigned int old_stride = f->taps - 1 + f->max_in;
+	unsigned int stride = f->taps - 1 + max_in;
+	int16_t *hist;
+	unsigned int c;
+
+	hist = calloc((size_t)f->channels * stride, sizeof(int16_t));
+	if (!hist)
+		return -ENOMEM;
+	if (f->hist) {
+		for (c = 0; c < f->channels; c++)
+			memcpy(hist + c * stride, f->hist + c * old_stride,
+			       (f->taps - 1) * sizeof(int16_t));
+		free(f->hist);
+	}
+	f->hist = hist;
+	f->max_in = max_in;
+	return 0;
+}
+
+static inline int32_t fir_dot(const int16_t *x, const int16_t *h,
+			      unsigned int taps)
+{
+#ifdef __ARM_NEON
+	int32x4_t acc0 = vdupq_n_s32(0);
+	int32x4_t acc1 = vdupq_n_s32(0);
+	int32x2_t sum;
+	unsigned int i;
+
+	for (i = 0; i < taps; i += 8) {
+		int16x8_t xv = vld1q_s16(x + i);
+		int16x8_t hv = vld1q_s16(h + i);
+
+		acc0 = vmlal_s16(acc0, vget_low_s16(xv), vget_low_s16(hv));
+		acc1 = vmlal_s16(acc1, vget_high_s16(xv), vget_high_s16(hv));
+	}
+	acc0 = vaddq_s32(acc0, acc1);
+	sum = vadd_s32(vget_low_s32(acc0), vget_high_s32(acc0));
+	sum = vpadd_s32(sum, sum);
+	return vget_lane_s32(sum, 0);
+#else
+	int32_t acc = 0;
+	unsigned int i;
+
+	for (i = 0; i < taps; i++)
+		acc += x[i] * h[i];
+	return acc;
+#endif
+}
+
+static inline int16_t fir_sat(int32_t acc)
+{
+	acc = (acc + (1 << 14)) >> 15;
+	if (acc > 32767)
+		return 32767;
+	if (acc < -32768)
+		return -32768;
+	return acc;
+}
+
+/*
+ * Produce dst_frames from src_frames. The output frame k sits at input
+ * position k * src_frames / dst_frames, tracked as integer part plus a
+ * remainder over dst_frames so nothing is rounded across calls.
+ */
+int fir_process(struct fir *f, int16_t *dst, unsigned int dst_frames,
+		const int16_t *src, unsigned int src_frames)
+{
+	unsigned int channels = f->channels;
+	unsigned int taps = f->taps;
+	unsigned int stride, step, step_rem;
+	unsigned int c, i, k;
+
+	if (src_frames > f->max_in && fir_grow(f, src_frames) < 0)
+		return -ENOMEM;
+	if (!dst_frames)
+		return 0;
+
+	stride = taps - 1 + f->max_in;
+	step = src_frames / dst_frames;
+	step_rem = src_frames % dst_frames;
+
+	for (c = 0; c < channels; c++) {
+		int16_t *buf = f->hist + c * stride;
+		unsigned int ip = 0, rem = 0;
+
+		for (i = 0; i < src_frames; i++)
+			buf[taps - 1 + i] = src[i * channels + c];
+
+		for (k = 0; k < dst_frames; k++) {
+			unsigned int phase = (uint64_t)rem * FIR_PHASES / dst_frames;
+
+			dst[k * channels + c] =
+				fir_sat(fir_dot(buf + ip, f->coef + phase * taps, taps));
+
+			ip += step;
+			rem += step_rem;
+			if (rem >= dst_frames) {
+				rem -= dst_frames;
+				ip++;
+			}
+		}
+
+		memmove(buf, buf + src_frames, (taps - 1) * sizeof(int16_t));
+	}
+	return 0;
+}
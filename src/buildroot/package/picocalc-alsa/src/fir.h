@@ -0,0 +1,36 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Polyphase FIR resampler for the PicoCalc softpwm card.
+ *
+ * Interleaved S16 in, interleaved S16 out. Each call maps exactly
+ * src_frames input frames onto dst_frames output frames, which is how the
+ * alsa-lib rate plugin drives its converters (one period at a time), so
+ * the ratio is exact and the phase never drifts.
+ *
+ * Copyright 2025 nekocharm <jumba.jookiba@outlook.com>
+ */
+
+#ifndef __PICOCALC_FIR_H
+#define __PICOCALC_FIR_H
+
+#include <stdint.h>
+
+/* Sub-sample positions the filter is designed for */
+#define FIR_PHASES		128
+
+struct fir {
+	unsigned int channels;
+	unsigned int taps;	/* per phase, a multiple of 8 */
+	int16_t *coef;		/* FIR_PHASES * taps, Q15 */
+	int16_t *hist;		/* per channel: taps - 1 history + max_in */
+	unsigned int max_in;
+};
+
+int fir_init(struct fir *f, unsigned int channels, unsigned int in_rate,
+	     unsigned int out_rate, unsigned int max_in);
+void fir_free(struct fir *f);
+void fir_reset(struct fir *f);
+int fir_process(struct fir *f, int16_t *dst, unsigned int dst_frames,
+		const int16_t *src, unsigned int src_frames);
+
+#endif /* __PICOCALC_FIR_H */
@@ -0,0 +1,253 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ * alsa-lib external filter PCM feeding the PicoCalc softpwm card.
+ *
+ * Takes S16 mono or stereo, optionally downmixes to mono and writes S16
+ * or U8 to the slave. The U8 path gets TPDF dither with first-order error
+ * feedback, so the 8-bit quantisation noise is pushed up towards the PWM
+ * carrier instead of sitting under quiet passages as distortion. The S16
+ * path leaves the requantisation to the driver, which shapes it against
+ * the real duty resolution.
+ *
+ * pcm.picocalc {
+ *     type picocalc
+ *     slave.pcm "hw:0,0"
+ *     channels 1		# optional, default: same as the application
+ *     format U8		# optional, S16_LE (default) or U8
+ *     dither off		# optional, U8 only, default on
+ * }
+ *
+ * Copyright 2025 nekocharm <jumba.jookiba@outlook.com>
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <alsa/asoundlib.h>
+#include <alsa/pcm_external.h>
+
+typedef struct {
+	snd_pcm_extplug_t ext;
+	int dither;
+	uint32_t seed;
+	int32_t err[2];
+} snd_pcm_picocalc_t;
+
+static inline void *area_addr(const snd_pcm_channel_area_t *area,
+			      snd_pcm_uframes_t offset)
+{
+	return (char *)area->addr + (area->first + offset * area->step) / 8;
+}
+
+static inline unsigned int area_step(const snd_pcm_channel_area_t *area)
+{
+	return area->step / 8;
+}
+
+/* xorshift32, only needs to be cheap and white */
+static inline uint32_t picocalc_rand(snd_pcm_picocalc_t *pc)
+{
+	uint32_t x = pc->seed;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	pc->seed = x;
+	return x;
+}
+
+static inline uint8_t picocalc_u8(snd_pcm_picocalc_t *pc, int ch, int32_t s)
+{
+	int32_t v, q, tpdf;
+	uint32_t r;
+
+	if (!pc->dither)
+		return (uint8_t)((s >> 8) + 128);
+
+	/* two 8-bit uniforms make a +-1 LSB triangular dither */
+	r = picocalc_rand(pc);
+	tpdf = (int32_t)(r & 0xff) + (int32_t)((r >> 8) & 0xff) - 255;
+
+	/* error feedback: (1 - z^-1) shaped quantisation noise */
+	v = s - pc->err[ch];
+	q = (v + tpdf + 128) >> 8;
+	if (q > 127)
+		q = 127;
+	else if (q < -128)
+		q = -128;
+
+	pc->err[ch] = (q << 8) - v;
+	/* clipped: do not let the loop wind up */
+	if (pc->err[ch] > 256)
+		pc->err[ch] = 256;
+	else if (pc->err[ch] < -256)
+		pc->err[ch] = -256;
+
+	return (uint8_t)(q + 128);
+}
+
+static snd_pcm_sframes_t
+picocalc_transfer(snd_pcm_extplug_t *ext,
+		  const snd_pcm_channel_area_t *dst_areas,
+		  snd_pcm_uframes_t dst_offset,
+		  const snd_pcm_channel_area_t *src_areas,
+		  snd_pcm_uframes_t src_offset,
+		  snd_pcm_uframes_t size)
+{
+	snd_pcm_picocalc_t *pc = ext->private_data;
+	unsigned int in_ch = ext->channels;
+	unsigned int out_ch = ext->slave_channels;
+	int u8 = ext->slave_format == SND_PCM_FORMAT_U8;
+	const char *src[2];
+	char *dst[2];
+	unsigned int src_step[2], dst_step[2];
+	snd_pcm_uframes_t i;
+	unsigned int c;
+
+	for (c = 0; c < in_ch; c++) {
+		src[c] = area_addr(src_areas + c, src_offset);
+		src_step[c] = area_step(src_areas + c);
+	}
+	for (c = 0; c < out_ch; c++) {
+		dst[c] = area_addr(dst_areas + c, dst_offset);
+		dst_step[c] = area_step(dst_areas + c);
+	}
+
+	for (i = 0; i < size; i++) {
+		int32_t s[2];
+
+		s[0] = *(const int16_t *)src[0];
+		s[1] = in_ch > 1 ? *(const int16_t *)src[1] : s[0];
+		if (out_ch == 1)
+			s[0] = (s[0] + s[1]) >> 1;
+
+		for (c = 0; c < out_ch; c++) {
+			if (u8)
+				*(uint8_t *)dst[c] = picocalc_u8(pc, c, s[c]);
+			else
+				*(int16_t *)dst[c] = s[c];
+			dst[c] += dst_step[c];
+		}
+		for (c = 0; c < in_ch; c++)
+			src[c] += src_step[c];
+	}
+	return size;
+}
+
+static int picocalc_init(snd_pcm_extplug_t *ext)
+{
+	snd_pcm_picocalc_t *pc = ext->private_data;
+
+	pc->err[0] = 0;
+	pc->err[1] = 0;
+	return 0;
+}
+
+static int picocalc_close(snd_pcm_extplug_t *ext)
+{
+	free(ext->private_data);
+	return 0;
+}
+
+static const snd_pcm_extplug_callback_t picocalc_callback = {
+	.transfer = picocalc_transfer,
+	.init = picocalc_init,
+	.close = picocalc_close,
+};
+
+SND_PCM_PLUGIN_DEFINE_FUNC(picocalc)
+{
+	snd_config_iterator_t i, next;
+	snd_pcm_picocalc_t *pc;
+	snd_config_t *sconf = NULL;
+	snd_pcm_format_t format = SND_PCM_FORMAT_S16;
+	long channels = 0;
+	int dither = 1;
+	int err;
+
+	snd_config_for_each(i, next, conf) {
+		snd_config_t *n = snd_config_iterator_entry(i);
+		const char *id;
+
+		if (snd_config_get_id(n, &id) < 0)
+			continue;
+		if (strcmp(id, "comment") == 0 || strcmp(id, "type") == 0 ||
+		    strcmp(id, "hint") == 0)
+			continue;
+		if (strcmp(id, "slave") == 0) {
+			sconf = n;
+			continue;
+		}
+		if (strcmp(id, "channels") == 0) {
+			if (snd_config_get_integer(n, &channels) < 0 ||
+			    channels < 1 || channels > 2) {
+				SNDERR("channels must be 1 or 2");
+				return -EINVAL;
+			}
+			continue;
+		}
+		if (strcmp(id, "format") == 0) {
+			const char *str;
+
+			if (snd_config_get_string(n, &str) < 0) {
+				SNDERR("format must be a string");
+				return -EINVAL;
+			}
+			format = snd_pcm_format_value(str);
+			if (format != SND_PCM_FORMAT_S16 &&
+			    format != SND_PCM_FORMAT_U8) {
+				SNDERR("format must be S16_LE or U8");
+				return -EINVAL;
+			}
+			continue;
+		}
+		if (strcmp(id, "dither") == 0) {
+			dither = snd_config_get_bool(n);
+			if (dither < 0) {
+				SNDERR("Invalid value for %s", id);
+				return -EINVAL;
+			}
+			continue;
+		}
+		SNDERR("Unknown field %s", id);
+		return -EINVAL;
+	}
+
+	if (!sconf) {
+		SNDERR("No slave configuration for picocalc pcm");
+		return -EINVAL;
+	}
+
+	pc = calloc(1, sizeof(*pc));
+	if (!pc)
+		return -ENOMEM;
+
+	pc->dither = dither;
+	pc->seed = 0x2545f491;
+	pc->ext.version = SND_PCM_EXTPLUG_VERSION;
+	pc->ext.name = "PicoCalc softpwm filter";
+	pc->ext.callback = &picocalc_callback;
+	pc->ext.private_data = pc;
+
+	err = snd_pcm_extplug_create(&pc->ext, name, root, sconf, stream, mode);
+	if (err < 0) {
+		free(pc);
+		return err;
+	}
+
+	snd_pcm_extplug_set_param(&pc->ext, SND_PCM_EXTPLUG_HW_FORMAT,
+				  SND_PCM_FORMAT_S16);
+	snd_pcm_extplug_set_slave_param(&pc->ext, SND_PCM_EXTPLUG_HW_FORMAT,
+					format);
+	snd_pcm_extplug_set_param_minmax(&pc->ext, SND_PCM_EXTPLUG_HW_CHANNELS,
+					 1, 2);
+	if (channels)
+		snd_pcm_extplug_set_slave_param(&pc->ext,
+						SND_PCM_EXTPLUG_HW_CHANNELS,
+						channels);
+
+	*pcmp = pc->ext.pcm;
+	return 0;
+}
+
+SND_PCM_PLUGIN_SYMBOL(picocalc);
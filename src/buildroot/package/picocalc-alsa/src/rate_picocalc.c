@@ -0,0 +1,179 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ * alsa-lib rate converter using the polyphase FIR in fir.c.
+ *
+ * Selected with rate_converter "picocalc" in a plug/rate PCM. Only the
+ * S16 path is provided, alsa-lib converts other formats around it.
+ *
+ * Copyright 2025 nekocharm <jumba.jookiba@outlook.com>
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <alsa/asoundlib.h>
+#include <alsa/pcm_rate.h>
+
+#include "fir.h"
+
+struct rate_picocalc {
+	unsigned int version;
+	struct fir fir;
+	unsigned int in_rate;
+	unsigned int out_rate;
+	snd_pcm_uframes_t in_period;
+	snd_pcm_uframes_t out_period;
+};
+
+static snd_pcm_uframes_t muldiv_near(snd_pcm_uframes_t frames,
+				     snd_pcm_uframes_t mul,
+				     snd_pcm_uframes_t div)
+{
+	if (!div)
+		return frames;
+	return ((uint64_t)frames * mul + div / 2) / div;
+}
+
+/* The converter runs at the period ratio, like the linear one does */
+static snd_pcm_uframes_t input_frames(void *obj, snd_pcm_uframes_t frames)
+{
+	struct rate_picocalc *rate = obj;
+
+	return muldiv_near(frames, rate->in_period, rate->out_period);
+}
+
+static snd_pcm_uframes_t output_frames(void *obj, snd_pcm_uframes_t frames)
+{
+	struct rate_picocalc *rate = obj;
+
+	return muldiv_near(frames, rate->out_period, rate->in_period);
+}
+
+static void pcm_picocalc_free(void *obj)
+{
+	struct rate_picocalc *rate = obj;
+
+	fir_free(&rate->fir);
+}
+
+static int pcm_picocalc_init(void *obj, snd_pcm_rate_info_t *info)
+{
+	struct rate_picocalc *rate = obj;
+
+	pcm_picocalc_free(obj);
+
+	rate->in_rate = info->in.rate;
+	rate->out_rate = info->out.rate;
+	rate->in_period = info->in.period_size;
+	rate->out_period = info->out.period_size;
+
+	return fir_init(&rate->fir, info->channels, info->in.rate,
+			info->out.rate, info->in.period_size);
+}
+
+static void pcm_picocalc_reset(void *obj)
+{
+	struct rate_picocalc *rate = obj;
+
+	fir_reset(&rate->fir);
+}
+
+static void pcm_picocalc_close(void *obj)
+{
+	pcm_picocalc_free(obj);
+	free(obj);
+}
+
+static void pcm_picocalc_convert_s16(void *obj, int16_t *dst,
+				     unsigned int dst_frames,
+				     const int16_t *src,
+				     unsigned int src_frames)
+{
+	struct rate_picocalc *rate = obj;
+
+	if (fir_process(&rate->fir, dst, dst_frames, src, src_frames) < 0)
+		memset(dst, 0, (size_t)dst_frames * rate->fir.channels *
+		       sizeof(int16_t));
+}
+
+#if SND_PCM_RATE_PLUGIN_VERSION >= 0x010002
+static int get_supported_rates(void *obj, unsigned int *rate_min,
+			       unsigned int *rate_max)
+{
+	(void)obj;
+	*rate_min = 4000;
+	*rate_max = 192000;
+	return 0;
+}
+
+static void dump(void *obj, snd_output_t *out)
+{
+	struct rate_picocalc *rate = obj;
+
+	snd_output_printf(out, "Converter: picocalc polyphase FIR "
+			  "%u -> %u Hz (%u taps x %u phases, %s)\n",
+			  rate->in_rate, rate->out_rate,
+			  rate->fir.taps, FIR_PHASES,
+#ifdef __ARM_NEON
+			  "NEON"
+#else
+			  "C"
+#endif
+			  );
+}
+#endif
+
+#if SND_PCM_RATE_PLUGIN_VERSION >= 0x010003
+static int get_supported_formats(void *obj, uint64_t *in_formats,
+				 uint64_t *out_formats, unsigned int *flags)
+{
+	(void)obj;
+	*in_formats = *out_formats = 1ULL << SND_PCM_FORMAT_S16;
+	*flags = SND_PCM_RATE_FLAG_INTERLEAVED;
+	return 0;
+}
+#endif
+
+static const snd_pcm_rate_ops_t picocalc_ops = {
+	.close = pcm_picocalc_close,
+	.init = pcm_picocalc_init,
+	.free = pcm_picocalc_free,
+	.reset = pcm_picocalc_reset,
+	.convert_s16 = pcm_picocalc_convert_s16,
+	.input_frames = input_frames,
+	.output_frames = output_frames,
+#if SND_PCM_RATE_PLUGIN_VERSION >= 0x010002
+	.version = SND_PCM_RATE_PLUGIN_VERSION,
+	.get_supported_rates = get_supported_rates,
+	.dump = dump,
+#endif
+#if SND_PCM_RATE_PLUGIN_VERSION >= 0x010003
+	.get_supported_formats = get_supported_formats,
+#endif
+};
+
+int SND_PCM_RATE_PLUGIN_ENTRY(picocalc) (unsigned int version, void **objp,
+					 snd_pcm_rate_ops_t *ops)
+{
+	struct rate_picocalc *rate;
+
+#if SND_PCM_RATE_PLUGIN_VERSION < 0x010002
+	if (version != SND_PCM_RATE_PLUGIN_VERSION) {
+		fprintf(stderr, "Invalid rate plugin version %x\n", version);
+		return -EINVAL;
+	}
+#endif
+	rate = calloc(1, sizeof(*rate));
+	if (!rate)
+		return -ENOMEM;
+
+	rate->version = version;
+	*objp = rate;
+#if SND_PCM_RATE_PLUGIN_VERSION >= 0x010002
+	if (version == 0x010001)
+		memcpy(ops, &picocalc_ops, sizeof(snd_pcm_rate_old_ops_t));
+	else
+#endif
+		*ops = picocalc_ops;
+	return 0;
+}
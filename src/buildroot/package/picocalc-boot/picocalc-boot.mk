@@ -0,0 +1,29 @@
+################################################################################
+#
+# PICOCALC_BOOT
+#
+################################################################################
+
+# Built straight from the package directory, like picocalc-alsa
+PICOCALC_BOOT_SRC = $(PICOCALC_BOOT_PKGDIR)/src
+PICOCALC_BOOT_CFLAGS = $(TARGET_CFLAGS) -O2 -Wall
+
+define PICOCALC_BOOT_BUILD_CMDS
+	$(TARGET_CC) $(PICOCALC_BOOT_CFLAGS) $(TARGET_LDFLAGS) \
+		-o $(@D)/modload $(PICOCALC_BOOT_SRC)/modload.c -lpthread
+	$(TARGET_CC) $(PICOCALC_BOOT_CFLAGS) $(TARGET_LDFLAGS) \
+		-o $(@D)/initrun $(PICOCALC_BOOT_SRC)/initrun.c
+	$(TARGET_CC) $(PICOCALC_BOOT_CFLAGS) $(TARGET_LDFLAGS) \
+		-o $(@D)/usbnetd $(PICOCALC_BOOT_SRC)/usbnetd.c
+	$(TARGET_CC) $(PICOCALC_BOOT_CFLAGS) $(TARGET_LDFLAGS) \
+		-o $(@D)/prefetch $(PICOCALC_BOOT_SRC)/prefetch.c -lpthread
+endef
+
+define PICOCALC_BOOT_INSTALL_TARGET_CMDS
+	$(INSTALL) -D -m 0755 $(@D)/modload $(TARGET_DIR)/sbin/modload
+	$(INSTALL) -D -m 0755 $(@D)/initrun $(TARGET_DIR)/sbin/initrun
+	$(INSTALL) -D -m 0755 $(@D)/usbnetd $(TARGET_DIR)/sbin/usbnetd
+	$(INSTALL) -D -m 0755 $(@D)/prefetch $(TARGET_DIR)/sbin/prefetch
+endef
+
+$(eval $(generic-package))
@@ -0,0 +1,421 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Parallel runner for the S??* init scripts.
+ *
+ * Starts the scripts of a directory as rcS does, but only orders them as
+ * far as their LSB headers ask for:
+ *
+ *   ### BEGIN INIT INFO
+ *   # Provides:          usbconfig
+ *   # Required-Start:    modules
+ *   # Should-Start:      udev
+ *   # X-Start-Before:    usbdevice
+ *   ### END INIT INFO
+ *
+ * A script is known by its Provides names and by its file name without
+ * the S?? and .sh, so S10udev is "udev". Should-Start names that do not
+ * exist are ignored, $all waits for every other script and the other $
+ * facilities are ignored.
+ *
+ * Scripts without a header keep their old order: each one waits for every
+ * script before it in the directory, headers or not. Scripts with a header
+ * only wait for what they name, and for the last script without a header
+ * before them. Up to one script per CPU runs at a time.
+ *
+ * The start and end of every script, relative to the runner's start, go
+ * to the kernel log so they show up with the kernel's timestamps, and to
+ * the file given with -l.
+ *
+ * usage: initrun [-j jobs] [-l log] action dir
+ *   action is passed on to the scripts, start for rcS
+ *
+ * Copyright 2025 nekocharm <jumba.jookiba@outlook.com>
+ */
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define INITRUN_MAX	128
+#define INITRUN_NAMES	4	/* Provides names per script */
+
+enum svc_state {
+	SVC_WAITING,
+	SVC_RUNNING,
+	SVC_DONE,
+};
+
+struct service {
+	char *file;		/* S45usbconfig */
+	char *path;
+	char *provides[INITRUN_NAMES + 1];
+	char *required, *should, *before;	/* header fields, as written */
+	int header;
+	int all;		/* $all */
+	int deps[INITRUN_MAX];	/* services to wait for */
+	int ndeps;
+	enum svc_state state;
+	pid_t pid;
+	long start_us, end_us;
+	int status;
+};
+
+static struct service services[INITRUN_MAX];
+static int nservices;
+static struct timespec t0;
+static FILE *logfp;
+static int kmsg = -1;
+
+static long now_us(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - t0.tv_sec) * 1000000L + (now.tv_nsec - t0.tv_nsec) / 1000;
+}
+
+static void report(const char *fmt, ...)
+{
+	char line[256];
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(line, sizeof(line), fmt, ap);
+	va_end(ap);
+	if (len < 0)
+		return;
+	if (len >= (int)sizeof(line))
+		len = sizeof(line) - 1;
+
+	if (kmsg >= 0 && write(kmsg, line, len) < 0)
+		kmsg = -1;
+	if (logfp)
+		fputs(line, logfp);
+}
+
+static char *field(const char *line, const char *key)
+{
+	size_t len = strlen(key);
+	char *value, *end;
+
+	if (strncmp(line, key, len))
+		return NULL;
+	line += len;
+	line += strspn(line, " \t");
+	value = strdup(line);
+	end = value + strlen(value);
+	while (end > value && (end[-1] == '\n' || end[-1] == ' ' || end[-1] == '\t'))
+		*--end = '\0';
+	return value;
+}
+
+static void read_header(struct service *svc)
+{
+	char *line = NULL, *value, *word, *save;
+	int in = 0, n = 0;
+	size_t size = 0;
+	FILE *fp;
+
+	fp = fopen(svc->path, "r");
+	if (!fp)
+		return;
+
+	while (getline(&line, &size, fp) > 0) {
+		if (!strncmp(line, "### BEGIN INIT INFO", 19)) {
+			in = svc->header = 1;
+			continue;
+		}
+		if (!in)
+			continue;
+		if (!strncmp(line, "### END INIT INFO", 17))
+			break;
+
+		if ((value = field(line, "# Provides:"))) {
+			for (word = strtok_r(value, " \t", &save); word && n < INITRUN_NAMES;
+			     word = strtok_r(NULL, " \t", &save))
+				svc->provides[n++] = strdup(word);
+			free(value);
+		} else if ((value = field(line, "# Required-Start:"))) {
+			svc->required = value;
+		} else if ((value = field(line, "# Should-Start:"))) {
+			svc->should = value;
+		} else if ((value = field(line, "# X-Start-Before:"))) {
+			svc->before = value;
+		}
+	}
+
+	free(line);
+	fclose(fp);
+}
+
+/* S10udev and S03modules_init.sh are known as "udev" and "modules_init" */
+static char *file_name(const char *file)
+{
+	char *name = strdup(file + 3), *dot;
+
+	dot = strstr(name, ".sh");
+	if (dot && !dot[3])
+		*dot = '\0';
+	return name;
+}
+
+static int find_service(const char *name)
+{
+	int i, n;
+
+	for (i = 0; i < nservices; i++) {
+		for (n = 0; services[i].provides[n]; n++)
+			if (!strcmp(services[i].provides[n], name))
+				return i;
+	}
+	return -1;
+}
+
+static void add_dep(int svc, int dep)
+{
+	struct service *s = &services[svc];
+	int d;
+
+	if (svc == dep)
+		return;
+	for (d = 0; d < s->ndeps; d++)
+		if (s->deps[d] == dep)
+			return;
+	s->deps[s->ndeps++] = dep;
+}
+
+static void add_named_deps(int svc, char *names, int required, int before)
+{
+	char *word, *save;
+	int dep;
+
+	if (!names)
+		return;
+	for (word = strtok_r(names, " \t", &save); word; word = strtok_r(NULL, " \t", &save)) {
+		if (!strcmp(word, "$all")) {
+			services[svc].all = 1;
+			continue;
+		}
+		if (word[0] == '$')
+			continue;
+		dep = find_service(word);
+		if (dep < 0) {
+			if (required)
+				report("initrun: %s: no %s, ignored\n", services[svc].file, word);
+			continue;
+		}
+		if (before)
+			add_dep(dep, svc);
+		else
+			add_dep(svc, dep);
+	}
+}
+
+static int filter(const struct dirent *ent)
+{
+	return ent->d_name[0] == 'S' && ent->d_name[1] >= '0' && ent->d_name[1] <= '9' &&
+	       ent->d_name[2] >= '0' && ent->d_name[2] <= '9';
+}
+
+static int scan(const char *dir)
+{
+	struct dirent **ents;
+	int i, n, barrier = -1;
+
+	n = scandir(dir, &ents, filter, alphasort);
+	if (n < 0 && errno == ENOENT)
+		return 0;
+	if (n < 0) {
+		perror(dir);
+		return -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		struct service *svc = &services[nservices];
+		int names;
+
+		if (nservices == INITRUN_MAX)
+			break;
+		/* Dangling links are skipped, like rcS does */
+		if (asprintf(&svc->path, "%s/%s", dir, ents[i]->d_name) < 0 ||
+		    access(svc->path, F_OK))
+			continue;
+
+		svc->file = strdup(ents[i]->d_name);
+		read_header(svc);
+		for (names = 0; svc->provides[names]; names++)
+			;
+		svc->provides[names] = file_name(svc->file);
+		nservices++;
+	}
+	for (i = 0; i < n; i++)
+		free(ents[i]);
+	free(ents);
+
+	for (i = 0; i < nservices; i++) {
+		struct service *svc = &services[i];
+		int d;
+
+		if (!svc->header) {
+			for (d = 0; d < i; d++)
+				add_dep(i, d);
+			barrier = i;
+			continue;
+		}
+		if (barrier >= 0)
+			add_dep(i, barrier);
+		add_named_deps(i, svc->required, 1, 0);
+		add_named_deps(i, svc->should, 0, 0);
+		add_named_deps(i, svc->before, 0, 1);
+	}
+	for (i = 0; i < nservices; i++) {
+		int d;
+
+		if (!services[i].all)
+			continue;
+		for (d = 0; d < nservices; d++)
+			if (!services[d].all)
+				add_dep(i, d);
+	}
+	return 0;
+}
+
+static void start(struct service *svc, const char *action)
+{
+	pid_t pid;
+
+	svc->start_us = now_us();
+	svc->state = SVC_RUNNING;
+
+	pid = fork();
+	if (!pid) {
+		/* rcS sources the .sh ones, they do not all have the x bit */
+		if (strlen(svc->path) > 3 && !strcmp(svc->path + strlen(svc->path) - 3, ".sh"))
+			execl("/bin/sh", "sh", svc->path, action, NULL);
+		else
+			execl(svc->path, svc->path, action, NULL);
+		_exit(127);
+	}
+	if (pid < 0) {
+		svc->state = SVC_DONE;
+		svc->status = -1;
+		svc->end_us = svc->start_us;
+		return;
+	}
+	svc->pid = pid;
+}
+
+static int ready(const struct service *svc)
+{
+	int d;
+
+	for (d = 0; d < svc->ndeps; d++)
+		if (services[svc->deps[d]].state != SVC_DONE)
+			return 0;
+	return 1;
+}
+
+static void run(const char *action, int jobs)
+{
+	int i, running = 0, done = 0, status;
+	pid_t pid;
+
+	while (done < nservices) {
+		int started = 0;
+
+		for (i = 0; i < nservices && running < jobs; i++) {
+			if (services[i].state != SVC_WAITING || !ready(&services[i]))
+				continue;
+			start(&services[i], action);
+			if (services[i].state == SVC_RUNNING)
+				running++;
+			else
+				done++;
+			started++;
+		}
+
+		if (!running) {
+			if (started)
+				continue;
+			/* A loop in the headers: fall back to the file order */
+			for (i = 0; i < nservices; i++) {
+				if (services[i].state == SVC_WAITING) {
+					report("initrun: %s: dependency loop\n", services[i].file);
+					services[i].ndeps = 0;
+					break;
+				}
+			}
+			continue;
+		}
+
+		pid = wait(&status);
+		if (pid < 0)
+			break;
+		for (i = 0; i < nservices; i++) {
+			if (services[i].state != SVC_RUNNING || services[i].pid != pid)
+				continue;
+			services[i].state = SVC_DONE;
+			services[i].end_us = now_us();
+			services[i].status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+			report("initrun: %-24s %6ld.%ld - %6ld.%ld ms%s\n", services[i].file,
+			       services[i].start_us / 1000, services[i].start_us % 1000 / 100,
+			       services[i].end_us / 1000, services[i].end_us % 1000 / 100,
+			       services[i].status ? " failed" : "");
+			running--;
+			done++;
+			break;
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	int jobs = sysconf(_SC_NPROCESSORS_ONLN), opt;
+	const char *log = NULL;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	while ((opt = getopt(argc, argv, "j:l:")) != -1) {
+		switch (opt) {
+		case 'j':
+			jobs = atoi(optarg);
+			break;
+		case 'l':
+			log = optarg;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (argc - optind != 2)
+		goto usage;
+	if (jobs < 1)
+		jobs = 1;
+
+	kmsg = open("/dev/kmsg", O_WRONLY | O_CLOEXEC);
+	if (log)
+		logfp = fopen(log, "a");
+
+	if (scan(argv[optind + 1]))
+		return 1;
+	run(argv[optind], jobs);
+	report("initrun: %s %s: %d scripts in %ld ms, %d jobs\n", argv[optind],
+	       argv[optind + 1], nservices, now_us() / 1000, jobs);
+
+	if (logfp)
+		fclose(logfp);
+	return 0;
+
+usage:
+	fprintf(stderr, "usage: %s [-j jobs] [-l log] action dir\n", argv[0]);
+	return 1;
+}
@@ -0,0 +1,574 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Boot-time module loader.
+ *
+ * Loads the modules the present devices ask for rather than every module
+ * the kernel ships. Reads modules.dep and modules.alias of the running
+ * kernel, matches the modalias of every device under /sys/devices against
+ * the aliases and loads the matches with finit_module(), one thread per
+ * CPU. A module goes in as soon as its dependencies are in. Devices the
+ * new drivers created are matched again in another round.
+ *
+ * Modules no device asks for go in /etc/modules, one name per line.
+ * Options are taken from modname.option=value on the kernel command line,
+ * as modprobe does.
+ *
+ * usage: modload [-a] [-n] [-v] [-j jobs]
+ *   -a  load every module, as the old init script did
+ *   -n  only print what would be loaded
+ *   -v  print the time every module took
+ *
+ * Copyright 2025 nekocharm <jumba.jookiba@outlook.com>
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+
+#define MODLOAD_ROUNDS	4
+#define MODLOAD_HASH	1024	/* a power of two, more than the modules */
+
+enum mod_state {
+	MOD_IDLE,
+	MOD_WANTED,	/* waiting for its dependencies */
+	MOD_QUEUED,
+	MOD_LOADED,
+	MOD_FAILED,
+};
+
+struct module {
+	char *name;		/* with underscores, as the kernel has it */
+	char *path;
+	char *options;
+	int *deps, ndeps;
+	int *users, nusers;
+	int pending;		/* dependencies not loaded yet */
+	enum mod_state state;
+	long usecs;
+};
+
+struct alias {
+	char *pattern;
+	int prefix;		/* length up to and including the ':' */
+	int module;
+};
+
+static struct module *modules;
+static int nmodules, hash[MODLOAD_HASH];
+static struct alias *aliases;
+static int naliases;
+
+static int dry_run, verbose;
+
+/* Run queue, shared by the loader threads */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static int *queue, queue_head, queue_tail;
+static int running;		/* dequeued, not finished yet */
+
+static void *xrealloc(void *ptr, size_t size)
+{
+	ptr = realloc(ptr, size);
+	if (!ptr) {
+		perror("modload");
+		exit(1);
+	}
+	return ptr;
+}
+
+static long usecs_since(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000000L +
+	       (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+static void normalize(char *name)
+{
+	for (; *name; name++)
+		if (*name == '-')
+			*name = '_';
+}
+
+static unsigned int hash_name(const char *name)
+{
+	unsigned int h = 2166136261u;
+
+	while (*name)
+		h = (h ^ (unsigned char)*name++) * 16777619u;
+	return h & (MODLOAD_HASH - 1);
+}
+
+static int find_module(const char *name)
+{
+	unsigned int h;
+
+	for (h = hash_name(name); hash[h]; h = (h + 1) & (MODLOAD_HASH - 1))
+		if (!strcmp(modules[hash[h] - 1].name, name))
+			return hash[h] - 1;
+	return -1;
+}
+
+/* "kernel/drivers/foo-bar.ko" -> "foo_bar" */
+static int add_module(const char *dir, const char *path)
+{
+	const char *base = strrchr(path, '/');
+	struct module *mod;
+	unsigned int h;
+	char *dot;
+	int i;
+
+	base = base ? base + 1 : path;
+	if (nmodules == MODLOAD_HASH - 1) {
+		fprintf(stderr, "modload: more than %d modules\n", nmodules);
+		exit(1);
+	}
+
+	modules = xrealloc(modules, (nmodules + 1) * sizeof(*modules));
+	mod = &modules[nmodules];
+	memset(mod, 0, sizeof(*mod));
+	mod->name = strdup(base);
+	dot = strchr(mod->name, '.');
+	if (dot)
+		*dot = '\0';
+	normalize(mod->name);
+
+	i = find_module(mod->name);
+	if (i >= 0) {
+		free(mod->name);
+		return i;
+	}
+
+	if (path[0] == '/')
+		mod->path = strdup(path);
+	else if (asprintf(&mod->path, "%s/%s", dir, path) < 0)
+		mod->path = NULL;
+
+	for (h = hash_name(mod->name); hash[h]; h = (h + 1) & (MODLOAD_HASH - 1))
+		;
+	hash[h] = nmodules + 1;
+	return nmodules++;
+}
+
+static void add_edge(int *(*list), int *count, int to)
+{
+	*list = xrealloc(*list, (*count + 1) * sizeof(int));
+	(*list)[(*count)++] = to;
+}
+
+/* "path: dep dep ..." per line */
+static int read_deps(const char *dir)
+{
+	char file[512], *line = NULL, *colon, *dep, *save;
+	size_t size = 0;
+	FILE *fp;
+	int mod, d;
+
+	snprintf(file, sizeof(file), "%s/modules.dep", dir);
+	fp = fopen(file, "r");
+	if (!fp) {
+		perror(file);
+		return -1;
+	}
+
+	while (getline(&line, &size, fp) > 0) {
+		colon = strchr(line, ':');
+		if (!colon)
+			continue;
+		*colon = '\0';
+		mod = add_module(dir, line);
+		for (dep = strtok_r(colon + 1, " \t\n", &save); dep;
+		     dep = strtok_r(NULL, " \t\n", &save)) {
+			d = add_module(dir, dep);
+			add_edge(&modules[mod].deps, &modules[mod].ndeps, d);
+			add_edge(&modules[d].users, &modules[d].nusers, mod);
+		}
+	}
+
+	free(line);
+	fclose(fp);
+	return 0;
+}
+
+/* "alias pattern module" per line */
+static void read_aliases(const char *dir)
+{
+	char file[512], *line = NULL, *pattern, *name, *save, *colon;
+	size_t size = 0;
+	struct alias *alias;
+	FILE *fp;
+	int mod;
+
+	snprintf(file, sizeof(file), "%s/modules.alias", dir);
+	fp = fopen(file, "r");
+	if (!fp)
+		return;
+
+	while (getline(&line, &size, fp) > 0) {
+		if (strncmp(line, "alias ", 6))
+			continue;
+		pattern = strtok_r(line + 6, " \t\n", &save);
+		name = strtok_r(NULL, " \t\n", &save);
+		if (!pattern || !name)
+			continue;
+		normalize(name);
+		mod = find_module(name);
+		if (mod < 0)
+			continue;
+
+		aliases = xrealloc(aliases, (naliases + 1) * sizeof(*aliases));
+		alias = &aliases[naliases++];
+		alias->pattern = strdup(pattern);
+		alias->module = mod;
+		/* Compared as is before fnmatch(), if there is no wildcard in it */
+		colon = strchr(alias->pattern, ':');
+		alias->prefix = colon && strcspn(alias->pattern, "*?[") > (size_t)(colon - alias->pattern) ?
+				colon - alias->pattern + 1 : 0;
+	}
+
+	free(line);
+	fclose(fp);
+}
+
+/* modname.option=value on the kernel command line */
+static void read_options(void)
+{
+	char cmdline[4096], *word, *save, *dot, *eq, *opts;
+	struct module *mod;
+	ssize_t len;
+	int fd, i;
+
+	fd = open("/proc/cmdline", O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+	len = read(fd, cmdline, sizeof(cmdline) - 1);
+	close(fd);
+	if (len <= 0)
+		return;
+	cmdline[len] = '\0';
+
+	for (word = strtok_r(cmdline, " \t\n", &save); word;
+	     word = strtok_r(NULL, " \t\n", &save)) {
+		dot = strchr(word, '.');
+		eq = strchr(word, '=');
+		if (!dot || (eq && eq < dot))
+			continue;
+		*dot = '\0';
+		normalize(word);
+		i = find_module(word);
+		if (i < 0)
+			continue;
+		mod = &modules[i];
+		if (asprintf(&opts, "%s%s%s", mod->options ? mod->options : "",
+			     mod->options ? " " : "", dot + 1) < 0)
+			continue;
+		free(mod->options);
+		mod->options = opts;
+	}
+}
+
+static int want(int i)
+{
+	struct module *mod = &modules[i];
+	int d, wanted = 0;
+
+	if (mod->state != MOD_IDLE)
+		return 0;
+	mod->state = MOD_WANTED;
+	for (d = 0; d < mod->ndeps; d++)
+		wanted += want(mod->deps[d]);
+	return wanted + 1;
+}
+
+static int want_name(const char *name)
+{
+	char buf[256];
+	int i;
+
+	snprintf(buf, sizeof(buf), "%s", name);
+	normalize(buf);
+	i = find_module(buf);
+	return i < 0 ? 0 : want(i);
+}
+
+static int want_listed(const char *file)
+{
+	char *line = NULL, *name, *save;
+	size_t size = 0;
+	int wanted = 0;
+	FILE *fp;
+
+	fp = fopen(file, "r");
+	if (!fp)
+		return 0;
+	while (getline(&line, &size, fp) > 0) {
+		name = strtok_r(line, " \t\n", &save);
+		if (name && name[0] != '#')
+			wanted += want_name(name);
+	}
+	free(line);
+	fclose(fp);
+	return wanted;
+}
+
+static int round_wanted;
+
+static int match_modalias(const char *path, const struct stat *st, int type,
+			  struct FTW *ftw)
+{
+	char modalias[512];
+	ssize_t len;
+	int fd, i;
+
+	(void)st;
+	if (type != FTW_F || strcmp(path + ftw->base, "modalias"))
+		return 0;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+	len = read(fd, modalias, sizeof(modalias) - 1);
+	close(fd);
+	if (len <= 0)
+		return 0;
+	while (len && modalias[len - 1] == '\n')
+		len--;
+	modalias[len] = '\0';
+
+	for (i = 0; i < naliases; i++) {
+		if (modules[aliases[i].module].state != MOD_IDLE)
+			continue;
+		if (aliases[i].prefix && strncmp(aliases[i].pattern, modalias, aliases[i].prefix))
+			continue;
+		if (!fnmatch(aliases[i].pattern, modalias, 0))
+			round_wanted += want(aliases[i].module);
+	}
+	return 0;
+}
+
+static int want_devices(void)
+{
+	round_wanted = 0;
+	nftw("/sys/devices", match_modalias, 32, FTW_PHYS);
+	return round_wanted;
+}
+
+/* Called with the lock held */
+static void finish(int i, int loaded)
+{
+	struct module *mod = &modules[i];
+	int u;
+
+	mod->state = loaded ? MOD_LOADED : MOD_FAILED;
+
+	for (u = 0; u < mod->nusers; u++) {
+		struct module *user = &modules[mod->users[u]];
+
+		if (user->state != MOD_WANTED)
+			continue;
+		if (!loaded) {
+			fprintf(stderr, "modload: skipping %s, %s is missing\n",
+				user->name, mod->name);
+			finish(mod->users[u], 0);
+		} else if (!--user->pending) {
+			user->state = MOD_QUEUED;
+			queue[queue_tail++] = mod->users[u];
+		}
+	}
+	pthread_cond_broadcast(&cond);
+}
+
+static int load(struct module *mod)
+{
+	struct timespec start;
+	int fd, ret = 0;
+
+	if (dry_run) {
+		printf("%s %s\n", mod->path, mod->options ? mod->options : "");
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	fd = open(mod->path, O_RDONLY | O_CLOEXEC);
+	if (fd >= 0) {
+		ret = syscall(SYS_finit_module, fd, mod->options ? mod->options : "", 0);
+		close(fd);
+	}
+	if (fd < 0 || (ret && errno != EEXIST)) {
+		fprintf(stderr, "modload: %s: %s\n", mod->name, strerror(errno));
+		return 0;
+	}
+	mod->usecs = usecs_since(&start);
+	return 1;
+}
+
+static void *loader(void *arg)
+{
+	int i, loaded;
+
+	(void)arg;
+	pthread_mutex_lock(&lock);
+	for (;;) {
+		/* Only a module that is still loading can queue another one */
+		while (queue_head == queue_tail && running)
+			pthread_cond_wait(&cond, &lock);
+		if (queue_head == queue_tail)
+			break;
+		i = queue[queue_head++];
+		running++;
+		pthread_mutex_unlock(&lock);
+
+		loaded = load(&modules[i]);
+
+		pthread_mutex_lock(&lock);
+		running--;
+		finish(i, loaded);
+	}
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+/* Loads what want() marked */
+static void run(int jobs)
+{
+	pthread_t threads[jobs];
+	int i, d, started = 0, failed;
+
+	queue_head = queue_tail = 0;
+	running = 0;
+
+	/* Users of a module that failed in an earlier round cannot load */
+	do {
+		failed = 0;
+		for (i = 0; i < nmodules; i++) {
+			struct module *mod = &modules[i];
+
+			if (mod->state != MOD_WANTED)
+				continue;
+			for (d = 0; d < mod->ndeps; d++) {
+				if (modules[mod->deps[d]].state != MOD_FAILED)
+					continue;
+				fprintf(stderr, "modload: skipping %s, %s is missing\n",
+					mod->name, modules[mod->deps[d]].name);
+				mod->state = MOD_FAILED;
+				failed = 1;
+				break;
+			}
+		}
+	} while (failed);
+
+	for (i = 0; i < nmodules; i++) {
+		struct module *mod = &modules[i];
+
+		if (mod->state != MOD_WANTED)
+			continue;
+		mod->pending = 0;
+		for (d = 0; d < mod->ndeps; d++)
+			if (modules[mod->deps[d]].state != MOD_LOADED)
+				mod->pending++;
+	}
+	for (i = 0; i < nmodules; i++) {
+		if (modules[i].state == MOD_WANTED && !modules[i].pending) {
+			modules[i].state = MOD_QUEUED;
+			queue[queue_tail++] = i;
+		}
+	}
+
+	for (i = 0; i < jobs; i++)
+		if (!pthread_create(&threads[started], NULL, loader, NULL))
+			started++;
+	if (!started)
+		loader(NULL);
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	/* Left over: dependency loops */
+	for (i = 0; i < nmodules; i++) {
+		if (modules[i].state == MOD_WANTED) {
+			fprintf(stderr, "modload: %s: dependency loop\n", modules[i].name);
+			modules[i].state = MOD_FAILED;
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct timespec start;
+	struct utsname uts;
+	int jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	int all = 0, loaded = 0, round, i, opt;
+	char dir[256];
+
+	while ((opt = getopt(argc, argv, "anvj:")) != -1) {
+		switch (opt) {
+		case 'a':
+			all = 1;
+			break;
+		case 'n':
+			dry_run = 1;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		case 'j':
+			jobs = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-a] [-n] [-v] [-j jobs]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (jobs < 1)
+		jobs = 1;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	uname(&uts);
+	snprintf(dir, sizeof(dir), "/lib/modules/%s", uts.release);
+	if (read_deps(dir))
+		return 1;
+	read_aliases(dir);
+	read_options();
+	queue = xrealloc(NULL, (nmodules + 1) * sizeof(int));
+
+	if (all) {
+		for (i = 0; i < nmodules; i++)
+			want(i);
+	} else {
+		want_listed("/etc/modules");
+		want_devices();
+	}
+
+	for (round = 0; round < MODLOAD_ROUNDS; round++) {
+		run(jobs);
+		/* The drivers just loaded may have added devices */
+		if (all || dry_run || !want_devices())
+			break;
+	}
+
+	loaded = 0;
+	for (i = 0; i < nmodules; i++) {
+		if (modules[i].state != MOD_LOADED)
+			continue;
+		loaded++;
+		if (verbose && !dry_run)
+			printf("modload: %-24s %6ld.%03ld ms\n", modules[i].name,
+			       modules[i].usecs / 1000, modules[i].usecs % 1000);
+	}
+	if (!dry_run)
+		printf("modload: %d of %d modules in %ld ms, %d jobs\n", loaded,
+		       nmodules, usecs_since(&start) / 1000, jobs);
+	return 0;
+}
@@ -0,0 +1,518 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Boot-time readahead of the root image.
+ *
+ * Right after pre_init has set up the overlay, reads the pages the last
+ * reference boot needed from the root, while init runs. They are read as
+ * large ranges, in the order their files were first opened, one thread
+ * per CPU so squashfs decompresses on every core. The SD card is much
+ * faster at that than at the small random reads of the page faults.
+ *
+ * A new list is recorded when there is none, or when it is of another
+ * root image, e.g. after an update. The files opened on / are collected
+ * with fanotify until the "bootmark: first-frame" line shows up in the
+ * kernel log, which inittab writes as the login prompt comes up on the
+ * panel, or the time is up. mincore() then tells which of their pages
+ * were read. Ranges closer than a squashfs block are merged into one.
+ *
+ * The list lives on the overlay partition, outside of the merged root:
+ *
+ *   # prefetch squashfs-1f3a96c2b07d5e41
+ *   /usr/bin/retroarch 0 2359296
+ *
+ * It runs in the background once it is ready to record or has read the
+ * list, so whatever init opens is seen.
+ *
+ * usage: prefetch [-r] [-f] [-t seconds] [-j jobs] [-l lower] list
+ *   -r  record even if the list is of this root image
+ *   -f  stay in the foreground
+ *
+ * Copyright 2025 nekocharm <jumba.jookiba@outlook.com>
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <search.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/fanotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#define PREFETCH_FILES	16384
+#define PREFETCH_GAP	(64 * 1024)	/* the squashfs block size */
+#define PREFETCH_MARK	"bootmark: first-frame"
+
+struct range {
+	int file;
+	off_t offset, length;
+};
+
+static char **files;
+static int nfiles;
+static struct range *ranges;
+static int nranges;
+
+static struct timespec t0;
+static int kmsg = -1;
+
+/* Replay queue, files are handed out whole and in order */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static int next_range;
+static long long replayed;
+
+static void *xrealloc(void *ptr, size_t size)
+{
+	ptr = realloc(ptr, size);
+	if (!ptr) {
+		perror("prefetch");
+		exit(1);
+	}
+	return ptr;
+}
+
+static long msecs(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - t0.tv_sec) * 1000L + (now.tv_nsec - t0.tv_nsec) / 1000000;
+}
+
+static void report(const char *fmt, ...)
+{
+	char line[256];
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(line, sizeof(line), fmt, ap);
+	va_end(ap);
+	if (len < 0)
+		return;
+	if (len >= (int)sizeof(line))
+		len = sizeof(line) - 1;
+
+	if (kmsg < 0 || write(kmsg, line, len) < 0)
+		fputs(line, stderr);
+}
+
+static uint64_t fnv(uint64_t hash, const unsigned char *p, size_t len)
+{
+	while (len--)
+		hash = (hash ^ *p++) * 0x100000001b3ULL;
+	return hash;
+}
+
+/*
+ * Names the image under lower by its superblock: all of it for squashfs,
+ * which is never written, the UUID and creation time for ext4.
+ */
+static int image_id(const char *lower, char *id, size_t size)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	char path[64], line[128], dev[160] = "";
+	unsigned char sb[2048];
+	struct stat st;
+	FILE *fp;
+	int fd, len;
+
+	if (stat(lower, &st))
+		return -1;
+	snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/uevent",
+		 major(st.st_dev), minor(st.st_dev));
+	fp = fopen(path, "r");
+	if (!fp)
+		return -1;
+	while (fgets(line, sizeof(line), fp)) {
+		if (!strncmp(line, "DEVNAME=", 8))
+			snprintf(dev, sizeof(dev), "/dev/%.*s",
+				 (int)strcspn(line + 8, "\n"), line + 8);
+	}
+	fclose(fp);
+
+	fd = open(dev, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	len = pread(fd, sb, sizeof(sb), 0);
+	close(fd);
+	if (len != sizeof(sb))
+		return -1;
+
+	if (!memcmp(sb, "hsqs", 4)) {
+		hash = fnv(hash, sb, 96);
+		snprintf(id, size, "squashfs-%016llx", (unsigned long long)hash);
+		return 0;
+	}
+	if (sb[1024 + 0x38] == 0x53 && sb[1024 + 0x39] == 0xef) {
+		hash = fnv(hash, sb + 1024 + 0x68, 16);
+		hash = fnv(hash, sb + 1024 + 0x108, 4);
+		snprintf(id, size, "ext4-%016llx", (unsigned long long)hash);
+		return 0;
+	}
+	return -1;
+}
+
+/* Returns 0 if the list is of this image, ranges are then loaded */
+static int load_list(const char *list, const char *id)
+{
+	char *line = NULL, *len, *off;
+	size_t size = 0;
+	int match = 0;
+	FILE *fp;
+
+	fp = fopen(list, "r");
+	if (!fp)
+		return -1;
+
+	while (getline(&line, &size, fp) > 0) {
+		line[strcspn(line, "\n")] = '\0';
+		if (line[0] == '#') {
+			match = !strncmp(line, "# prefetch ", 11) && !strcmp(line + 11, id);
+			if (!match)
+				break;
+			continue;
+		}
+		/* The path may have spaces, the numbers are the last two words */
+		len = strrchr(line, ' ');
+		if (!len)
+			continue;
+		*len++ = '\0';
+		off = strrchr(line, ' ');
+		if (!off)
+			continue;
+		*off++ = '\0';
+
+		if (!nfiles || strcmp(files[nfiles - 1], line)) {
+			files = xrealloc(files, (nfiles + 1) * sizeof(*files));
+			files[nfiles++] = strdup(line);
+		}
+		ranges = xrealloc(ranges, (nranges + 1) * sizeof(*ranges));
+		ranges[nranges].file = nfiles - 1;
+		ranges[nranges].offset = strtoll(off, NULL, 10);
+		ranges[nranges].length = strtoll(len, NULL, 10);
+		nranges++;
+	}
+
+	free(line);
+	fclose(fp);
+	return match ? 0 : -1;
+}
+
+static void *replayer(void *arg)
+{
+	int first, last, file, fd;
+	long long bytes;
+
+	(void)arg;
+	for (;;) {
+		pthread_mutex_lock(&lock);
+		first = next_range;
+		if (first == nranges) {
+			pthread_mutex_unlock(&lock);
+			break;
+		}
+		file = ranges[first].file;
+		for (last = first; last < nranges && ranges[last].file == file; last++)
+			;
+		next_range = last;
+		pthread_mutex_unlock(&lock);
+
+		fd = open(files[file], O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			continue;
+		/* Blocks until squashfs has decompressed, so it is paced */
+		for (bytes = 0; first < last; first++) {
+			if (!posix_fadvise(fd, ranges[first].offset, ranges[first].length,
+					   POSIX_FADV_WILLNEED))
+				bytes += ranges[first].length;
+		}
+		close(fd);
+
+		pthread_mutex_lock(&lock);
+		replayed += bytes;
+		pthread_mutex_unlock(&lock);
+	}
+	return NULL;
+}
+
+static void replay(int jobs)
+{
+	pthread_t threads[jobs];
+	int i, started = 0;
+
+	for (i = 0; i < jobs; i++)
+		if (!pthread_create(&threads[started], NULL, replayer, NULL))
+			started++;
+	if (!started)
+		replayer(NULL);
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	report("prefetch: %d files, %lld MiB in %ld ms, %d jobs\n", nfiles,
+	       replayed >> 20, msecs(), jobs);
+}
+
+static void add_file(int fd)
+{
+	char link[32], path[PATH_MAX];
+	struct stat st;
+	ENTRY e;
+	int len;
+
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode) || !st.st_size)
+		return;
+	snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+	len = readlink(link, path, sizeof(path) - 1);
+	if (len <= 0)
+		return;
+	path[len] = '\0';
+	if (path[0] != '/' || strchr(path, '\n') || strstr(path, " (deleted)"))
+		return;
+
+	e.key = path;
+	e.data = NULL;
+	if (hsearch(e, FIND))
+		return;
+	e.key = strdup(path);
+	if (!e.key || !hsearch(e, ENTER))
+		return;
+	files = xrealloc(files, (nfiles + 1) * sizeof(*files));
+	files[nfiles++] = e.key;
+}
+
+/* Collects the files opened until the first frame or the timeout */
+static void record(int fan, int seconds)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct fanotify_event_metadata))));
+	struct fanotify_event_metadata *ev;
+	struct pollfd pfd[2];
+	int overflow = 0, watch;
+	pid_t self = getpid();
+	long end;
+	ssize_t len;
+
+	/* Only lines logged from now on */
+	watch = open("/dev/kmsg", O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (watch >= 0)
+		lseek(watch, 0, SEEK_END);
+
+	pfd[0].fd = fan;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = watch;
+	pfd[1].events = POLLIN;
+
+	end = msecs() + seconds * 1000L;
+	for (;;) {
+		long left = end - msecs();
+
+		if (left <= 0)
+			break;
+		if (poll(pfd, 2, left) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		if (pfd[1].revents & POLLIN) {
+			len = read(watch, buf, sizeof(buf) - 1);
+			if (len > 0) {
+				buf[len] = '\0';
+				if (strstr(buf, PREFETCH_MARK))
+					break;
+			}
+		}
+
+		if (!(pfd[0].revents & POLLIN))
+			continue;
+		len = read(fan, buf, sizeof(buf));
+		for (ev = (void *)buf; len > 0 && FAN_EVENT_OK(ev, len); ev = FAN_EVENT_NEXT(ev, len)) {
+			if (ev->vers != FANOTIFY_METADATA_VERSION)
+				break;
+			if (ev->mask & FAN_Q_OVERFLOW)
+				overflow = 1;
+			if (ev->fd < 0)
+				continue;
+			if (ev->pid != self)
+				add_file(ev->fd);
+			close(ev->fd);
+		}
+	}
+
+	if (watch >= 0)
+		close(watch);
+	close(fan);
+	if (overflow)
+		report("prefetch: events were lost, the list is incomplete\n");
+}
+
+/* Turns the pages of the files that are in the page cache into ranges */
+static void add_ranges(int file, FILE *out)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	off_t start = -1, last = 0, n, pages;
+	unsigned char *vec;
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = open(files[file], O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+	if (fstat(fd, &st) || !st.st_size) {
+		close(fd);
+		return;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return;
+
+	pages = (st.st_size + page - 1) / page;
+	vec = malloc(pages);
+	if (vec && !mincore(map, st.st_size, vec)) {
+		for (n = 0; n <= pages; n++) {
+			if (n < pages && !(vec[n] & 1))
+				continue;
+			if (n < pages && start >= 0 && (n - last - 1) * page < PREFETCH_GAP) {
+				last = n;
+				continue;
+			}
+			if (start >= 0) {
+				off_t length = (last + 1) * page;
+
+				if (length > st.st_size)
+					length = st.st_size;
+				length -= start * page;
+				fprintf(out, "%s %lld %lld\n", files[file],
+					(long long)start * page, (long long)length);
+				nranges++;
+			}
+			start = last = n;
+		}
+	}
+
+	free(vec);
+	munmap(map, st.st_size);
+}
+
+static int save_list(const char *list, const char *id)
+{
+	char tmp[PATH_MAX];
+	FILE *out;
+	int i;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", list);
+	out = fopen(tmp, "w");
+	if (!out) {
+		report("prefetch: %s: %s\n", tmp, strerror(errno));
+		return -1;
+	}
+	fprintf(out, "# prefetch %s\n", id);
+	for (i = 0; i < nfiles; i++)
+		add_ranges(i, out);
+	fflush(out);
+	fsync(fileno(out));
+	if (fclose(out) || rename(tmp, list)) {
+		report("prefetch: %s: %s\n", list, strerror(errno));
+		unlink(tmp);
+		return -1;
+	}
+	report("prefetch: recorded %d files, %d ranges for %s\n", nfiles, nranges, id);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int jobs = sysconf(_SC_NPROCESSORS_ONLN), seconds = 60;
+	int force = 0, foreground = 0, fan = -1, opt;
+	const char *lower = "/overlay/lower", *list;
+	char id[64];
+	pid_t pid;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	while ((opt = getopt(argc, argv, "rft:j:l:")) != -1) {
+		switch (opt) {
+		case 'r':
+			force = 1;
+			break;
+		case 'f':
+			foreground = 1;
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		case 'j':
+			jobs = atoi(optarg);
+			break;
+		case 'l':
+			lower = optarg;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (argc - optind != 1)
+		goto usage;
+	list = argv[optind];
+	if (jobs < 1)
+		jobs = 1;
+
+	kmsg = open("/dev/kmsg", O_WRONLY | O_CLOEXEC);
+
+	if (image_id(lower, id, sizeof(id))) {
+		report("prefetch: no root image under %s\n", lower);
+		return 1;
+	}
+
+	/* Set up before going to the background, so init is not missed */
+	if (force || load_list(list, id)) {
+		fan = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK,
+				    O_RDONLY | O_LARGEFILE | O_CLOEXEC);
+		if (fan < 0 || fanotify_mark(fan, FAN_MARK_ADD | FAN_MARK_MOUNT,
+					     FAN_OPEN, AT_FDCWD, "/")) {
+			report("prefetch: fanotify: %s\n", strerror(errno));
+			return 1;
+		}
+		if (!hcreate(PREFETCH_FILES)) {
+			perror("prefetch");
+			return 1;
+		}
+		free(files);
+		files = NULL;
+		nfiles = nranges = 0;
+	}
+
+	if (!foreground) {
+		pid = fork();
+		if (pid < 0) {
+			perror("prefetch");
+			return 1;
+		}
+		if (pid)
+			return 0;
+		setsid();
+	}
+
+	if (fan >= 0) {
+		record(fan, seconds);
+		return save_list(list, id) ? 1 : 0;
+	}
+	replay(jobs);
+	return 0;
+
+usage:
+	fprintf(stderr, "usage: %s [-r] [-f] [-t seconds] [-j jobs] [-l lower] list\n", argv[0]);
+	return 1;
+}
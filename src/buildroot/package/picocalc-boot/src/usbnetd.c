@@ -0,0 +1,252 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Brings up the USB gadget network interface as soon as it appears.
+ *
+ * Listens for link messages on rtnetlink instead of polling. Whenever
+ * usb0 shows up, at start or when the gadget function is bound again,
+ * it gets the MAC saved in /etc/.usb0_macaddr (the first MAC it had is
+ * saved there otherwise), is brought up and gets its static address. A
+ * cable replug only drops and restores the carrier, which is logged; the
+ * configuration stays on the interface.
+ *
+ * usage: usbnetd [-i ifname] [-a address] [-m macfile]
+ *
+ * Copyright 2025 nekocharm <jumba.jookiba@outlook.com>
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <netinet/in.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+static const char *ifname = "usb0";
+static const char *address = "192.168.123.100";
+static const char *macfile = "/etc/.usb0_macaddr";
+
+static int seen_index, configured_index;
+static int carrier = -1;
+
+static int ifreq_ioctl(int fd, unsigned long req, struct ifreq *ifr, const char *what)
+{
+	snprintf(ifr->ifr_name, IFNAMSIZ, "%s", ifname);
+	if (ioctl(fd, req, ifr) < 0) {
+		fprintf(stderr, "usbnetd: %s %s: %s\n", what, ifname, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+static int parse_mac(const char *text, unsigned char *mac)
+{
+	return sscanf(text, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
+		      &mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5]) == 6 ? 0 : -1;
+}
+
+/* Applies the saved MAC, or saves the current one */
+static void set_mac(int fd)
+{
+	unsigned char *mac;
+	struct ifreq ifr;
+	char text[32];
+	FILE *fp;
+
+	memset(&ifr, 0, sizeof(ifr));
+	if (ifreq_ioctl(fd, SIOCGIFHWADDR, &ifr, "get MAC of"))
+		return;
+	mac = (unsigned char *)ifr.ifr_hwaddr.sa_data;
+
+	fp = fopen(macfile, "r");
+	if (fp) {
+		if (fgets(text, sizeof(text), fp) && !parse_mac(text, mac)) {
+			fclose(fp);
+			ifr.ifr_hwaddr.sa_family = ARPHRD_ETHER;
+			if (!ifreq_ioctl(fd, SIOCSIFHWADDR, &ifr, "set MAC of"))
+				printf("usbnetd: set %s MAC address to %s", ifname, text);
+			return;
+		}
+		fclose(fp);
+	}
+
+	fp = fopen(macfile, "w");
+	if (!fp)
+		return;
+	fprintf(fp, "%02x:%02x:%02x:%02x:%02x:%02x\n",
+		mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+	fclose(fp);
+	printf("usbnetd: saved %s MAC address to %s\n", ifname, macfile);
+}
+
+static void configure(int index)
+{
+	struct sockaddr_in *sin;
+	struct ifreq ifr;
+	int fd;
+
+	fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return;
+
+	/* The MAC only changes while the interface is down */
+	memset(&ifr, 0, sizeof(ifr));
+	if (ifreq_ioctl(fd, SIOCGIFFLAGS, &ifr, "get flags of"))
+		goto out;
+	if (ifr.ifr_flags & IFF_UP) {
+		ifr.ifr_flags &= ~IFF_UP;
+		ifreq_ioctl(fd, SIOCSIFFLAGS, &ifr, "down");
+	}
+	set_mac(fd);
+
+	memset(&ifr, 0, sizeof(ifr));
+	sin = (struct sockaddr_in *)&ifr.ifr_addr;
+	sin->sin_family = AF_INET;
+	inet_pton(AF_INET, address, &sin->sin_addr);
+	if (ifreq_ioctl(fd, SIOCSIFADDR, &ifr, "set address of"))
+		goto out;
+	sin = (struct sockaddr_in *)&ifr.ifr_netmask;
+	sin->sin_family = AF_INET;
+	inet_pton(AF_INET, "255.255.255.0", &sin->sin_addr);
+	ifreq_ioctl(fd, SIOCSIFNETMASK, &ifr, "set netmask of");
+
+	memset(&ifr, 0, sizeof(ifr));
+	if (ifreq_ioctl(fd, SIOCGIFFLAGS, &ifr, "get flags of"))
+		goto out;
+	ifr.ifr_flags |= IFF_UP;
+	if (ifreq_ioctl(fd, SIOCSIFFLAGS, &ifr, "up"))
+		goto out;
+
+	configured_index = index;
+	carrier = -1;
+	printf("usbnetd: %s up at %s\n", ifname, address);
+out:
+	close(fd);
+}
+
+static void link_changed(struct nlmsghdr *nh)
+{
+	struct ifinfomsg *ifi = NLMSG_DATA(nh);
+	int len = IFLA_PAYLOAD(nh), running;
+	struct rtattr *rta;
+
+	for (rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type == IFLA_IFNAME && !strcmp(RTA_DATA(rta), ifname))
+			break;
+	}
+	if (!RTA_OK(rta, len))
+		return;
+
+	if (nh->nlmsg_type == RTM_DELLINK) {
+		printf("usbnetd: %s removed\n", ifname);
+		seen_index = configured_index = 0;
+		carrier = -1;
+		return;
+	}
+
+	/*
+	 * A new index is a new interface, e.g. the gadget was bound again.
+	 * Tried once per interface, configure() itself causes link messages.
+	 */
+	if (ifi->ifi_index != seen_index) {
+		seen_index = ifi->ifi_index;
+		configure(ifi->ifi_index);
+	}
+
+	/* Our own down and up in configure() are no replug */
+	if (!(ifi->ifi_flags & IFF_UP))
+		return;
+	running = !!(ifi->ifi_flags & IFF_RUNNING);
+	if (running != carrier && configured_index) {
+		if (carrier >= 0)
+			printf("usbnetd: %s %s\n", ifname, running ? "connected" : "disconnected");
+		carrier = running;
+	}
+}
+
+static int request_links(int fd)
+{
+	struct {
+		struct nlmsghdr nh;
+		struct ifinfomsg ifi;
+	} req;
+
+	memset(&req, 0, sizeof(req));
+	req.nh.nlmsg_len = sizeof(req);
+	req.nh.nlmsg_type = RTM_GETLINK;
+	req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.ifi.ifi_family = AF_UNSPEC;
+	return send(fd, &req, sizeof(req), 0) < 0 ? -1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct sockaddr_nl sa;
+	char buf[8192];
+	int fd, opt;
+
+	while ((opt = getopt(argc, argv, "i:a:m:")) != -1) {
+		switch (opt) {
+		case 'i':
+			ifname = optarg;
+			break;
+		case 'a':
+			address = optarg;
+			break;
+		case 'm':
+			macfile = optarg;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-i ifname] [-a address] [-m macfile]\n", argv[0]);
+			return 1;
+		}
+	}
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (fd < 0) {
+		perror("usbnetd: netlink");
+		return 1;
+	}
+	memset(&sa, 0, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+	sa.nl_groups = RTMGRP_LINK;
+	if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+		perror("usbnetd: bind");
+		return 1;
+	}
+
+	/* Subscribed first, so an interface appearing now is not missed */
+	if (request_links(fd)) {
+		perror("usbnetd: dump links");
+		return 1;
+	}
+
+	for (;;) {
+		struct nlmsghdr *nh;
+		ssize_t len;
+
+		len = recv(fd, buf, sizeof(buf), 0);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			/* Messages were lost, start over from a dump */
+			if (errno == ENOBUFS && !request_links(fd))
+				continue;
+			perror("usbnetd: recv");
+			return 1;
+		}
+
+		for (nh = (struct nlmsghdr *)buf; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+			if (nh->nlmsg_type == RTM_NEWLINK || nh->nlmsg_type == RTM_DELLINK)
+				link_changed(nh);
+		}
+	}
+}
@@ -0,0 +1 @@
+../../../../kernel-6.1/include/soc/picocalc/ima_adpcm.h
\ No newline at end of file
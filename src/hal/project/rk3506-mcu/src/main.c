@@ -5,6 +5,16 @@
 
 #include "hal_bsp.h"
 #include "hal_base.h"
+#include "spsc_ring.h"
+#include "softpwm.h"
+#include "ima_adpcm.h"
+#include "rpmsg_lite.h"
+#include "rpmsg_ns.h"
+#include "mcu_rpmsg.h"
+#include "shm_table.h"
+#include "keyboard.h"
+#include "panel.h"
+#include "mcu_stats.h"
 
 /********************* Private MACRO Definition ******************************/
 //#define TEST_DEMO
@@ -12,54 +22,234 @@ extern uint32_t __linux_share_memory_start__[];
 extern uint32_t __linux_share_memory_end__[];
 #define SHMEM_LINUX_MEM_BASE ((uint32_t)&__linux_share_memory_start__)
 #define SHMEM_LINUX_MEM_END  ((uint32_t)&__linux_share_memory_end__)
-#define SHMEM_LINUX_MEM_SIZE (2UL * RL_VRING_OVERHEAD)
 
-#define MCULOG_OFFSET 32
-#define SOFTPWM_OFFSET 0
+/* RPMsg vrings, the "rockchip,rpmsg" node of the device tree */
+extern uint32_t __linux_rpmsg_start__[];
+extern uint32_t __linux_rpmsg_end__[];
+#define RPMSG_LINUX_MEM_BASE ((uint32_t)&__linux_rpmsg_start__)
+#define RPMSG_LINUX_MEM_END  ((uint32_t)&__linux_rpmsg_end__)
+#define RPMSG_LINUX_MEM_SIZE (2UL * RL_VRING_OVERHEAD)
+#define RPMSG_LINK_ID        RL_PLATFORM_SET_LINK_ID(0, 3)
 
-//#define STEREO
+/* Services this firmware offers over the command channel */
+#define MCU_CAPS (PICOCALC_CAP_SOFTPWM | PICOCALC_CAP_MCULOG | PICOCALC_CAP_KEYBOARD | \
+                  PICOCALC_CAP_PANEL)
 
-/********************* Private Structure Definition **************************/
-struct mculog_buffer {
-    unsigned int init_flag;
-    unsigned int max_size;
-    size_t head;
-    size_t tail;
-    unsigned char buf[0];
-};
+/* Received RPMsg buffers held for the main loop, a power of two */
+#define RPMSG_RX_SLOTS 4
 
-struct softpwm_config {
-    unsigned int left_duty;
-    unsigned int right_duty;
-};
+/*
+ * Doorbell, see the "doorbell" mbox of the Linux drivers. The MCU rings it
+ * per played period, Linux rings it back after changing softpwm->state.
+ */
+#define DOORBELL_MBOX MBOX0
+#define DOORBELL_CHAN MBOX_CH_0
+#define DOORBELL_IRQ  MBOX0_CH0_A2B_IRQn
+
+/* Fallback poll of the shared state, for kernels that do not ring, 0: off */
+#define POLL_MS 10
+
+/*
+ * Keyboard controller on I2C0, polled while Linux has the keyboard ring
+ * open. Events go out on their own doorbell channel, see keyboard.h.
+ */
+#define KBD_I2C           I2C0
+#define KBD_I2C_CLK       CLK_I2C0
+#define KBD_I2C_ADDR      0x1f
+#define KBD_I2C_SPINS     100000    /* polled transfer timeout */
+#define KBD_DOORBELL_CHAN MBOX_CH_3
+#define KBD_POLL_MS       5
+#define KBD_FIFO_MAX      8         /* events taken per poll */
+
+/*
+ * Panel on SPI0, the spi-lcd node of the device tree. Linux keeps off the
+ * bus while a flush is queued here, see panel.h.
+ */
+#define PANEL_SPI         SPI0
+#define PANEL_SPI_CLK     CLK_SPI0
+#define PANEL_SPI_HZ      80000000
+#define PANEL_CS          0
+#define PANEL_DC_GPIO     GPIO0
+#define PANEL_DC_PIN      GPIO_PIN_A3
+#define PANEL_LINES       8         /* lines per main loop pass, ~0.5 ms */
+#define PANEL_CASET       0x2a
+#define PANEL_PASET       0x2b
+#define PANEL_RAMWR       0x2c
+
+#define PWM_LEFT_PIN  GPIO_PIN_B2
+#define PWM_RIGHT_PIN GPIO_PIN_B3
+#define PWM_PINS      (PWM_LEFT_PIN | PWM_RIGHT_PIN)
+
+/*
+ * Two PWM1 channels make the carrier, the timer only ticks once per
+ * sample to load the next duties. Where PWM1 does not reach the pins the
+ * edge engine takes over: the timer interrupts on every PWM edge (two to
+ * three per carrier cycle) and toggles the pins, which works on any GPIO.
+ *
+ * FUNC1 of GPIO4 B2/B3 being PWM1 channel 2/3 is not confirmed by any
+ * RK3506 document at hand, and every other peripheral of this board
+ * (I2C0, SPI0/1, PWM0) reaches its pins through the RMIO matrix, see the
+ * rm_io* pinctrl groups in the device tree. So pwm_probe() reads the pads
+ * back at boot to pick the engine.
+ */
+#define PWM_DEV       PWM1
+#define PWM_CLK       CLK_PWM1
+#define PWM_LEFT_CH   2
+#define PWM_RIGHT_CH  3
+#define PWM_PINS_FUNC PIN_CONFIG_MUX_FUNC1
+
+/*
+ * PWM v4 channel registers, one 4 KB block per channel from PWM_DEV. The
+ * layout is only trusted once it reads back what the HAL programmed, see
+ * softpwm_start().
+ */
+#define PWM_CH_STRIDE      0x1000
+#define PWM_REG_ENABLE     0x004
+#define PWM_REG_PERIOD     0x010
+#define PWM_REG_DUTY       0x014
+#define PWM_CTRL_UPDATE_EN 0x00040004   /* write masked, latch period/duty */
+
+/* Carrier of pwm_probe(), and how long the pads get to follow a duty */
+#define PWM_PROBE_NS 10000
+#define PWM_PROBE_US 30
+
+/*
+ * Free-running time base of the load and interrupt accounting. SysTick is
+ * left to the HAL tick, which may run it with a 1 ms reload. TIMER0 was
+ * the right channel timer of the old two timer softpwm and is clocked for
+ * the MCU (CLK_TIMER0_CH0 of the rockchip-amp node). Its 64 bit count is
+ * never reloaded, so the low word wraps cleanly every ~179 s.
+ */
+#define CYCLE_TIMER TIMER0
+#define CYCLE_HZ    SOFTPWM_TIMER_HZ
+
+/* Sample ticks per MCU load window, ~0.19 s at 22.05 kHz */
+#define LOAD_WINDOW 4096
+
+/* No timer behind the interrupt, see stats_isr() */
+#define STATS_NO_LATENCY 0xffffffffU
+
+#define MCULOG_SYNC_LINUX 0x4D43554C
+#define MCULOG_SYNC_MCU   0x554C4F47
 
 /********************* Private Variable Definition ***************************/
-volatile struct mculog_buffer *logbuf;
-volatile struct softpwm_config *softpwm;
-
-#ifdef STEREO
-static struct TIMER_REG *left_timer = TIMER4;
-static uint32_t left_timer_irq = TIMER4_IRQn;
-static bool left_enable = false;
-static bool left_flag = true;
-
-static struct TIMER_REG *right_timer = TIMER0;
-static uint32_t right_timer_irq = TIMER0_IRQn;
-static bool right_enable = false;
-static bool right_flag = true;
-#else
+static struct picocalc_shm_table *shm_table;
+static struct spsc_ring logring;
+static struct softpwm_shm *softpwm;
+static struct spsc_ring sample_ring;
+
 static struct TIMER_REG *timer = TIMER4;
 static uint32_t timer_irq = TIMER4_IRQn;
-static bool enable = false;
-static bool flag = true;
-#endif
+static volatile bool enable = false;
+static struct TIMER_REG *poll_timer = TIMER5;
+static uint32_t poll_timer_irq = TIMER5_IRQn;
+
+/* Work for the main loop, set from interrupts, see main() */
+#define EVENT_DOORBELL HAL_BIT(0)
+#define EVENT_POLL     HAL_BIT(1)
+#define EVENT_STOP     HAL_BIT(2)
+#define EVENT_LOAD     HAL_BIT(3)
+#define EVENT_RPMSG    HAL_BIT(4)
+static volatile uint32_t events;
+
+/* RPMsg command channel, see mcu_rpmsg.h */
+static struct rpmsg_lite_instance rpmsg_ctx;
+static struct rpmsg_lite_ept_static_context rpmsg_ept_ctx;
+static struct rpmsg_lite_instance *rpmsg;
+static struct rpmsg_lite_endpoint *rpmsg_ept;
+static uint32_t rpmsg_remote = RL_ADDR_ANY;     /* Linux, from its HELLO */
+static uint32_t rpmsg_caps;
+static struct rpmsg_rx_slot {
+    void *data;
+    uint32_t len;
+    uint32_t src;
+} rpmsg_rx[RPMSG_RX_SLOTS];
+static volatile uint32_t rpmsg_rx_head, rpmsg_rx_tail;
+static uint8_t *rpmsg_tx;                       /* batch, a vring buffer */
+static uint32_t rpmsg_tx_size, rpmsg_tx_used;
+static uint32_t pwm_period;
+static uint32_t carrier_per_sample;
+static uint32_t channels;
+static uint32_t frame_bytes;
+static uint32_t encoding;
+static uint32_t frames;
+static uint32_t underruns;
+static uint32_t period_left;
+
+/*
+ * MCU load: CYCLE_TIMER ticks spent in the timer ISR over LOAD_WINDOW sample
+ * ticks. The ISR hands a finished window to the main loop, which does the
+ * division and publishes it in softpwm_shm.
+ */
+static uint32_t load_busy;
+static uint32_t load_samples;
+static volatile uint32_t load_window_busy;
+static uint32_t load_max;
+
+/*
+ * Interrupt profile, see mcu_stats.h. The handlers account into isr_stats,
+ * the main loop snapshots it into the shared block.
+ */
+static struct picocalc_mcu_stats *stats;
+static struct picocalc_isr_stats isr_stats[PICOCALC_STATS_ISRS];
+static uint32_t stats_seq;
+static uint32_t stats_reset;
+static uint32_t stats_stamp;            /* cycle_now() at the last main loop pass */
+static uint32_t stats_window;           /* CYCLE_TIMER ticks */
+static uint32_t stats_idle;
+static uint32_t stats_idle_min;
+
+static bool pwm_engine;         /* PWM1 reaches the pins, see pwm_probe() */
+static struct PWM_HANDLE pwm;
+static uint32_t pwm_scale;      /* CLK_PWM1 counts per timer tick, Q16 */
+static uint32_t pwm_ns_scale;   /* ns per CLK_PWM1 count, Q16, rounded up */
+static bool pwm_direct;         /* registers written by the ISR itself */
+static uint32_t period_count, period_ns;
+static uint32_t duty_left, duty_right;  /* in CLK_PWM1 counts */
+
+/*
+ * Edge schedule of one carrier cycle. Both channels rise together at the
+ * start of the cycle from the single timer, so they stay phase locked;
+ * the pins fall at edge_first and edge_second (equal duties fall together).
+ * Edges are due at CYCLE_TIMER times, so the time the handler takes to
+ * restart the timer is not added to every carrier cycle.
+ */
+enum {
+    EDGE_RISE,
+    EDGE_FIRST,
+    EDGE_SECOND,
+};
+static uint32_t edge;
+static uint32_t edge_due;       /* cycle_now() of the next edge */
+static uint32_t carrier;        /* carrier cycles of the current sample */
+static softpwm_sample_t edge_first, edge_second;
+static uint32_t pins_first, pins_second;
+
+/* IMA ADPCM decoder state, see SOFTPWM_ENCODING_IMA_ADPCM */
+static struct ima_adpcm adpcm[2];
+static int32_t adpcm_mid;
+static uint32_t adpcm_held;     /* mono: second frame of the last byte */
+static bool adpcm_half;
+
+/* Keyboard service, kbd_hdr is NULL when the table has no channel for it */
+static struct spsc_ring_hdr *kbd_hdr;
+static struct spsc_ring kbd_ring;
+static struct I2C_HANDLE kbd_i2c;
+static bool kbd_i2c_ready;
+static uint32_t kbd_keys[256 / 32];     /* pressed keys, by controller code */
+
+/* Panel flushes from Linux, panel_queue[panel_tail] is the one on the bus */
+static struct picocalc_panel_flush panel_queue[PICOCALC_PANEL_QUEUE];
+static uint32_t panel_head, panel_tail;
+static uint32_t panel_line;             /* next line of the running flush */
+static bool panel_report;               /* DONE not sent yet */
+static uint32_t panel_done;
+static struct SPI_HANDLE panel_spi;
 
 /********************* Public Function Definition ****************************/
 #ifdef __GNUC__
 __USED int _write(int fd, char *ptr, int len)
 {
-    size_t free, tail;
-    size_t to_end;
     /*
      * write "len" of char from "ptr" to file id "fd"
      * Return number of char written.
@@ -70,22 +260,7 @@ __USED int _write(int fd, char *ptr, int len)
         return -1;
     }
 
-    tail = logbuf->tail;
-    free = (tail > logbuf->head) ? (tail - logbuf->head - 1) : (logbuf->max_size - logbuf->head + tail - 1);
-
-    len = len < free ? len : free;
-    to_end = logbuf->max_size - logbuf->head;
-
-    if (len > to_end) {
-        memcpy((unsigned char*)logbuf->buf + logbuf->head, ptr, to_end);
-        memcpy((unsigned char*)logbuf->buf, ptr + to_end, len - to_end);
-    } else {
-        memcpy((unsigned char*)logbuf->buf + logbuf->head, ptr, len);
-    }
-
-    logbuf->head = (logbuf->head + len) % logbuf->max_size;
-
-    return len;
+    return spsc_ring_write(&logring, ptr, len);
 }
 #else
 int fputc(int ch, FILE *f)
@@ -95,73 +270,877 @@ int fputc(int ch, FILE *f)
 #endif
 
 /********************* Private Function Definition ***************************/
-#ifdef STEREO
-static void left_timer_isr(long unsigned int irq, void *args)
+static void doorbell_ring(eMBOX_CH chan, uint32_t cmd)
+{
+    struct MBOX_CMD_DAT msg = { .CMD = cmd, .DATA = 0 };
+
+    HAL_MBOX_SendMsg(DOORBELL_MBOX, chan, &msg);
+}
+
+/* Start CYCLE_TIMER counting up from 0, it never expires */
+static void cycle_init(void)
+{
+    HAL_TIMER_Init(CYCLE_TIMER, TIMER_FREE_RUNNING);
+    HAL_TIMER_SetCount(CYCLE_TIMER, UINT64_MAX);
+    HAL_TIMER_Start(CYCLE_TIMER);
+}
+
+/* Low word of the count, differences are right across its wrap */
+static inline uint32_t cycle_now(void)
+{
+    return (uint32_t)HAL_TIMER_GetCount(CYCLE_TIMER);
+}
+
+/* Account the ticks since @start */
+static void load_account(uint32_t start)
+{
+    load_busy += cycle_now() - start;
+}
+
+/* Ticks since @t expired, the timers count up from 0 after reloading */
+static uint32_t timer_late(struct TIMER_REG *t)
+{
+    return (uint32_t)HAL_TIMER_GetCount(t);
+}
+
+static void stats_clear(struct picocalc_isr_stats *st)
+{
+    memset(st, 0, sizeof(*st));
+    st->lat_min = UINT32_MAX;
+    st->run_min = UINT32_MAX;
+}
+
+/* Last thing in a handler that started at cycle_now() @start */
+static void stats_isr(uint32_t id, uint32_t latency, uint32_t start)
 {
-    HAL_TIMER_Stop_IT(left_timer);
-    if (left_flag) {
-        HAL_GPIO_SetPinLevel(GPIO4, GPIO_PIN_B2, GPIO_HIGH);
-        HAL_TIMER_SetCount(left_timer, softpwm->left_duty);
-        if(!softpwm->left_duty) {
-            left_enable = false;
-            HAL_GPIO_SetPinLevel(GPIO4, GPIO_PIN_B2, GPIO_LOW);
+    struct picocalc_isr_stats *st = &isr_stats[id];
+    uint32_t run = cycle_now() - start;
+    uint32_t bucket = 0;
+
+    st->count++;
+    st->run_sum += run;
+    if (run < st->run_min) {
+        st->run_min = run;
+    }
+    if (run > st->run_max) {
+        st->run_max = run;
+    }
+    if (latency == STATS_NO_LATENCY) {
+        return;
+    }
+
+    st->lat_sum += latency;
+    if (latency < st->lat_min) {
+        st->lat_min = latency;
+    }
+    if (latency > st->lat_max) {
+        st->lat_max = latency;
+    }
+    /* No CLZ on the M0, at most PICOCALC_STATS_HIST steps */
+    while (bucket < PICOCALC_STATS_HIST - 1 &&
+           latency >= (uint32_t)PICOCALC_STATS_HIST_BASE << bucket) {
+        bucket++;
+    }
+    st->hist[bucket]++;
+}
+
+/*
+ * Main loop, once per pass. A pass that sleeps longer than one CYCLE_TIMER
+ * wrap (~179 s, no poll timer and no sound) is only counted modulo it.
+ */
+static void stats_publish(uint32_t idle)
+{
+    uint32_t now = cycle_now(), reset, permille, i;
+
+    stats_window += now - stats_stamp;
+    stats_idle += idle;
+    stats_stamp = now;
+    if (!stats || stats_window < CYCLE_HZ / 1000 * PICOCALC_STATS_WINDOW_MS) {
+        return;
+    }
+
+    permille = (uint64_t)stats_idle * 1000 / stats_window;
+    reset = SPSC_RING_LOAD(stats->reset);
+    if (reset != stats_reset) {
+        for (i = 0; i < PICOCALC_STATS_ISRS; i++) {
+            __disable_irq();
+            stats_clear(&isr_stats[i]);
+            __enable_irq();
         }
+        stats_idle_min = permille;
+        stats_reset = reset;
+    }
+    if (permille < stats_idle_min) {
+        stats_idle_min = permille;
+    }
+
+    SPSC_RING_STORE(stats->seq, ++stats_seq);
+    SPSC_RING_RELEASE_W();
+    for (i = 0; i < PICOCALC_STATS_ISRS; i++) {
+        __disable_irq();
+        memcpy(&stats->isr[i], &isr_stats[i], sizeof(isr_stats[i]));
+        __enable_irq();
+    }
+    stats->run_hz = CYCLE_HZ;
+    stats->timer_hz = SOFTPWM_TIMER_HZ;
+    stats->idle = permille;
+    stats->idle_min = stats_idle_min;
+    stats->reset_ack = stats_reset;
+    SPSC_RING_RELEASE_W();
+    SPSC_RING_STORE(stats->seq, ++stats_seq);
+
+    stats_window = 0;
+    stats_idle = 0;
+}
+
+static void load_sample(void)
+{
+    if (++load_samples == LOAD_WINDOW) {
+        load_window_busy = load_busy;
+        events |= EVENT_LOAD;
+        load_busy = 0;
+        load_samples = 0;
+    }
+}
+
+/* Main loop: busy ticks of the last window as per-mille of its length */
+static void load_publish(void)
+{
+    uint64_t window;
+    uint32_t load;
+
+    /* The sample timer and CYCLE_TIMER share CYCLE_HZ */
+    window = (uint64_t)LOAD_WINDOW * pwm_period * carrier_per_sample;
+    if (!window) {
+        return;
+    }
+    load = (uint64_t)load_window_busy * 1000 / window;
+    if (load > load_max) {
+        load_max = load;
+    }
+    SPSC_RING_STORE(softpwm->mcu_load, load);
+    SPSC_RING_STORE(softpwm->mcu_load_max, load_max);
+}
+
+/*
+ * CLK_PWM1 is asked for SOFTPWM_TIMER_HZ, so that a duty in timer ticks is
+ * also its PWM count. Whatever rate it really runs at, the counts are
+ * scaled to it with one multiply, the M0 has no divider.
+ */
+static void pwm_clk_init(void)
+{
+    uint32_t hz;
+
+    HAL_CRU_ClkSetFreq(PWM_CLK, SOFTPWM_TIMER_HZ);
+    hz = HAL_CRU_ClkGetFreq(PWM_CLK);
+    if (!hz) {
+        HAL_DBG("softpwm: CLK_PWM1 rate unknown, assuming %u Hz\n", SOFTPWM_TIMER_HZ);
+        hz = SOFTPWM_TIMER_HZ;
+    } else if (hz != SOFTPWM_TIMER_HZ) {
+        HAL_DBG("softpwm: CLK_PWM1 at %lu Hz, duties are scaled\n", (unsigned long)hz);
+    }
+
+    pwm_scale = ((uint64_t)hz << 16) / SOFTPWM_TIMER_HZ;
+    pwm_ns_scale = ((1000000000ULL << 16) + hz - 1) / hz;
+    HAL_PWM_Init(&pwm, PWM_DEV, hz);
+}
+
+/* Timer ticks to CLK_PWM1 counts */
+static inline uint32_t pwm_count(uint32_t ticks)
+{
+    return (ticks * pwm_scale + 0x8000) >> 16;
+}
+
+/* CLK_PWM1 counts to ns, rounded up so the HAL gets the same count back */
+static uint32_t pwm_ns(uint32_t count)
+{
+    return (count * pwm_ns_scale + 0xffff) >> 16;
+}
+
+static inline volatile uint32_t *pwm_reg(uint32_t channel, uint32_t reg)
+{
+    return (volatile uint32_t *)((uintptr_t)PWM_DEV + channel * PWM_CH_STRIDE + reg);
+}
+
+/*
+ * Load a duty of @count CLK_PWM1 counts. The PWM latches it at the end of
+ * the running carrier cycle. The direct path is two stores, the HAL path
+ * is kept for a register layout that did not check out.
+ */
+static void pwm_set(uint32_t channel, uint32_t count)
+{
+    struct HAL_PWM_CONFIG config = {
+        .channel = channel,
+        .periodNS = period_ns,
+        .polarity = true,
+    };
+
+    if (pwm_direct) {
+        *pwm_reg(channel, PWM_REG_DUTY) = count;
+        *pwm_reg(channel, PWM_REG_ENABLE) = PWM_CTRL_UPDATE_EN;
+        return;
+    }
+
+    config.dutyNS = pwm_ns(count);
+    HAL_PWM_SetConfig(&pwm, channel, &config);
+}
+
+/* Load both channels with @duty_ns of a PWM_PROBE_NS carrier, false unless the pads follow */
+static bool pwm_pads(uint32_t duty_ns, eGPIO_pinLevel level)
+{
+    struct HAL_PWM_CONFIG config = {
+        .periodNS = PWM_PROBE_NS,
+        .dutyNS = duty_ns,
+        .polarity = true,
+    };
+
+    config.channel = PWM_LEFT_CH;
+    HAL_PWM_SetConfig(&pwm, PWM_LEFT_CH, &config);
+    config.channel = PWM_RIGHT_CH;
+    HAL_PWM_SetConfig(&pwm, PWM_RIGHT_CH, &config);
+    HAL_DelayUs(PWM_PROBE_US);
+
+    return HAL_GPIO_GetPinLevel(GPIO4, PWM_LEFT_PIN) == level &&
+           HAL_GPIO_GetPinLevel(GPIO4, PWM_RIGHT_PIN) == level;
+}
+
+/*
+ * Mux the pins to PWM1 and check that they go low, high and low again
+ * with the duty. GPIO EXT_PORT reads the pad whatever its mux, so only
+ * pins PWM1 really drives follow. Otherwise they go back to GPIO for the
+ * edge engine. Either way they are low afterwards, the high pulse is
+ * PWM_PROBE_US long, once at boot.
+ */
+static bool pwm_probe(void)
+{
+    bool routed;
+
+    pwm_clk_init();
+    HAL_GPIO_SetPinDirection(GPIO4, PWM_LEFT_PIN, GPIO_IN);
+    HAL_GPIO_SetPinDirection(GPIO4, PWM_RIGHT_PIN, GPIO_IN);
+    HAL_PINCTRL_SetIOMUX(GPIO_BANK4, PWM_PINS, PWM_PINS_FUNC);
+    HAL_PWM_Enable(&pwm, PWM_LEFT_CH, HAL_PWM_CONTINUOUS);
+    HAL_PWM_Enable(&pwm, PWM_RIGHT_CH, HAL_PWM_CONTINUOUS);
+    routed = pwm_pads(0, GPIO_LOW) && pwm_pads(PWM_PROBE_NS, GPIO_HIGH) &&
+             pwm_pads(0, GPIO_LOW);
+    HAL_PWM_Disable(&pwm, PWM_LEFT_CH);
+    HAL_PWM_Disable(&pwm, PWM_RIGHT_CH);
+    if (!routed) {
+        HAL_PINCTRL_SetIOMUX(GPIO_BANK4, PWM_PINS, PIN_CONFIG_MUX_FUNC0);
+    }
+
+    return routed;
+}
+
+/*
+ * Load the timer for the edge @ticks after the last one. An edge that is
+ * already due fires as soon as the timer can, the cycle after it is cut
+ * short by as much; a whole carrier cycle behind, the schedule restarts.
+ */
+static void edge_next(uint32_t ticks)
+{
+    uint32_t now = cycle_now();
+    int32_t left;
+
+    edge_due += ticks;
+    left = (int32_t)(edge_due - now);
+    if (left < -(int32_t)pwm_period) {
+        edge_due = now;
+    }
+    HAL_TIMER_SetCount(timer, left > 0 ? (uint32_t)left : 1);
+}
+
+/*
+ * Called from the sample tick. The PWM engine's ISR then only stores the
+ * counts, the edge engine's sorts the falling edges here.
+ */
+static void softpwm_schedule(softpwm_sample_t left, softpwm_sample_t right)
+{
+    if (pwm_engine) {
+        duty_left = pwm_count(left);
+        duty_right = pwm_count(right);
+    } else if (left <= right) {
+        edge_first = left;
+        pins_first = left == right ? PWM_PINS : PWM_LEFT_PIN;
+        edge_second = right;
+        pins_second = PWM_RIGHT_PIN;
     } else {
-        HAL_GPIO_SetPinLevel(GPIO4, GPIO_PIN_B2, GPIO_LOW);
-        HAL_TIMER_SetCount(left_timer, 375 - softpwm->left_duty);
+        edge_first = right;
+        pins_first = PWM_RIGHT_PIN;
+        edge_second = left;
+        pins_second = PWM_LEFT_PIN;
     }
-    left_flag = !left_flag;
-    HAL_TIMER_ClrInt(left_timer);
-    HAL_TIMER_Start_IT(left_timer);
 }
 
-static void right_timer_isr(long unsigned int irq, void *args)
+static softpwm_sample_t adpcm_duty(struct ima_adpcm *st, uint32_t nibble)
 {
-    HAL_TIMER_Stop_IT(right_timer);
-    if (right_flag) {
-        HAL_GPIO_SetPinLevel(GPIO4, GPIO_PIN_B3, GPIO_HIGH);
-        HAL_TIMER_SetCount(right_timer, softpwm->right_duty);
-        if(!softpwm->right_duty) {
-            right_enable = false;
-            HAL_GPIO_SetPinLevel(GPIO4, GPIO_PIN_B3, GPIO_LOW);
+    int32_t duty = (ima_adpcm_update(st, nibble) + adpcm_mid +
+                    (1 << (SOFTPWM_ADPCM_SHIFT - 1))) >> SOFTPWM_ADPCM_SHIFT;
+
+    if (duty < SOFTPWM_DUTY_MIN) {
+        duty = SOFTPWM_DUTY_MIN;
+    } else if (duty > (int32_t)pwm_period - 1) {
+        duty = pwm_period - 1;
+    }
+
+    return duty;
+}
+
+/* Load the next frame into the edge schedule, returns false on underrun */
+static bool softpwm_fetch(void)
+{
+    const softpwm_sample_t *frame;
+    const void *p;
+    softpwm_sample_t left;
+    uint8_t byte;
+
+    if (encoding != SOFTPWM_ENCODING_IMA_ADPCM) {
+        if (spsc_ring_peek(&sample_ring, &p, frame_bytes) < frame_bytes) {
+            return false;
         }
+        frame = (const softpwm_sample_t *)p;
+        softpwm_schedule(frame[0], frame[channels - 1]);
+        spsc_ring_consume(&sample_ring, frame_bytes);
+
+        return true;
+    }
+
+    if (adpcm_half) {
+        left = adpcm_duty(&adpcm[0], adpcm_held);
+        softpwm_schedule(left, left);
+        adpcm_half = false;
+
+        return true;
+    }
+    if (spsc_ring_peek(&sample_ring, &p, 1) < 1) {
+        return false;
+    }
+    byte = *(const uint8_t *)p;
+    spsc_ring_consume(&sample_ring, 1);
+
+    left = adpcm_duty(&adpcm[0], byte & 0xf);
+    if (channels == 2) {
+        softpwm_schedule(left, adpcm_duty(&adpcm[1], byte >> 4));
     } else {
-        HAL_GPIO_SetPinLevel(GPIO4, GPIO_PIN_B3, GPIO_LOW);
-        HAL_TIMER_SetCount(right_timer, 375 - softpwm->right_duty);
+        softpwm_schedule(left, left);
+        adpcm_held = byte >> 4;
+        adpcm_half = true;
     }
-    right_flag = !right_flag;
-    HAL_TIMER_ClrInt(right_timer);
-    HAL_TIMER_Start_IT(right_timer);
+
+    return true;
 }
-#else
-static void timer_isr(long unsigned int irq, void *args)
+
+/* Called once per sample tick, returns false when Linux stopped the stream */
+static bool softpwm_next_sample(void)
+{
+    if (SPSC_RING_LOAD(softpwm->state) != SOFTPWM_STATE_RUN) {
+        return false;
+    }
+
+    load_sample();
+
+    /*
+     * On underrun the last duty is held, which is silent and click free.
+     * The position still advances and periods are still signalled, as a
+     * DMA engine would, so Linux can skip what was missed and a drain that
+     * ends in a partial period completes.
+     */
+    if (!softpwm_fetch()) {
+        SPSC_RING_STORE(softpwm->underruns, ++underruns);
+    }
+    SPSC_RING_STORE(softpwm->frames, ++frames);
+    if (--period_left == 0) {
+        period_left = SPSC_RING_LOAD(softpwm->period_frames);
+        doorbell_ring(DOORBELL_CHAN, SOFTPWM_DOORBELL_PERIOD);
+    }
+
+    return true;
+}
+
+static void softpwm_stop(void)
+{
+    enable = false;
+    if (pwm_engine) {
+        HAL_TIMER_Stop_IT(timer);
+        HAL_PWM_Disable(&pwm, PWM_LEFT_CH);
+        HAL_PWM_Disable(&pwm, PWM_RIGHT_CH);
+    } else {
+        HAL_GPIO_SetPinsLevel(GPIO4, PWM_PINS, GPIO_LOW);
+    }
+    SPSC_RING_STORE(softpwm->mcu_state, SOFTPWM_STATE_STOP);
+    events |= EVENT_STOP;
+}
+
+/* PWM engine: one interrupt per sample, the timer reloads itself */
+static void pwm_timer_isr(long unsigned int irq, void *args)
+{
+    uint32_t start = cycle_now();
+    uint32_t late = timer_late(timer);
+
+    HAL_TIMER_ClrInt(timer);
+    if (!softpwm_next_sample()) {
+        softpwm_stop();
+        stats_isr(PICOCALC_STATS_SAMPLE, late, start);
+        return;
+    }
+    pwm_set(PWM_LEFT_CH, duty_left);
+    pwm_set(PWM_RIGHT_CH, duty_right);
+    load_account(start);
+    stats_isr(PICOCALC_STATS_SAMPLE, late, start);
+}
+
+/* Edge engine: one interrupt per edge, the timer is loaded for the next one */
+static void edge_timer_isr(long unsigned int irq, void *args)
 {
+    uint32_t start = cycle_now();
+    uint32_t late = timer_late(timer);
+
     HAL_TIMER_Stop_IT(timer);
-    if (flag) {
-        HAL_GPIO_SetPinLevel(GPIO4, GPIO_PIN_B2, GPIO_HIGH);
-        HAL_GPIO_SetPinLevel(GPIO4, GPIO_PIN_B3, GPIO_HIGH);
-        HAL_TIMER_SetCount(timer, softpwm->left_duty);
-        if(!softpwm->left_duty) {
-            enable = false;
-            HAL_GPIO_SetPinLevel(GPIO4, GPIO_PIN_B2, GPIO_LOW);
-            HAL_GPIO_SetPinLevel(GPIO4, GPIO_PIN_B3, GPIO_LOW);
-            HAL_DBG("Sound Stop\n");
+    HAL_TIMER_ClrInt(timer);
+    switch (edge) {
+    case EDGE_RISE:
+        if (++carrier == carrier_per_sample) {
+            carrier = 0;
+            if (!softpwm_next_sample()) {
+                softpwm_stop();
+                stats_isr(PICOCALC_STATS_SAMPLE, late, start);
+                return;
+            }
+        }
+        HAL_GPIO_SetPinsLevel(GPIO4, PWM_PINS, GPIO_HIGH);
+        edge_next(edge_first);
+        edge = EDGE_FIRST;
+        break;
+    case EDGE_FIRST:
+        HAL_GPIO_SetPinsLevel(GPIO4, pins_first, GPIO_LOW);
+        if (pins_first == PWM_PINS) {
+            edge_next(pwm_period - edge_first);
+            edge = EDGE_RISE;
+        } else {
+            edge_next(edge_second - edge_first);
+            edge = EDGE_SECOND;
         }
+        break;
+    default:
+        HAL_GPIO_SetPinsLevel(GPIO4, pins_second, GPIO_LOW);
+        edge_next(pwm_period - edge_second);
+        edge = EDGE_RISE;
+        break;
+    }
+    HAL_TIMER_Start_IT(timer);
+    load_account(start);
+    stats_isr(PICOCALC_STATS_SAMPLE, late, start);
+}
+
+static void doorbell_rx(struct MBOX_CMD_DAT *msg, void *args)
+{
+    if (msg->CMD == SOFTPWM_DOORBELL_STATE) {
+        events |= EVENT_DOORBELL;
+    }
+}
+
+static const struct MBOX_CLIENT doorbell_client = {
+    .name = "softpwm",
+    .RXCallback = doorbell_rx,
+};
+
+static void doorbell_isr(long unsigned int irq, void *args)
+{
+    uint32_t start = cycle_now();
+
+    HAL_MBOX_IrqHandler(irq, DOORBELL_MBOX);
+    stats_isr(PICOCALC_STATS_DOORBELL, STATS_NO_LATENCY, start);
+}
+
+static void poll_isr(long unsigned int irq, void *args)
+{
+    uint32_t start = cycle_now();
+    uint32_t late = timer_late(poll_timer);
+
+    HAL_TIMER_ClrInt(poll_timer);
+    events |= EVENT_POLL;
+    stats_isr(PICOCALC_STATS_POLL, late, start);
+}
+
+/* One polled transfer on the keyboard bus, @last ends it with a STOP */
+static HAL_Status kbd_xfer(uint8_t *buf, uint16_t len, eI2C_Mode mode, bool last)
+{
+    uint32_t spins = KBD_I2C_SPINS;
+    HAL_Status ret;
+
+    ret = HAL_I2C_SetupMsg(&kbd_i2c, KBD_I2C_ADDR, buf, len, mode, 0);
+    if (ret != HAL_OK) {
+        return ret;
+    }
+    ret = HAL_I2C_Transfer(&kbd_i2c, I2C_POLL, last);
+    while (ret == HAL_BUSY && --spins) {
+        ret = HAL_I2C_IRQHandler(&kbd_i2c);
+    }
+
+    return ret;
+}
+
+/* Pop one controller FIFO entry, the same word Linux used to read */
+static bool kbd_read(struct picocalc_kbd_event *ev)
+{
+    uint8_t buf[2] = { PICOCALC_KBD_REG_FIFO };
+
+    if (kbd_xfer(buf, 1, REG_CON_MOD_TX, false) != HAL_OK ||
+        kbd_xfer(buf, 2, REG_CON_MOD_RX, true) != HAL_OK) {
+        /* Start over from a fresh controller on the next poll */
+        HAL_I2C_DeInit(&kbd_i2c);
+        kbd_i2c_ready = false;
+
+        return false;
+    }
+    ev->state = buf[0];
+    ev->code = buf[1];
+
+    return true;
+}
+
+/*
+ * Debounce: only edges that change a key's state get through, so repeated
+ * or bounced reports of the same edge never wake Linux up.
+ */
+static bool kbd_changed(const struct picocalc_kbd_event *ev)
+{
+    uint32_t *word = &kbd_keys[ev->code >> 5];
+    uint32_t bit = HAL_BIT(ev->code & 31);
+    bool down = ev->state == PICOCALC_KBD_PRESSED;
+
+    if (ev->state != PICOCALC_KBD_PRESSED && ev->state != PICOCALC_KBD_RELEASED) {
+        return false;
+    }
+    if (!!(*word & bit) == down) {
+        return false;
+    }
+    *word ^= bit;
+
+    return true;
+}
+
+/* Main loop, every KBD_POLL_MS */
+static void kbd_poll(void)
+{
+    struct picocalc_kbd_event ev;
+    uint32_t sync, pushed = 0, i;
+
+    if (!kbd_hdr) {
+        return;
+    }
+    sync = SPSC_RING_LOAD(kbd_hdr->sync);
+    if (sync == PICOCALC_KBD_SYNC_LINUX) {
+        spsc_ring_attach(&kbd_ring, kbd_hdr);
+        memset(kbd_keys, 0, sizeof(kbd_keys));
+        SPSC_RING_STORE(kbd_hdr->sync, PICOCALC_KBD_SYNC_MCU);
+        HAL_DBG("Keyboard ring on: 0x%x, size %u\n", (unsigned int)kbd_hdr, kbd_ring.size);
+    } else if (sync != PICOCALC_KBD_SYNC_MCU) {
+        return;
+    } else if (!kbd_ring.hdr) {
+        /* Our answer from before a restart, or a stale one before Linux opened the ring */
+        if (!SPSC_RING_LOAD(shm_table->restarts)) {
+            return;
+        }
+        spsc_ring_attach(&kbd_ring, kbd_hdr);
+        HAL_DBG("Keyboard ring on: 0x%x, size %u\n", (unsigned int)kbd_hdr, kbd_ring.size);
+    }
+    if (!kbd_i2c_ready) {
+        /* Linux muxed the pins before opening the ring */
+        if (HAL_I2C_Init(&kbd_i2c, (uint32_t)KBD_I2C, HAL_CRU_ClkGetFreq(KBD_I2C_CLK),
+                         I2C_100K) != HAL_OK) {
+            return;
+        }
+        kbd_i2c_ready = true;
+    }
+
+    /* What does not fit the ring stays in the controller FIFO */
+    for (i = 0; i < KBD_FIFO_MAX && spsc_ring_space(&kbd_ring) >= sizeof(ev); i++) {
+        if (!kbd_read(&ev) || ev.state == PICOCALC_KBD_IDLE) {
+            break;
+        }
+        if (kbd_changed(&ev)) {
+            spsc_ring_write(&kbd_ring, &ev, sizeof(ev));
+            pushed++;
+        }
+    }
+    if (pushed) {
+        doorbell_ring(KBD_DOORBELL_CHAN, PICOCALC_KBD_DOORBELL);
+    }
+}
+
+/*
+ * Runs from the mailbox interrupt. The buffer is kept (RL_HOLD) and parsed
+ * in place by the main loop, which releases it afterwards.
+ */
+static int32_t rpmsg_rx_cb(void *payload, uint32_t payload_len, uint32_t src, void *priv)
+{
+    uint32_t head = rpmsg_rx_head;
+    struct rpmsg_rx_slot *slot = &rpmsg_rx[head & (RPMSG_RX_SLOTS - 1)];
+
+    if (head - rpmsg_rx_tail == RPMSG_RX_SLOTS) {
+        return RL_RELEASE;
+    }
+    slot->data = payload;
+    slot->len = payload_len;
+    slot->src = src;
+    rpmsg_rx_head = head + 1;
+    events |= EVENT_RPMSG;
+
+    return RL_HOLD;
+}
+
+static void rpmsg_flush(void)
+{
+    if (!rpmsg_tx) {
+        return;
+    }
+    rpmsg_lite_send_nocopy(rpmsg, rpmsg_ept, rpmsg_remote, rpmsg_tx, rpmsg_tx_used);
+    rpmsg_tx = NULL;
+}
+
+/*
+ * Append a record to the tx batch, returns its payload to fill in place or
+ * NULL when Linux has not said HELLO yet or no vring buffer is free.
+ * Main loop only, the batch goes out on rpmsg_flush().
+ */
+static void *rpmsg_reserve(uint16_t type, uint16_t len)
+{
+    uint32_t size = PICOCALC_MSG_SIZE(len);
+    struct picocalc_msg *msg;
+
+    if (rpmsg_remote == RL_ADDR_ANY || size > RL_BUFFER_PAYLOAD_SIZE) {
+        return NULL;
+    }
+    if (rpmsg_tx && rpmsg_tx_used + size > rpmsg_tx_size) {
+        rpmsg_flush();
+    }
+    if (!rpmsg_tx) {
+        rpmsg_tx = rpmsg_lite_alloc_tx_buffer(rpmsg, &rpmsg_tx_size, RL_DONT_BLOCK);
+        if (!rpmsg_tx) {
+            return NULL;
+        }
+        rpmsg_tx_used = 0;
+    }
+
+    msg = (struct picocalc_msg *)(rpmsg_tx + rpmsg_tx_used);
+    msg->type = type;
+    msg->len = len;
+    rpmsg_tx_used += size;
+
+    return msg->data;
+}
+
+static void rpmsg_hello(const struct picocalc_msg *msg, uint32_t src)
+{
+    const struct picocalc_msg_hello *hello = (const void *)msg->data;
+    struct picocalc_msg_hello *reply;
+
+    if (msg->len < sizeof(*hello)) {
+        return;
+    }
+
+    /* On a version mismatch no service is granted, Linux says why */
+    rpmsg_remote = src;
+    rpmsg_caps = hello->version == PICOCALC_RPMSG_VERSION ? hello->caps & MCU_CAPS : 0;
+    reply = rpmsg_reserve(PICOCALC_MSG_HELLO, sizeof(*reply));
+    if (reply) {
+        reply->version = PICOCALC_RPMSG_VERSION;
+        reply->caps = rpmsg_caps;
+    }
+    HAL_DBG("rpmsg: Linux v%u, services 0x%x\n", (unsigned int)hello->version,
+            (unsigned int)rpmsg_caps);
+}
+
+/* Blocking PIO transfer of @len bytes in frames of @frame bytes */
+static void panel_xfer(const void *buf, uint32_t len, uint32_t frame)
+{
+    panel_spi.config.nBytes = frame;
+    HAL_SPI_Configure(&panel_spi, buf, NULL, len);
+    while (HAL_SPI_PioTransfer(&panel_spi) == HAL_BUSY) {
+        ;
+    }
+    while (HAL_SPI_QueryBusState(&panel_spi) == HAL_BUSY) {
+        ;
+    }
+}
+
+static void panel_command(uint8_t cmd, const uint8_t *data, uint32_t len)
+{
+    HAL_GPIO_SetPinLevel(PANEL_DC_GPIO, PANEL_DC_PIN, GPIO_LOW);
+    panel_xfer(&cmd, 1, 1);
+    HAL_GPIO_SetPinLevel(PANEL_DC_GPIO, PANEL_DC_PIN, GPIO_HIGH);
+    if (len) {
+        panel_xfer(data, len, 1);
+    }
+}
+
+/* Take the bus from where Linux left it and open the window of @f */
+static void panel_start(const struct picocalc_panel_flush *f)
+{
+    uint8_t caset[4] = { f->x1 >> 8, f->x1 & 0xff, f->x2 >> 8, f->x2 & 0xff };
+    uint8_t paset[4] = { f->y1 >> 8, f->y1 & 0xff, f->y2 >> 8, f->y2 & 0xff };
+
+    HAL_SPI_Init(&panel_spi, (uint32_t)PANEL_SPI, false);
+    panel_spi.maxFreq = HAL_CRU_ClkGetFreq(PANEL_SPI_CLK);
+    panel_spi.config.opMode = CR0_OPM_MASTER;
+    panel_spi.config.xfmMode = CR0_XFM_TO;
+    panel_spi.config.endianMode = CR0_EM_BIG;
+    panel_spi.config.apbTransform = CR0_BHT_8BIT;
+    panel_spi.config.clkPolarity = CR0_POLARITY_LOW;
+    panel_spi.config.clkPhase = CR0_PHASE_1EDGE;
+    panel_spi.config.ssd = CR0_SSD_ONE;
+    panel_spi.config.speed = PANEL_SPI_HZ;
+
+    HAL_SPI_SetCS(&panel_spi, PANEL_CS, true);
+    panel_command(PANEL_CASET, caset, sizeof(caset));
+    panel_command(PANEL_PASET, paset, sizeof(paset));
+    panel_command(PANEL_RAMWR, NULL, 0);
+}
+
+/*
+ * Main loop: clock out up to PANEL_LINES lines of the running flush, in
+ * 16 bit frames so the little endian RGB565 goes out MSB first.
+ */
+static void panel_work(void)
+{
+    const struct picocalc_panel_flush *f;
+    struct picocalc_panel_done *done;
+    uint32_t width, lines, end;
+
+    if (panel_head != panel_tail) {
+        f = &panel_queue[panel_tail & (PICOCALC_PANEL_QUEUE - 1)];
+        if (!panel_line) {
+            panel_start(f);
+        }
+        width = (f->x2 - f->x1 + 1) * 2;
+        lines = f->y2 - f->y1 + 1;
+        end = panel_line + PANEL_LINES < lines ? panel_line + PANEL_LINES : lines;
+        for (; panel_line < end; panel_line++) {
+            panel_xfer((const void *)(f->addr + panel_line * f->pitch), width, 2);
+        }
+        if (panel_line == lines) {
+            HAL_SPI_SetCS(&panel_spi, PANEL_CS, false);
+            panel_line = 0;
+            panel_done = f->seq;
+            panel_tail++;
+            /* One DONE per drained queue, Linux only waits for the last one */
+            panel_report = panel_head == panel_tail;
+        }
+    }
+
+    /* Retried on every wakeup while the vring has no free buffer */
+    if (panel_report) {
+        done = rpmsg_reserve(PICOCALC_MSG_PANEL_DONE, sizeof(*done));
+        if (done) {
+            done->seq = panel_done;
+            panel_report = false;
+        }
+    }
+}
+
+static void panel_queue_flush(const struct picocalc_msg *msg)
+{
+    if (!(rpmsg_caps & PICOCALC_CAP_PANEL) || msg->len < sizeof(struct picocalc_panel_flush)) {
+        return;
+    }
+    if (panel_head - panel_tail == PICOCALC_PANEL_QUEUE) {
+        HAL_DBG("panel: queue full, flush dropped\n");
+
+        return;
+    }
+    memcpy(&panel_queue[panel_head & (PICOCALC_PANEL_QUEUE - 1)], msg->data,
+           sizeof(struct picocalc_panel_flush));
+    panel_head++;
+}
+
+static void rpmsg_poll(void)
+{
+    const struct picocalc_msg *msg;
+    struct rpmsg_rx_slot *slot;
+    uint32_t tail, pos;
+
+    if (!rpmsg_ept && rpmsg_lite_is_link_up(rpmsg)) {
+        rpmsg_ept = rpmsg_lite_create_ept(rpmsg, PICOCALC_RPMSG_MCU_ADDR,
+                                          rpmsg_rx_cb, NULL, &rpmsg_ept_ctx);
+        rpmsg_ns_announce(rpmsg, rpmsg_ept, PICOCALC_RPMSG_NAME, RL_NS_CREATE);
+        HAL_DBG("rpmsg: announced %s\n", PICOCALC_RPMSG_NAME);
+    }
+
+    for (tail = rpmsg_rx_tail; tail != rpmsg_rx_head; tail++) {
+        slot = &rpmsg_rx[tail & (RPMSG_RX_SLOTS - 1)];
+        pos = 0;
+        while ((msg = picocalc_msg_next(slot->data, slot->len, &pos))) {
+            switch (msg->type) {
+            case PICOCALC_MSG_HELLO:
+                rpmsg_hello(msg, slot->src);
+                break;
+            case PICOCALC_MSG_PANEL_FLUSH:
+                panel_queue_flush(msg);
+                break;
+            default:
+                break;
+            }
+        }
+        rpmsg_lite_release_rx_buffer(rpmsg, slot->data);
+        rpmsg_rx_tail = tail + 1;
+    }
+
+    rpmsg_flush();
+}
+
+static void softpwm_start(void)
+{
+    spsc_ring_attach(&sample_ring, &softpwm->ring);
+    period_left = SPSC_RING_LOAD(softpwm->period_frames);
+    pwm_period = SPSC_RING_LOAD(softpwm->pwm_period);
+    carrier_per_sample = SPSC_RING_LOAD(softpwm->carrier_per_sample);
+    channels = SPSC_RING_LOAD(softpwm->channels);
+    frame_bytes = channels * sizeof(softpwm_sample_t);
+    encoding = SPSC_RING_LOAD(softpwm->encoding);
+    ima_adpcm_reset(&adpcm[0]);
+    ima_adpcm_reset(&adpcm[1]);
+    adpcm_mid = pwm_period << (SOFTPWM_ADPCM_SHIFT - 1);
+    adpcm_half = false;
+    softpwm_schedule(pwm_period / 2, pwm_period / 2);
+    load_busy = 0;
+    load_samples = 0;
+    enable = true;
+    SPSC_RING_STORE(softpwm->mcu_state, SOFTPWM_STATE_RUN);
+
+    if (pwm_engine) {
+        period_count = pwm_count(pwm_period);
+        period_ns = pwm_ns(period_count);
+        pwm_direct = false;
+        pwm_set(PWM_LEFT_CH, duty_left);
+        pwm_set(PWM_RIGHT_CH, duty_right);
+        /* The sample tick writes the duty registers only if they read back */
+        pwm_direct = *pwm_reg(PWM_LEFT_CH, PWM_REG_PERIOD) == period_count &&
+                     *pwm_reg(PWM_LEFT_CH, PWM_REG_DUTY) == duty_left &&
+                     *pwm_reg(PWM_RIGHT_CH, PWM_REG_PERIOD) == period_count &&
+                     *pwm_reg(PWM_RIGHT_CH, PWM_REG_DUTY) == duty_right;
+        if (!pwm_direct) {
+            HAL_DBG("softpwm: PWM registers differ, duties go through the HAL\n");
+        }
+        HAL_PWM_Enable(&pwm, PWM_LEFT_CH, HAL_PWM_CONTINUOUS);
+        HAL_PWM_Enable(&pwm, PWM_RIGHT_CH, HAL_PWM_CONTINUOUS);
+
+        HAL_TIMER_SetCount(timer, pwm_period * carrier_per_sample);
     } else {
-        HAL_GPIO_SetPinLevel(GPIO4, GPIO_PIN_B2, GPIO_LOW);
-        HAL_GPIO_SetPinLevel(GPIO4, GPIO_PIN_B3, GPIO_LOW);
-        HAL_TIMER_SetCount(timer, 375 - softpwm->left_duty);
+        carrier = carrier_per_sample - 1;
+        edge = EDGE_RISE;
+
+        edge_due = cycle_now();
+        edge_next(pwm_period / 2);
     }
-    flag = !flag;
-    HAL_TIMER_ClrInt(timer);
     HAL_TIMER_Start_IT(timer);
 }
-#endif
 
 int main(void)
 {
-    uint64_t start, end;
-    uint32_t count;
+    const struct picocalc_shm_entry *logring_entry, *softpwm_entry, *kbd_entry, *stats_entry;
+    uint32_t poll_ms, i;
+    bool playing = false;
 
     /* HAL BASE Init */
     HAL_Init();
@@ -172,68 +1151,154 @@ int main(void)
     /* INTMUX Init */
     HAL_INTMUX_Init();
     
+    /*
+     * SHARE MEMORY TABLE Init, U-Boot starts us before Linux publishes it.
+     * After a restart from Linux the table is republished with restarts
+     * bumped, and the rings still carry our answers from the last run.
+     */
+    shm_table = (struct picocalc_shm_table *)SHMEM_LINUX_MEM_BASE;
+    SPSC_RING_STORE(shm_table->magic, 0);
+    while (SPSC_RING_LOAD(shm_table->magic) != PICOCALC_SHM_MAGIC);
+    SPSC_RING_ACQUIRE();
+    logring_entry = picocalc_shm_find(shm_table, PICOCALC_SHM_MCULOG);
+    softpwm_entry = picocalc_shm_find(shm_table, PICOCALC_SHM_SOFTPWM);
+    if (shm_table->version != PICOCALC_SHM_VERSION || !logring_entry || !softpwm_entry) {
+        /* Nowhere to log to, stay put rather than scribble over Linux */
+        while (1) {
+            __WFI();
+        }
+    }
+
     /* LOG SHARE MEMORY Init */
-    logbuf = (struct mculog_buffer*)((void*)SHMEM_LINUX_MEM_BASE + MCULOG_OFFSET);
-    while(logbuf->init_flag != 0x4d43554c);
-    logbuf->init_flag = 0x554C4F47;
-    HAL_DBG("Load mculog_buffer on: 0x%x\n", (unsigned int)(logbuf));
+    logring.hdr = (struct spsc_ring_hdr *)((void *)shm_table + logring_entry->offset);
+    while (SPSC_RING_LOAD(logring.hdr->sync) != MCULOG_SYNC_LINUX &&
+           !(SPSC_RING_LOAD(shm_table->restarts) && SPSC_RING_LOAD(logring.hdr->sync) == MCULOG_SYNC_MCU));
+    spsc_ring_attach(&logring, logring.hdr);
+    SPSC_RING_STORE(logring.hdr->sync, MCULOG_SYNC_MCU);
+    HAL_DBG("Load mculog ring on: 0x%x, size %u\n", (unsigned int)(logring.hdr), logring.size);
 
-    /* PWM CONFIG SHARE MEMORY Init */
-    softpwm = (struct softpwm_config*)((void*)SHMEM_LINUX_MEM_BASE + SOFTPWM_OFFSET);
-    HAL_DBG("Load softpwm_config on: 0x%x\n", (unsigned int)(softpwm));
+    /*
+     * PWM SAMPLE SHARE MEMORY Init. frames and underruns run on from where
+     * the last firmware left them, Linux never sees them go backwards.
+     */
+    softpwm = (struct softpwm_shm *)((void *)shm_table + softpwm_entry->offset);
+    if (SPSC_RING_LOAD(shm_table->restarts)) {
+        frames = SPSC_RING_LOAD(softpwm->frames);
+        underruns = SPSC_RING_LOAD(softpwm->underruns);
+    } else {
+        SPSC_RING_STORE(softpwm->frames, 0);
+        SPSC_RING_STORE(softpwm->underruns, 0);
+    }
+    SPSC_RING_STORE(softpwm->mcu_state, SOFTPWM_STATE_STOP);
+    SPSC_RING_STORE(softpwm->mcu_load, 0);
+    SPSC_RING_STORE(softpwm->mcu_load_max, 0);
+    HAL_DBG("Load softpwm_shm on: 0x%x, size %u\n", (unsigned int)(softpwm),
+            (unsigned int)softpwm_entry->size);
 
-    /* GPIO Init */
-    HAL_GPIO_SetPinDirection(GPIO4, GPIO_PIN_B2, GPIO_OUT);
-    HAL_GPIO_SetPinDirection(GPIO4, GPIO_PIN_B3, GPIO_OUT);
-    HAL_GPIO_SetPinLevel(GPIO4, GPIO_PIN_B2, GPIO_LOW);
-    HAL_GPIO_SetPinLevel(GPIO4, GPIO_PIN_B3, GPIO_LOW);
+    /* KEYBOARD SHARE MEMORY Init, attached once Linux opened the ring */
+    kbd_entry = picocalc_shm_find(shm_table, PICOCALC_SHM_KEYBOARD);
+    if (kbd_entry) {
+        kbd_hdr = (struct spsc_ring_hdr *)((void *)shm_table + kbd_entry->offset);
+    }
+
+    /* STATS SHARE MEMORY Init, published from the first window on */
+    stats_entry = picocalc_shm_find(shm_table, PICOCALC_SHM_STATS);
+    if (stats_entry && stats_entry->size >= sizeof(*stats)) {
+        stats = (struct picocalc_mcu_stats *)((void *)shm_table + stats_entry->offset);
+        stats_reset = SPSC_RING_LOAD(stats->reset);
+    }
+    for (i = 0; i < PICOCALC_STATS_ISRS; i++) {
+        stats_clear(&isr_stats[i]);
+    }
+    stats_idle_min = 1000;
+
+    /* DOORBELL Init */
+    HAL_MBOX_Init(DOORBELL_MBOX, false);
+    HAL_MBOX_RegisterClient(DOORBELL_MBOX, DOORBELL_CHAN, &doorbell_client);
+    HAL_NVIC_SetIRQHandler(DOORBELL_IRQ, doorbell_isr);
+    HAL_NVIC_EnableIRQ(DOORBELL_IRQ);
+
+    /* RPMSG Init, the endpoint is announced once Linux brought the link up */
+    if (RPMSG_LINUX_MEM_SIZE > RPMSG_LINUX_MEM_END - RPMSG_LINUX_MEM_BASE) {
+        HAL_DBG("rpmsg: vrings do not fit the linker region\n");
+    }
+    rpmsg = rpmsg_lite_remote_init((void *)RPMSG_LINUX_MEM_BASE, RPMSG_LINK_ID,
+                                   RL_NO_FLAGS, &rpmsg_ctx);
+
+    /* PWM Init, the pins stay GPIO for the edge engine if PWM1 does not reach them */
+    pwm_engine = pwm_probe();
+    if (!pwm_engine) {
+        HAL_GPIO_SetPinsLevel(GPIO4, PWM_PINS, GPIO_LOW);
+        HAL_GPIO_SetPinDirection(GPIO4, PWM_LEFT_PIN, GPIO_OUT);
+        HAL_GPIO_SetPinDirection(GPIO4, PWM_RIGHT_PIN, GPIO_OUT);
+    }
+    HAL_DBG("softpwm: %s engine\n", pwm_engine ? "PWM1" : "GPIO edge");
+
+    /* CYCLE TIMER Init */
+    cycle_init();
+    stats_stamp = cycle_now();
 
     /* TIMER Init */
-    softpwm->left_duty = 0;
-    softpwm->right_duty = 0;
-#ifdef STEREO
-    HAL_NVIC_SetIRQHandler(left_timer_irq, left_timer_isr);
-    HAL_NVIC_EnableIRQ(left_timer_irq);
-    HAL_TIMER_SetCount(left_timer, 0);
-    HAL_TIMER_Init(left_timer, TIMER_FREE_RUNNING);
-
-    HAL_INTMUX_SetIRQHandler(right_timer_irq, right_timer_isr, NULL);
-    HAL_INTMUX_EnableIRQ(right_timer_irq);
-    HAL_TIMER_SetCount(right_timer, 0);
-    HAL_TIMER_Init(right_timer, TIMER_FREE_RUNNING);
-#else
-    HAL_NVIC_SetIRQHandler(timer_irq, timer_isr);
+    HAL_NVIC_SetIRQHandler(timer_irq, pwm_engine ? pwm_timer_isr : edge_timer_isr);
     HAL_NVIC_EnableIRQ(timer_irq);
     HAL_TIMER_SetCount(timer, 0);
     HAL_TIMER_Init(timer, TIMER_FREE_RUNNING);
-#endif
+
+    /* POLL TIMER Init, the keyboard needs the faster tick */
+    poll_ms = kbd_hdr ? KBD_POLL_MS : POLL_MS;
+    if (poll_ms) {
+        HAL_NVIC_SetIRQHandler(poll_timer_irq, poll_isr);
+        HAL_NVIC_EnableIRQ(poll_timer_irq);
+        HAL_TIMER_Init(poll_timer, TIMER_FREE_RUNNING);
+        HAL_TIMER_SetCount(poll_timer, SOFTPWM_TIMER_HZ / 1000 * poll_ms);
+        HAL_TIMER_Start_IT(poll_timer);
+    }
 
     HAL_DBG("Hello RK3506 mcu\n");
 
     while (1) {
-#ifdef STEREO
-        if (softpwm->left_duty && !left_enable)
-        {
-            HAL_TIMER_SetCount(left_timer, softpwm->left_duty);
-            HAL_TIMER_Start_IT(left_timer);
-            left_enable = true;
+        uint32_t pending, idle = 0, wfi;
+
+        /*
+         * Sleep until an interrupt posts work, WFI still wakes with IRQs
+         * masked, so the time asleep does not include the waking handler.
+         */
+        __disable_irq();
+        if (!events && panel_head == panel_tail) {
+            wfi = cycle_now();
+            __WFI();
+            idle = cycle_now() - wfi;
         }
-        if (softpwm->right_duty && !right_enable)
-        {
-            HAL_TIMER_SetCount(right_timer, softpwm->right_duty);
-            HAL_TIMER_Start_IT(right_timer);
-            right_enable = true;
+        pending = events;
+        events = 0;
+        __enable_irq();
+
+        stats_publish(idle);
+
+        if (pending & EVENT_LOAD) {
+            load_publish();
         }
-#else
-        if (softpwm->left_duty && !enable)
+        /* Also on other wakeups: link up comes in through rpmsg-lite's own IRQ */
+        rpmsg_poll();
+        if (pending & EVENT_POLL) {
+            kbd_poll();
+        }
+        /* Keeps the loop awake while a flush is running */
+        panel_work();
+        rpmsg_flush();
+        if (!enable && SPSC_RING_LOAD(softpwm->state) == SOFTPWM_STATE_RUN)
         {
-            HAL_TIMER_SetCount(timer, softpwm->left_duty);
-            HAL_TIMER_Start_IT(timer);
+            softpwm_start();
             HAL_DBG("Sound Start\n");
-            enable = true;
+            playing = true;
+        }
+        else if (playing && !enable)
+        {
+            /* Logged here, the log ring has a single producer */
+            HAL_DBG("Sound Stop\n");
+            SPSC_RING_STORE(softpwm->mcu_load, 0);
+            playing = false;
         }
-#endif
-        HAL_DelayUs(1);
     }
 }
 
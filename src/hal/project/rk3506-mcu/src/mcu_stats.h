@@ -0,0 +1 @@
+../../../../kernel-6.1/include/soc/picocalc/mcu_stats.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../../../kernel-6.1/include/soc/picocalc/panel.h
\ No newline at end of file
@@ -0,0 +1,32 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * rpmsg-lite configuration of the PicoCalc MCU firmware.
+ *
+ * Static API and zero copy: the M0 has no heap worth the name, endpoints
+ * and the instance live in main.c and records are built and parsed in
+ * place in the vring buffers. RL_BUFFER_COUNT and the payload size must
+ * match the rpmsg_dma_reserved pool of the device tree.
+ */
+
+#ifndef RPMSG_CONFIG_H_
+#define RPMSG_CONFIG_H_
+
+#define RL_MS_PER_INTERVAL                      (1)
+#define RL_BUFFER_PAYLOAD_SIZE                  (496U)
+#define RL_BUFFER_COUNT                         (32U)
+#define RL_API_HAS_ZEROCOPY                     (1)
+#define RL_USE_STATIC_API                       (1)
+#define RL_CLEAR_USED_BUFFERS                   (0)
+#define RL_USE_MCMGR_IPC_ISR_HANDLER            (0)
+#define RL_USE_ENVIRONMENT_CONTEXT              (0)
+#define RL_DEBUG_CHECK_BUFFERS                  (0)
+#define RL_ALLOW_CONSUMED_BUFFERS_NOTIFICATION  (0)
+#define RL_HANG                                 (0)
+#define RL_ASSERT(x)                            \
+    do {                                        \
+        if (!(x)) {                             \
+            while (1);                          \
+        }                                       \
+    } while (0)
+
+#endif /* RPMSG_CONFIG_H_ */
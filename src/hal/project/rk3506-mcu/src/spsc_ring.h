@@ -0,0 +1 @@
+../../../../kernel-6.1/include/soc/picocalc/spsc_ring.h
\ No newline at end of file
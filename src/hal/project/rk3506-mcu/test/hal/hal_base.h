@@ -0,0 +1,305 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Mock of the Rockchip HAL for host builds of ../../src/main.c.
+ *
+ * Only what main.c uses, with the same names and signatures. Peripherals
+ * are plain structs in host memory that the tests inspect: timers keep
+ * their load and count, GPIO banks their levels, the PWM block is a
+ * register file at the real channel offsets and SPI transfers go to a
+ * hook. Every mock call bumps mock_calls, a rough measure of how much bus
+ * traffic an interrupt handler makes on the M0.
+ */
+
+#ifndef __HAL_BASE_H
+#define __HAL_BASE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define HAL_BIT(n)	(1U << (n))
+#define __USED		__attribute__((used))
+
+typedef enum {
+	HAL_OK,
+	HAL_ERROR,
+	HAL_BUSY,
+	HAL_TIMEOUT,
+} HAL_Status;
+
+extern unsigned long mock_calls;
+
+/*
+ * Time, in SOFTPWM_TIMER_HZ ticks. It only moves when a test moves it,
+ * and by mock_call_ticks on every mock call, so handlers take as long on
+ * the host as the calls they make.
+ */
+extern uint64_t mock_ticks;
+extern uint32_t mock_call_ticks;
+
+#define MOCK_TICKS_PER_US	24
+
+HAL_Status HAL_DelayUs(uint32_t us);
+
+int mock_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+#define HAL_DBG(...)	mock_printf(__VA_ARGS__)
+
+/* CMSIS, the host runs the handlers by hand so there is nothing to mask */
+static inline void __WFI(void) {}
+static inline void __disable_irq(void) {}
+static inline void __enable_irq(void) {}
+
+HAL_Status HAL_Init(void);
+HAL_Status HAL_INTMUX_Init(void);
+
+/* NVIC */
+typedef void (*NVIC_IRQHandler)(unsigned long irq, void *args);
+
+enum {
+	TIMER0_IRQn = 0,
+	TIMER4_IRQn = 4,
+	TIMER5_IRQn = 5,
+	MBOX0_CH0_A2B_IRQn = 16,
+};
+
+HAL_Status HAL_NVIC_SetIRQHandler(uint32_t irq, NVIC_IRQHandler handler);
+HAL_Status HAL_NVIC_EnableIRQ(uint32_t irq);
+
+/* CRU, rates of the clocks are settable through mock_clk_hz */
+enum {
+	CLK_I2C0,
+	CLK_SPI0,
+	CLK_PWM1,
+	CLK_COUNT,
+};
+
+extern uint32_t mock_clk_hz[CLK_COUNT];
+
+HAL_Status HAL_CRU_ClkSetFreq(uint32_t clk, uint32_t rate);
+uint32_t HAL_CRU_ClkGetFreq(uint32_t clk);
+
+/*
+ * TIMER, counts up from 0 to load and wraps, from mock_ticks while it
+ * runs. mock_timer_expiry() is when a running timer reaches load next.
+ */
+typedef enum {
+	TIMER_FREE_RUNNING,
+	TIMER_USER_DEFINED,
+} eTIMER_MODE;
+
+struct TIMER_REG {
+	uint64_t load;
+	uint64_t count;
+	uint64_t base;		/* mock_ticks at count 0 */
+	bool running;
+	bool irq;
+	bool pending;
+};
+
+extern struct TIMER_REG mock_timer[6];
+#define TIMER0	(&mock_timer[0])
+#define TIMER4	(&mock_timer[4])
+#define TIMER5	(&mock_timer[5])
+
+HAL_Status HAL_TIMER_Init(struct TIMER_REG *pReg, eTIMER_MODE mode);
+HAL_Status HAL_TIMER_SetCount(struct TIMER_REG *pReg, uint64_t timerCount);
+uint64_t HAL_TIMER_GetCount(struct TIMER_REG *pReg);
+HAL_Status HAL_TIMER_Start(struct TIMER_REG *pReg);
+HAL_Status HAL_TIMER_Start_IT(struct TIMER_REG *pReg);
+HAL_Status HAL_TIMER_Stop_IT(struct TIMER_REG *pReg);
+HAL_Status HAL_TIMER_ClrInt(struct TIMER_REG *pReg);
+uint64_t mock_timer_expiry(const struct TIMER_REG *pReg);
+
+/*
+ * GPIO, bank pins A0-D7 are bits 0-31. A pad reads its output latch as
+ * GPIO, the PWM1 channel when muxed to it (FUNC1 of GPIO4 B2/B3 is
+ * channel 2/3 if mock_pwm_routed) and low otherwise, pulled down.
+ */
+typedef enum {
+	GPIO_LOW,
+	GPIO_HIGH,
+} eGPIO_pinLevel;
+
+typedef enum {
+	GPIO_IN,
+	GPIO_OUT,
+} eGPIO_pinDirection;
+
+#define GPIO_PIN_A3	HAL_BIT(3)
+#define GPIO_PIN_B2	HAL_BIT(10)
+#define GPIO_PIN_B3	HAL_BIT(11)
+
+struct GPIO_REG {
+	uint32_t level;
+	uint32_t dir;
+	uint32_t func1;		/* pins muxed to FUNC1 */
+};
+
+extern struct GPIO_REG mock_gpio[5];
+#define GPIO0	(&mock_gpio[0])
+#define GPIO4	(&mock_gpio[4])
+
+HAL_Status HAL_GPIO_SetPinLevel(struct GPIO_REG *pGPIO, uint32_t pin, eGPIO_pinLevel level);
+HAL_Status HAL_GPIO_SetPinsLevel(struct GPIO_REG *pGPIO, uint32_t mPins, eGPIO_pinLevel level);
+HAL_Status HAL_GPIO_SetPinDirection(struct GPIO_REG *pGPIO, uint32_t pin,
+				    eGPIO_pinDirection direction);
+eGPIO_pinLevel HAL_GPIO_GetPinLevel(struct GPIO_REG *pGPIO, uint32_t pin);
+
+/* PINCTRL */
+#define GPIO_BANK4		4
+#define PIN_CONFIG_MUX_FUNC0	0
+#define PIN_CONFIG_MUX_FUNC1	1
+
+HAL_Status HAL_PINCTRL_SetIOMUX(uint32_t bank, uint32_t mPins, uint32_t param);
+
+/*
+ * PWM, four channels of 4 KB each. HAL_PWM_SetConfig() programs PERIOD and
+ * DUTY like the real driver, truncating ns to counts, unless
+ * mock_pwm_layout_bad moves them somewhere main.c does not look.
+ */
+typedef enum {
+	HAL_PWM_ONE_SHOT,
+	HAL_PWM_CONTINUOUS,
+} ePWM_Mode;
+
+struct PWM_REG {
+	uint32_t ch[4][0x1000 / 4];
+};
+
+struct PWM_HANDLE {
+	struct PWM_REG *pReg;
+	uint32_t freq;
+};
+
+struct HAL_PWM_CONFIG {
+	uint8_t channel;
+	uint32_t periodNS;
+	uint32_t dutyNS;
+	bool polarity;
+};
+
+extern struct PWM_REG mock_pwm1;
+extern bool mock_pwm_layout_bad;
+extern bool mock_pwm_routed;
+extern uint32_t mock_pwm_config_duty[4];	/* counts, last HAL_PWM_SetConfig() */
+#define PWM1	(&mock_pwm1)
+
+HAL_Status HAL_PWM_Init(struct PWM_HANDLE *pPWM, struct PWM_REG *pReg, uint32_t freq);
+HAL_Status HAL_PWM_SetConfig(struct PWM_HANDLE *pPWM, uint8_t channel,
+			     const struct HAL_PWM_CONFIG *config);
+HAL_Status HAL_PWM_Enable(struct PWM_HANDLE *pPWM, uint8_t channel, ePWM_Mode mode);
+HAL_Status HAL_PWM_Disable(struct PWM_HANDLE *pPWM, uint8_t channel);
+
+/* MBOX, sent messages are counted per channel */
+typedef enum {
+	MBOX_CH_0,
+	MBOX_CH_1,
+	MBOX_CH_2,
+	MBOX_CH_3,
+	MBOX_CH_MAX,
+} eMBOX_CH;
+
+struct MBOX_REG {
+	uint32_t sent[MBOX_CH_MAX];
+	uint32_t last[MBOX_CH_MAX];
+};
+
+struct MBOX_CMD_DAT {
+	uint32_t CMD;
+	uint32_t DATA;
+};
+
+struct MBOX_CLIENT {
+	char name[16];
+	void (*RXCallback)(struct MBOX_CMD_DAT *msg, void *args);
+};
+
+extern struct MBOX_REG mock_mbox0;
+#define MBOX0	(&mock_mbox0)
+
+HAL_Status HAL_MBOX_Init(struct MBOX_REG *pReg, bool isA2B);
+HAL_Status HAL_MBOX_RegisterClient(struct MBOX_REG *pReg, eMBOX_CH chan,
+				   const struct MBOX_CLIENT *client);
+HAL_Status HAL_MBOX_SendMsg(struct MBOX_REG *pReg, eMBOX_CH chan,
+			    const struct MBOX_CMD_DAT *msg);
+HAL_Status HAL_MBOX_IrqHandler(int irq, struct MBOX_REG *pReg);
+
+/* I2C, no controller behind it: every transfer fails */
+#define I2C0	0xff040000U
+
+typedef enum {
+	REG_CON_MOD_TX,
+	REG_CON_MOD_REGISTER_TX,
+	REG_CON_MOD_RX,
+	REG_CON_MOD_REGISTER_RX,
+} eI2C_Mode;
+
+typedef enum {
+	I2C_POLL,
+	I2C_IT,
+} eI2C_TransferType;
+
+typedef enum {
+	I2C_100K = 100000,
+	I2C_400K = 400000,
+} eI2C_BusSpeed;
+
+struct I2C_HANDLE {
+	uint32_t base;
+};
+
+HAL_Status HAL_I2C_Init(struct I2C_HANDLE *pI2C, uint32_t base, uint32_t rate,
+			eI2C_BusSpeed speed);
+HAL_Status HAL_I2C_DeInit(struct I2C_HANDLE *pI2C);
+HAL_Status HAL_I2C_SetupMsg(struct I2C_HANDLE *pI2C, uint16_t addr, uint8_t *buf,
+			    uint16_t len, eI2C_Mode mode, uint8_t flags);
+HAL_Status HAL_I2C_Transfer(struct I2C_HANDLE *pI2C, eI2C_TransferType type, bool last);
+HAL_Status HAL_I2C_IRQHandler(struct I2C_HANDLE *pI2C);
+
+/*
+ * SPI master. A PIO transfer hands its bytes to mock_spi_tx in wire order:
+ * 16 bit frames of a big endian transfer go out MSB first, so a little
+ * endian buffer arrives byte swapped, as on the real controller.
+ */
+#define SPI0	0xff0b0000U
+
+#define CR0_OPM_MASTER		0
+#define CR0_XFM_TO		1
+#define CR0_EM_BIG		1
+#define CR0_BHT_8BIT		1
+#define CR0_POLARITY_LOW	0
+#define CR0_PHASE_1EDGE		0
+#define CR0_SSD_ONE		0
+
+struct SPI_CONFIG {
+	uint32_t opMode;
+	uint32_t xfmMode;
+	uint32_t nBytes;
+	uint32_t endianMode;
+	uint32_t apbTransform;
+	uint32_t clkPolarity;
+	uint32_t clkPhase;
+	uint32_t ssd;
+	uint32_t speed;
+};
+
+struct SPI_HANDLE {
+	uint32_t base;
+	uint32_t maxFreq;
+	struct SPI_CONFIG config;
+	const uint8_t *pTxBuffer;
+	uint32_t len;
+	bool cs;
+};
+
+extern void (*mock_spi_tx)(const uint8_t *buf, uint32_t len, bool cs);
+
+HAL_Status HAL_SPI_Init(struct SPI_HANDLE *pSPI, uint32_t base, bool slave);
+HAL_Status HAL_SPI_SetCS(struct SPI_HANDLE *pSPI, uint8_t cs, bool select);
+HAL_Status HAL_SPI_Configure(struct SPI_HANDLE *pSPI, const uint8_t *pTxData,
+			     uint8_t *pRxData, uint32_t size);
+HAL_Status HAL_SPI_PioTransfer(struct SPI_HANDLE *pSPI);
+HAL_Status HAL_SPI_QueryBusState(struct SPI_HANDLE *pSPI);
+
+#endif /* __HAL_BASE_H */
@@ -0,0 +1,13 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Mock of the board support of the Rockchip HAL, see hal_base.h.
+ */
+
+#ifndef __HAL_BSP_H
+#define __HAL_BSP_H
+
+#include "hal_base.h"
+
+void BSP_Init(void);
+
+#endif /* __HAL_BSP_H */
@@ -0,0 +1,498 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Mock HAL and rpmsg-lite, see hal_base.h and rpmsg_lite.h.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "hal_bsp.h"
+#include "rpmsg_ns.h"
+
+unsigned long mock_calls;
+uint64_t mock_ticks;
+uint32_t mock_call_ticks;
+
+uint32_t mock_clk_hz[CLK_COUNT] = {
+	[CLK_I2C0] = 100000000,
+	[CLK_SPI0] = 200000000,
+	[CLK_PWM1] = 24000000,
+};
+
+struct TIMER_REG mock_timer[6];
+struct GPIO_REG mock_gpio[5];
+struct PWM_REG mock_pwm1;
+bool mock_pwm_layout_bad;
+bool mock_pwm_routed;
+uint32_t mock_pwm_config_duty[4];
+struct MBOX_REG mock_mbox0;
+void (*mock_spi_tx)(const uint8_t *buf, uint32_t len, bool cs);
+uint8_t mock_rpmsg_tx[RL_BUFFER_PAYLOAD_SIZE];
+bool mock_rpmsg_tx_busy;
+void (*mock_rpmsg_sent)(uint32_t dst, const void *data, uint32_t size);
+
+static void mock_call(void)
+{
+	mock_calls++;
+	mock_ticks += mock_call_ticks;
+}
+
+/* The firmware's stdout, the log ring */
+int _write(int fd, char *ptr, int len);
+
+int mock_printf(const char *fmt, ...)
+{
+	char buf[256];
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	if (len > (int)sizeof(buf) - 1)
+		len = sizeof(buf) - 1;
+
+	return _write(1, buf, len);
+}
+
+HAL_Status HAL_DelayUs(uint32_t us)
+{
+	mock_call();
+	mock_ticks += (uint64_t)us * MOCK_TICKS_PER_US;
+	return HAL_OK;
+}
+
+HAL_Status HAL_Init(void)
+{
+	mock_call();
+	return HAL_OK;
+}
+
+HAL_Status HAL_INTMUX_Init(void)
+{
+	mock_call();
+	return HAL_OK;
+}
+
+void BSP_Init(void)
+{
+	mock_call();
+}
+
+HAL_Status HAL_NVIC_SetIRQHandler(uint32_t irq, NVIC_IRQHandler handler)
+{
+	(void)irq;
+	(void)handler;
+	mock_call();
+	return HAL_OK;
+}
+
+HAL_Status HAL_NVIC_EnableIRQ(uint32_t irq)
+{
+	(void)irq;
+	mock_call();
+	return HAL_OK;
+}
+
+HAL_Status HAL_CRU_ClkSetFreq(uint32_t clk, uint32_t rate)
+{
+	(void)clk;
+	(void)rate;
+	mock_call();
+	return HAL_OK;
+}
+
+uint32_t HAL_CRU_ClkGetFreq(uint32_t clk)
+{
+	mock_call();
+	return clk < CLK_COUNT ? mock_clk_hz[clk] : 0;
+}
+
+HAL_Status HAL_TIMER_Init(struct TIMER_REG *pReg, eTIMER_MODE mode)
+{
+	(void)mode;
+	mock_call();
+	pReg->running = false;
+	pReg->irq = false;
+	pReg->count = 0;
+	return HAL_OK;
+}
+
+HAL_Status HAL_TIMER_SetCount(struct TIMER_REG *pReg, uint64_t timerCount)
+{
+	mock_call();
+	pReg->load = timerCount;
+	return HAL_OK;
+}
+
+static void timer_update(struct TIMER_REG *pReg)
+{
+	if (!pReg->running)
+		return;
+	pReg->count = mock_ticks - pReg->base;
+	if (pReg->load && pReg->count >= pReg->load)
+		pReg->count %= pReg->load;
+}
+
+/* The count is read at the end of the call, as late as it can be */
+uint64_t HAL_TIMER_GetCount(struct TIMER_REG *pReg)
+{
+	mock_call();
+	timer_update(pReg);
+	return pReg->count;
+}
+
+/* Counting starts at the end of the call */
+HAL_Status HAL_TIMER_Start(struct TIMER_REG *pReg)
+{
+	mock_call();
+	pReg->running = true;
+	pReg->count = 0;
+	pReg->base = mock_ticks;
+	return HAL_OK;
+}
+
+HAL_Status HAL_TIMER_Start_IT(struct TIMER_REG *pReg)
+{
+	mock_call();
+	pReg->running = true;
+	pReg->irq = true;
+	pReg->count = 0;
+	pReg->base = mock_ticks;
+	return HAL_OK;
+}
+
+/* Counting stops at the start of the call */
+HAL_Status HAL_TIMER_Stop_IT(struct TIMER_REG *pReg)
+{
+	timer_update(pReg);
+	mock_call();
+	pReg->running = false;
+	pReg->irq = false;
+	return HAL_OK;
+}
+
+HAL_Status HAL_TIMER_ClrInt(struct TIMER_REG *pReg)
+{
+	mock_call();
+	pReg->pending = false;
+	return HAL_OK;
+}
+
+uint64_t mock_timer_expiry(const struct TIMER_REG *pReg)
+{
+	uint64_t elapsed = mock_ticks - pReg->base;
+
+	if (!pReg->load)
+		return pReg->base;
+	return pReg->base + (elapsed / pReg->load + 1) * pReg->load;
+}
+
+HAL_Status HAL_GPIO_SetPinLevel(struct GPIO_REG *pGPIO, uint32_t pin, eGPIO_pinLevel level)
+{
+	mock_call();
+	if (level == GPIO_HIGH)
+		pGPIO->level |= pin;
+	else
+		pGPIO->level &= ~pin;
+	return HAL_OK;
+}
+
+HAL_Status HAL_GPIO_SetPinsLevel(struct GPIO_REG *pGPIO, uint32_t mPins, eGPIO_pinLevel level)
+{
+	mock_call();
+	if (level == GPIO_HIGH)
+		pGPIO->level |= mPins;
+	else
+		pGPIO->level &= ~mPins;
+	return HAL_OK;
+}
+
+HAL_Status HAL_GPIO_SetPinDirection(struct GPIO_REG *pGPIO, uint32_t pin,
+				    eGPIO_pinDirection direction)
+{
+	mock_call();
+	if (direction == GPIO_OUT)
+		pGPIO->dir |= pin;
+	else
+		pGPIO->dir &= ~pin;
+	return HAL_OK;
+}
+
+/* An enabled channel is high while its duty is more than half the period */
+static eGPIO_pinLevel mock_pwm_level(uint32_t channel)
+{
+	const uint32_t *ch = mock_pwm1.ch[channel];
+	uint32_t reg = mock_pwm_layout_bad ? 0x20 / 4 : 0x10 / 4;
+
+	return (ch[0] & 1) && ch[reg + 1] * 2 > ch[reg] ? GPIO_HIGH : GPIO_LOW;
+}
+
+eGPIO_pinLevel HAL_GPIO_GetPinLevel(struct GPIO_REG *pGPIO, uint32_t pin)
+{
+	mock_call();
+	if (pGPIO->func1 & pin) {
+		if (!mock_pwm_routed || pGPIO != GPIO4 || !(pin & (GPIO_PIN_B2 | GPIO_PIN_B3)))
+			return GPIO_LOW;
+		return mock_pwm_level(pin & GPIO_PIN_B2 ? 2 : 3);
+	}
+	return pGPIO->dir & pGPIO->level & pin ? GPIO_HIGH : GPIO_LOW;
+}
+
+HAL_Status HAL_PINCTRL_SetIOMUX(uint32_t bank, uint32_t mPins, uint32_t param)
+{
+	mock_call();
+	if (param == PIN_CONFIG_MUX_FUNC1)
+		mock_gpio[bank].func1 |= mPins;
+	else
+		mock_gpio[bank].func1 &= ~mPins;
+	return HAL_OK;
+}
+
+HAL_Status HAL_PWM_Init(struct PWM_HANDLE *pPWM, struct PWM_REG *pReg, uint32_t freq)
+{
+	mock_call();
+	pPWM->pReg = pReg;
+	pPWM->freq = freq;
+	return HAL_OK;
+}
+
+/* PERIOD at 0x10 and DUTY at 0x14 of the channel, see main.c */
+HAL_Status HAL_PWM_SetConfig(struct PWM_HANDLE *pPWM, uint8_t channel,
+			     const struct HAL_PWM_CONFIG *config)
+{
+	uint32_t *ch = pPWM->pReg->ch[channel];
+	uint32_t period = (uint64_t)config->periodNS * pPWM->freq / 1000000000;
+	uint32_t duty = (uint64_t)config->dutyNS * pPWM->freq / 1000000000;
+	uint32_t reg = mock_pwm_layout_bad ? 0x20 / 4 : 0x10 / 4;
+
+	mock_call();
+	ch[reg] = period;
+	ch[reg + 1] = duty;
+	mock_pwm_config_duty[channel] = duty;
+	return HAL_OK;
+}
+
+HAL_Status HAL_PWM_Enable(struct PWM_HANDLE *pPWM, uint8_t channel, ePWM_Mode mode)
+{
+	(void)mode;
+	mock_call();
+	pPWM->pReg->ch[channel][0] |= 1;
+	return HAL_OK;
+}
+
+HAL_Status HAL_PWM_Disable(struct PWM_HANDLE *pPWM, uint8_t channel)
+{
+	mock_call();
+	pPWM->pReg->ch[channel][0] &= ~1U;
+	return HAL_OK;
+}
+
+HAL_Status HAL_MBOX_Init(struct MBOX_REG *pReg, bool isA2B)
+{
+	(void)isA2B;
+	mock_call();
+	memset(pReg, 0, sizeof(*pReg));
+	return HAL_OK;
+}
+
+HAL_Status HAL_MBOX_RegisterClient(struct MBOX_REG *pReg, eMBOX_CH chan,
+				   const struct MBOX_CLIENT *client)
+{
+	(void)pReg;
+	(void)chan;
+	(void)client;
+	mock_call();
+	return HAL_OK;
+}
+
+HAL_Status HAL_MBOX_SendMsg(struct MBOX_REG *pReg, eMBOX_CH chan,
+			    const struct MBOX_CMD_DAT *msg)
+{
+	mock_call();
+	pReg->sent[chan]++;
+	pReg->last[chan] = msg->CMD;
+	return HAL_OK;
+}
+
+HAL_Status HAL_MBOX_IrqHandler(int irq, struct MBOX_REG *pReg)
+{
+	(void)irq;
+	(void)pReg;
+	mock_call();
+	return HAL_OK;
+}
+
+HAL_Status HAL_I2C_Init(struct I2C_HANDLE *pI2C, uint32_t base, uint32_t rate,
+			eI2C_BusSpeed speed)
+{
+	(void)rate;
+	(void)speed;
+	mock_call();
+	pI2C->base = base;
+	return HAL_OK;
+}
+
+HAL_Status HAL_I2C_DeInit(struct I2C_HANDLE *pI2C)
+{
+	mock_call();
+	pI2C->base = 0;
+	return HAL_OK;
+}
+
+HAL_Status HAL_I2C_SetupMsg(struct I2C_HANDLE *pI2C, uint16_t addr, uint8_t *buf,
+			    uint16_t len, eI2C_Mode mode, uint8_t flags)
+{
+	(void)pI2C;
+	(void)addr;
+	(void)buf;
+	(void)len;
+	(void)mode;
+	(void)flags;
+	mock_call();
+	return HAL_OK;
+}
+
+HAL_Status HAL_I2C_Transfer(struct I2C_HANDLE *pI2C, eI2C_TransferType type, bool last)
+{
+	(void)pI2C;
+	(void)type;
+	(void)last;
+	mock_call();
+	return HAL_ERROR;
+}
+
+HAL_Status HAL_I2C_IRQHandler(struct I2C_HANDLE *pI2C)
+{
+	(void)pI2C;
+	mock_call();
+	return HAL_ERROR;
+}
+
+HAL_Status HAL_SPI_Init(struct SPI_HANDLE *pSPI, uint32_t base, bool slave)
+{
+	(void)slave;
+	mock_call();
+	memset(pSPI, 0, sizeof(*pSPI));
+	pSPI->base = base;
+	return HAL_OK;
+}
+
+HAL_Status HAL_SPI_SetCS(struct SPI_HANDLE *pSPI, uint8_t cs, bool select)
+{
+	(void)cs;
+	mock_call();
+	pSPI->cs = select;
+	return HAL_OK;
+}
+
+HAL_Status HAL_SPI_Configure(struct SPI_HANDLE *pSPI, const uint8_t *pTxData,
+			     uint8_t *pRxData, uint32_t size)
+{
+	(void)pRxData;
+	mock_call();
+	pSPI->pTxBuffer = pTxData;
+	pSPI->len = size;
+	return HAL_OK;
+}
+
+HAL_Status HAL_SPI_PioTransfer(struct SPI_HANDLE *pSPI)
+{
+	uint8_t wire[512];
+	uint32_t done, n, i;
+	bool swap = pSPI->config.nBytes == 2 && pSPI->config.endianMode == CR0_EM_BIG;
+
+	mock_call();
+	for (done = 0; done < pSPI->len; done += n) {
+		n = pSPI->len - done < sizeof(wire) ? pSPI->len - done : sizeof(wire);
+		for (i = 0; i < n; i++)
+			wire[i] = pSPI->pTxBuffer[done + (swap ? i ^ 1 : i)];
+		if (mock_spi_tx)
+			mock_spi_tx(wire, n, pSPI->cs);
+	}
+	return HAL_OK;
+}
+
+HAL_Status HAL_SPI_QueryBusState(struct SPI_HANDLE *pSPI)
+{
+	(void)pSPI;
+	mock_call();
+	return HAL_OK;
+}
+
+struct rpmsg_lite_instance *rpmsg_lite_remote_init(void *shmem_addr, uint32_t link_id,
+						   uint32_t init_flags,
+						   struct rpmsg_lite_instance *static_context)
+{
+	(void)shmem_addr;
+	(void)init_flags;
+	mock_call();
+	static_context->link_id = link_id;
+	return static_context;
+}
+
+uint32_t rpmsg_lite_is_link_up(struct rpmsg_lite_instance *rpmsg_lite_dev)
+{
+	(void)rpmsg_lite_dev;
+	mock_call();
+	return 1;
+}
+
+struct rpmsg_lite_endpoint *rpmsg_lite_create_ept(struct rpmsg_lite_instance *rpmsg_lite_dev,
+						  uint32_t addr, rl_ept_rx_cb_t rx_cb,
+						  void *rx_cb_data,
+						  struct rpmsg_lite_ept_static_context *ept_context)
+{
+	(void)rpmsg_lite_dev;
+	mock_call();
+	ept_context->ept.addr = addr;
+	ept_context->ept.rx_cb = rx_cb;
+	ept_context->ept.rx_cb_data = rx_cb_data;
+	return &ept_context->ept;
+}
+
+int32_t rpmsg_ns_announce(struct rpmsg_lite_instance *rpmsg_lite_dev,
+			  struct rpmsg_lite_endpoint *new_ept, const char *ept_name,
+			  uint32_t flags)
+{
+	(void)rpmsg_lite_dev;
+	(void)new_ept;
+	(void)ept_name;
+	(void)flags;
+	mock_call();
+	return 0;
+}
+
+void *rpmsg_lite_alloc_tx_buffer(struct rpmsg_lite_instance *rpmsg_lite_dev, uint32_t *size,
+				 uintptr_t timeout)
+{
+	(void)rpmsg_lite_dev;
+	(void)timeout;
+	mock_call();
+	if (mock_rpmsg_tx_busy)
+		return NULL;
+	mock_rpmsg_tx_busy = true;
+	*size = sizeof(mock_rpmsg_tx);
+	return mock_rpmsg_tx;
+}
+
+int32_t rpmsg_lite_send_nocopy(struct rpmsg_lite_instance *rpmsg_lite_dev,
+			       struct rpmsg_lite_endpoint *ept, uint32_t dst, void *data,
+			       uint32_t size)
+{
+	(void)rpmsg_lite_dev;
+	(void)ept;
+	mock_call();
+	if (mock_rpmsg_sent)
+		mock_rpmsg_sent(dst, data, size);
+	mock_rpmsg_tx_busy = false;
+	return 0;
+}
+
+int32_t rpmsg_lite_release_rx_buffer(struct rpmsg_lite_instance *rpmsg_lite_dev, void *rxbuf)
+{
+	(void)rpmsg_lite_dev;
+	(void)rxbuf;
+	mock_call();
+	return 0;
+}
@@ -0,0 +1,60 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Mock of rpmsg-lite for host builds of ../../src/main.c, see hal_base.h.
+ *
+ * The link is always up. The one tx buffer is taken from mock_rpmsg_tx
+ * unless mock_rpmsg_tx_busy is set, and what is sent goes to
+ * mock_rpmsg_sent.
+ */
+
+#ifndef __RPMSG_LITE_H
+#define __RPMSG_LITE_H
+
+#include "hal_base.h"
+
+#define RL_ADDR_ANY			0xffffffffU
+#define RL_BUFFER_PAYLOAD_SIZE		496U
+#define RL_VRING_OVERHEAD		0x1000U
+#define RL_PLATFORM_SET_LINK_ID(master, remote)	(((master) << 16) | (remote))
+#define RL_NO_FLAGS			0U
+#define RL_DONT_BLOCK			0U
+#define RL_RELEASE			0
+#define RL_HOLD				1
+
+typedef int32_t (*rl_ept_rx_cb_t)(void *payload, uint32_t payload_len, uint32_t src,
+				  void *priv);
+
+struct rpmsg_lite_instance {
+	uint32_t link_id;
+};
+
+struct rpmsg_lite_endpoint {
+	uint32_t addr;
+	rl_ept_rx_cb_t rx_cb;
+	void *rx_cb_data;
+};
+
+struct rpmsg_lite_ept_static_context {
+	struct rpmsg_lite_endpoint ept;
+};
+
+extern uint8_t mock_rpmsg_tx[RL_BUFFER_PAYLOAD_SIZE];
+extern bool mock_rpmsg_tx_busy;
+extern void (*mock_rpmsg_sent)(uint32_t dst, const void *data, uint32_t size);
+
+struct rpmsg_lite_instance *rpmsg_lite_remote_init(void *shmem_addr, uint32_t link_id,
+						   uint32_t init_flags,
+						   struct rpmsg_lite_instance *static_context);
+uint32_t rpmsg_lite_is_link_up(struct rpmsg_lite_instance *rpmsg_lite_dev);
+struct rpmsg_lite_endpoint *rpmsg_lite_create_ept(struct rpmsg_lite_instance *rpmsg_lite_dev,
+						  uint32_t addr, rl_ept_rx_cb_t rx_cb,
+						  void *rx_cb_data,
+						  struct rpmsg_lite_ept_static_context *ept_context);
+void *rpmsg_lite_alloc_tx_buffer(struct rpmsg_lite_instance *rpmsg_lite_dev, uint32_t *size,
+				 uintptr_t timeout);
+int32_t rpmsg_lite_send_nocopy(struct rpmsg_lite_instance *rpmsg_lite_dev,
+			       struct rpmsg_lite_endpoint *ept, uint32_t dst, void *data,
+			       uint32_t size);
+int32_t rpmsg_lite_release_rx_buffer(struct rpmsg_lite_instance *rpmsg_lite_dev, void *rxbuf);
+
+#endif /* __RPMSG_LITE_H */
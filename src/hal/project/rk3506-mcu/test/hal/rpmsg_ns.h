@@ -0,0 +1,17 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Mock of the rpmsg-lite name service, see rpmsg_lite.h.
+ */
+
+#ifndef __RPMSG_NS_H
+#define __RPMSG_NS_H
+
+#include "rpmsg_lite.h"
+
+#define RL_NS_CREATE	0U
+
+int32_t rpmsg_ns_announce(struct rpmsg_lite_instance *rpmsg_lite_dev,
+			  struct rpmsg_lite_endpoint *new_ept, const char *ept_name,
+			  uint32_t flags);
+
+#endif /* __RPMSG_NS_H */
@@ -0,0 +1,13 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Mock barriers, the host tests run the driver and the MCU in one thread */
+
+#ifndef __MOCK_ASM_BARRIER_H
+#define __MOCK_ASM_BARRIER_H
+
+#define mb()		__atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define rmb()		__atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define wmb()		__atomic_thread_fence(__ATOMIC_RELEASE)
+#define dma_rmb()	rmb()
+#define dma_wmb()	wmb()
+
+#endif /* __MOCK_ASM_BARRIER_H */
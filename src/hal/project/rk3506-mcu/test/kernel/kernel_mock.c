@@ -0,0 +1,378 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Mock kernel and ALSA core, see linux/kernel.h and sound/pcm.h.
+ *
+ * The PCM core follows sound/core/pcm_native.c and pcm_lib.c of 6.1 for
+ * one playback substream, with the default thresholds: prepare calls the
+ * driver first and then resets hw_ptr and appl_ptr, the pointer is read
+ * on every period interrupt and a stream whose buffer has run dry either
+ * ends its drain or goes to XRUN.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#include <sound/pcm.h>
+
+struct mbox_chan mock_mbox_chan;
+void (*mock_mbox_sent)(void *mssg);
+struct snd_pcm *mock_pcm;
+
+void mock_spin_lock(spinlock_t *lock)
+{
+	if (lock->locked) {
+		fprintf(stderr, "spinlock taken twice\n");
+		abort();
+	}
+	lock->locked = 1;
+}
+
+void mock_spin_unlock(spinlock_t *lock)
+{
+	lock->locked = 0;
+}
+
+int mock_dev_printk(const struct device *dev, const char *fmt, ...)
+{
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	return len;
+}
+
+struct mbox_chan *mbox_request_channel_byname(struct mbox_client *cl, const char *name)
+{
+	mock_mbox_chan.cl = cl;
+	return &mock_mbox_chan;
+}
+
+int mbox_send_message(struct mbox_chan *chan, void *mssg)
+{
+	if (mock_mbox_sent)
+		mock_mbox_sent(mssg);
+	return 0;
+}
+
+void mbox_free_channel(struct mbox_chan *chan)
+{
+	chan->cl = NULL;
+}
+
+/* Card, devices and controls */
+
+int snd_card_new(struct device *parent, int idx, const char *xid,
+		 struct module *module, int extra_size, struct snd_card **card_ret)
+{
+	struct snd_card *card = calloc(1, sizeof(*card));
+
+	if (!card)
+		return -ENOMEM;
+	card->dev = parent;
+	*card_ret = card;
+	return 0;
+}
+
+int snd_card_register(struct snd_card *card)
+{
+	return 0;
+}
+
+int snd_card_free(struct snd_card *card)
+{
+	free(card);
+	return 0;
+}
+
+int snd_device_new(struct snd_card *card, int type, void *device_data,
+		   const struct snd_device_ops *ops)
+{
+	return 0;
+}
+
+void snd_device_free(struct snd_card *card, void *device_data)
+{
+}
+
+int snd_pcm_new(struct snd_card *card, const char *id, int device,
+		int playback_count, int capture_count, struct snd_pcm **rpcm)
+{
+	struct snd_pcm *pcm = calloc(1, sizeof(*pcm));
+
+	if (!pcm)
+		return -ENOMEM;
+	pcm->card = card;
+	pcm->substream.pcm = pcm;
+	pcm->substream.stream = SNDRV_PCM_STREAM_PLAYBACK;
+	mock_pcm = pcm;
+	*rpcm = pcm;
+	return 0;
+}
+
+void snd_pcm_set_ops(struct snd_pcm *pcm, int direction, const struct snd_pcm_ops *ops)
+{
+	pcm->ops = ops;
+}
+
+void snd_pcm_set_managed_buffer_all(struct snd_pcm *pcm, int type, struct device *data,
+				    size_t size, size_t max)
+{
+	pcm->buffer_bytes = max;
+}
+
+int snd_pcm_hw_constraint_step(struct snd_pcm_runtime *runtime, unsigned int cond,
+			       int var, unsigned long step)
+{
+	return 0;
+}
+
+int snd_pcm_lib_ioctl(struct snd_pcm_substream *substream, unsigned int cmd, void *arg)
+{
+	return 0;
+}
+
+void snd_pcm_gettime(struct snd_pcm_runtime *runtime, struct timespec64 *tv)
+{
+	tv->tv_sec = 0;
+	tv->tv_nsec = 0;
+}
+
+struct snd_kcontrol *snd_ctl_new1(const struct snd_kcontrol_new *kcontrolnew, void *private_data)
+{
+	struct snd_kcontrol *kcontrol = calloc(1, sizeof(*kcontrol));
+
+	if (kcontrol) {
+		kcontrol->private_value = kcontrolnew->private_value;
+		kcontrol->private_data = private_data;
+	}
+	return kcontrol;
+}
+
+int snd_ctl_add(struct snd_card *card, struct snd_kcontrol *kcontrol)
+{
+	if (!kcontrol)
+		return -ENOMEM;
+	free(kcontrol);
+	return 0;
+}
+
+int snd_ctl_boolean_mono_info(struct snd_kcontrol *kcontrol, struct snd_ctl_elem_info *uinfo)
+{
+	uinfo->type = SNDRV_CTL_ELEM_TYPE_INTEGER;
+	uinfo->count = 1;
+	uinfo->value.integer.min = 0;
+	uinfo->value.integer.max = 1;
+	return 0;
+}
+
+int snd_card_ro_proc_new(struct snd_card *card, const char *name, void *private_data,
+			 void (*read)(struct snd_info_entry *, struct snd_info_buffer *))
+{
+	return 0;
+}
+
+int snd_iprintf(struct snd_info_buffer *buffer, const char *fmt, ...)
+{
+	return 0;
+}
+
+/* PCM core */
+
+static snd_pcm_sframes_t playback_avail(struct snd_pcm_runtime *runtime)
+{
+	snd_pcm_sframes_t avail = runtime->status->hw_ptr + runtime->buffer_size -
+				  runtime->control->appl_ptr;
+
+	if (avail < 0)
+		avail += runtime->boundary;
+	else if ((snd_pcm_uframes_t)avail >= runtime->boundary)
+		avail -= runtime->boundary;
+	return avail;
+}
+
+static bool pcm_running(struct snd_pcm_runtime *runtime)
+{
+	return runtime->status->state == SNDRV_PCM_STATE_RUNNING ||
+	       runtime->status->state == SNDRV_PCM_STATE_DRAINING;
+}
+
+static void pcm_stop(struct snd_pcm_substream *substream, snd_pcm_state_t state)
+{
+	if (pcm_running(substream->runtime))
+		substream->ops->trigger(substream, SNDRV_PCM_TRIGGER_STOP);
+	substream->runtime->status->state = state;
+}
+
+int mock_pcm_open(struct snd_pcm *pcm, struct snd_pcm_substream **substream_ret)
+{
+	struct snd_pcm_substream *substream = &pcm->substream;
+	struct snd_pcm_runtime *runtime;
+
+	runtime = calloc(1, sizeof(*runtime));
+	if (!runtime)
+		return -ENOMEM;
+	runtime->status = calloc(1, sizeof(*runtime->status));
+	runtime->control = calloc(1, sizeof(*runtime->control));
+	runtime->dma_area = calloc(1, pcm->buffer_bytes);
+	if (!runtime->status || !runtime->control || !runtime->dma_area)
+		return -ENOMEM;
+
+	substream->runtime = runtime;
+	substream->ops = pcm->ops;
+	substream->private_data = pcm->private_data;
+	runtime->status->state = SNDRV_PCM_STATE_OPEN;
+	*substream_ret = substream;
+	return substream->ops->open(substream);
+}
+
+int mock_pcm_hw_params(struct snd_pcm_substream *substream, unsigned int rate,
+		       unsigned int channels, snd_pcm_format_t format,
+		       snd_pcm_uframes_t period_size, unsigned int periods)
+{
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	struct snd_pcm_hw_params params = { rate, channels, format };
+	int ret;
+
+	if (pcm_running(runtime))
+		return -EBADFD;
+
+	runtime->rate = rate;
+	runtime->channels = channels;
+	runtime->format = format;
+	runtime->frame_bits = channels * (format == SNDRV_PCM_FORMAT_S16_LE ? 16 : 8);
+	runtime->period_size = period_size;
+	runtime->buffer_size = period_size * periods;
+	if (frames_to_bytes(runtime, runtime->buffer_size) > substream->pcm->buffer_bytes)
+		return -EINVAL;
+	// As snd_pcm_hw_params(): the largest buffer multiple of a power of two
+	runtime->boundary = runtime->buffer_size;
+	while (runtime->boundary * 2 <= LONG_MAX - runtime->buffer_size)
+		runtime->boundary *= 2;
+
+	ret = substream->ops->hw_params(substream, &params);
+	if (ret)
+		return ret;
+	runtime->status->state = SNDRV_PCM_STATE_SETUP;
+	return 0;
+}
+
+/* snd_pcm_prepare(): the driver first, then snd_pcm_do_reset() and post_prepare */
+int mock_pcm_prepare(struct snd_pcm_substream *substream)
+{
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	int ret;
+
+	if (runtime->status->state == SNDRV_PCM_STATE_OPEN)
+		return -EBADFD;
+	if (pcm_running(runtime))
+		return -EBUSY;
+
+	ret = substream->ops->prepare(substream);
+	if (ret)
+		return ret;
+	runtime->status->hw_ptr = 0;
+	runtime->hw_ptr_base = 0;
+	runtime->control->appl_ptr = runtime->status->hw_ptr;
+	runtime->status->state = SNDRV_PCM_STATE_PREPARED;
+	return 0;
+}
+
+int mock_pcm_start(struct snd_pcm_substream *substream)
+{
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	int ret;
+
+	if (runtime->status->state != SNDRV_PCM_STATE_PREPARED)
+		return -EBADFD;
+
+	ret = substream->ops->trigger(substream, SNDRV_PCM_TRIGGER_START);
+	if (ret)
+		return ret;
+	runtime->status->state = SNDRV_PCM_STATE_RUNNING;
+	return 0;
+}
+
+/* Only starts the drain, it ends in snd_pcm_period_elapsed() */
+int mock_pcm_drain(struct snd_pcm_substream *substream)
+{
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	int ret;
+
+	if (runtime->status->state == SNDRV_PCM_STATE_PREPARED) {
+		ret = mock_pcm_start(substream);
+		if (ret)
+			return ret;
+	}
+	if (runtime->status->state != SNDRV_PCM_STATE_RUNNING)
+		return -EBADFD;
+	runtime->status->state = SNDRV_PCM_STATE_DRAINING;
+	return 0;
+}
+
+int mock_pcm_drop(struct snd_pcm_substream *substream)
+{
+	if (substream->runtime->status->state == SNDRV_PCM_STATE_OPEN)
+		return -EBADFD;
+	pcm_stop(substream, SNDRV_PCM_STATE_SETUP);
+	return 0;
+}
+
+/* Non blocking write, returns the frames that fit */
+snd_pcm_uframes_t mock_pcm_write(struct snd_pcm_substream *substream, const void *buf,
+				 snd_pcm_uframes_t frames)
+{
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	snd_pcm_uframes_t n, pos, done = 0;
+	snd_pcm_state_t state = runtime->status->state;
+
+	if (state != SNDRV_PCM_STATE_PREPARED && state != SNDRV_PCM_STATE_RUNNING)
+		return 0;
+
+	frames = min(frames, (snd_pcm_uframes_t)playback_avail(runtime));
+	while (done < frames) {
+		pos = runtime->control->appl_ptr % runtime->buffer_size;
+		n = min(frames - done, runtime->buffer_size - pos);
+		memcpy(runtime->dma_area + frames_to_bytes(runtime, pos),
+		       (const u8 *)buf + frames_to_bytes(runtime, done),
+		       frames_to_bytes(runtime, n));
+		runtime->control->appl_ptr += n;
+		if (runtime->control->appl_ptr >= runtime->boundary)
+			runtime->control->appl_ptr -= runtime->boundary;
+		done += n;
+	}
+	return done;
+}
+
+/* snd_pcm_update_hw_ptr0() and snd_pcm_update_state() */
+void snd_pcm_period_elapsed(struct snd_pcm_substream *substream)
+{
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	snd_pcm_uframes_t pos, old = runtime->status->hw_ptr;
+	snd_pcm_uframes_t hw_ptr;
+
+	if (!pcm_running(runtime))
+		return;
+
+	pos = substream->ops->pointer(substream);
+	if (pos >= runtime->buffer_size) {
+		fprintf(stderr, "pointer %lu past the buffer\n", pos);
+		abort();
+	}
+	hw_ptr = runtime->hw_ptr_base + pos;
+	if (hw_ptr < old) {
+		runtime->hw_ptr_base += runtime->buffer_size;
+		if (runtime->hw_ptr_base >= runtime->boundary)
+			runtime->hw_ptr_base = 0;
+		hw_ptr = runtime->hw_ptr_base + pos;
+	}
+	runtime->status->hw_ptr = hw_ptr;
+
+	if (playback_avail(runtime) < (snd_pcm_sframes_t)runtime->buffer_size)
+		return;
+	if (runtime->status->state == SNDRV_PCM_STATE_DRAINING)
+		pcm_stop(substream, SNDRV_PCM_STATE_SETUP);
+	else
+		pcm_stop(substream, SNDRV_PCM_STATE_XRUN);
+}
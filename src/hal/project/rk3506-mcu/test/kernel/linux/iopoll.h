@@ -0,0 +1,9 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Mock kernel API, see kernel.h */
+
+#ifndef __MOCK_LINUX_IOPOLL_H
+#define __MOCK_LINUX_IOPOLL_H
+
+#include <linux/kernel.h>
+
+#endif /* __MOCK_LINUX_IOPOLL_H */
@@ -0,0 +1,269 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Mock of the kernel API for host builds of sound/pwm/picocalc-softpwm.c.
+ *
+ * Only what the driver uses, with the same names and signatures. The
+ * other linux/ headers include this one. Locks are flags that catch
+ * recursion, timers never fire, the mailbox hands every message to
+ * mock_mbox_sent and the ALSA core is modelled in kernel_mock.c.
+ */
+
+#ifndef __MOCK_LINUX_KERNEL_H
+#define __MOCK_LINUX_KERNEL_H
+
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <asm/barrier.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+typedef uint16_t __le16;
+
+#define EPROBE_DEFER	517
+
+#define USEC_PER_SEC	1000000L
+#define NSEC_PER_SEC	1000000000L
+
+#define ARRAY_SIZE(a)	(sizeof(a) / sizeof((a)[0]))
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+#define READ_ONCE(x)		(*(volatile __typeof__(x) *)&(x))
+#define WRITE_ONCE(x, v)	do { *(volatile __typeof__(x) *)&(x) = (v); } while (0)
+
+#define min(a, b)	({ __typeof__(a) _a = (a); __typeof__(b) _b = (b); _a < _b ? _a : _b; })
+#define max(a, b)	({ __typeof__(a) _a = (a); __typeof__(b) _b = (b); _a > _b ? _a : _b; })
+#define min3(a, b, c)	min((__typeof__(a))min(a, b), c)
+#define clamp(v, lo, hi)	min(max(v, lo), hi)
+
+#define __round_mask(x, y)	((__typeof__(x))((y) - 1))
+#define round_up(x, y)		((((x) - 1) | __round_mask(x, y)) + 1)
+#define round_down(x, y)	((x) & ~__round_mask(x, y))
+
+#define le16_to_cpu(x)	((u16)(x))
+
+static inline u64 div_u64(u64 dividend, u32 divisor)
+{
+	return dividend / divisor;
+}
+
+static inline size_t mock_strlcpy(char *dst, const char *src, size_t size)
+{
+	size_t len = strlen(src);
+
+	if (size) {
+		size_t n = len < size - 1 ? len : size - 1;
+
+		memcpy(dst, src, n);
+		dst[n] = 0;
+	}
+	return len;
+}
+#define strlcpy mock_strlcpy
+
+/* Errors in pointers */
+#define MAX_ERRNO	4095
+
+static inline void *ERR_PTR(long error)
+{
+	return (void *)error;
+}
+
+static inline long PTR_ERR(const void *ptr)
+{
+	return (long)ptr;
+}
+
+static inline bool IS_ERR(const void *ptr)
+{
+	return (unsigned long)ptr >= (unsigned long)-MAX_ERRNO;
+}
+
+/* Locks, taking one twice is a bug the mock reports */
+typedef struct {
+	int locked;
+} spinlock_t;
+
+void mock_spin_lock(spinlock_t *lock);
+void mock_spin_unlock(spinlock_t *lock);
+
+#define spin_lock_init(l)	((l)->locked = 0)
+#define spin_lock_irqsave(l, flags)	do { (flags) = 0; mock_spin_lock(l); } while (0)
+#define spin_unlock_irqrestore(l, flags)	do { (void)(flags); mock_spin_unlock(l); } while (0)
+
+/* Devices and modules */
+struct device_node {
+	int unused;
+};
+
+struct device {
+	struct device_node *of_node;
+	void *driver_data;
+};
+
+struct platform_device {
+	struct device dev;
+};
+
+struct of_device_id {
+	char compatible[128];
+};
+
+#define PROBE_PREFER_ASYNCHRONOUS	1
+
+struct device_driver {
+	const char *name;
+	const struct of_device_id *of_match_table;
+	int probe_type;
+};
+
+struct platform_driver {
+	struct device_driver driver;
+	int (*probe)(struct platform_device *pdev);
+	int (*remove)(struct platform_device *pdev);
+};
+
+static inline void platform_set_drvdata(struct platform_device *pdev, void *data)
+{
+	pdev->dev.driver_data = data;
+}
+
+static inline void *platform_get_drvdata(const struct platform_device *pdev)
+{
+	return pdev->dev.driver_data;
+}
+
+#define GFP_KERNEL	0
+#define devm_kzalloc(dev, size, gfp)	calloc(1, size)
+
+int mock_dev_printk(const struct device *dev, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+#define dev_err(dev, ...)		mock_dev_printk(dev, __VA_ARGS__)
+#define dev_info(dev, ...)		mock_dev_printk(dev, __VA_ARGS__)
+#define dev_warn_ratelimited(dev, ...)	mock_dev_printk(dev, __VA_ARGS__)
+#define dev_err_probe(dev, err, ...)	(mock_dev_printk(dev, __VA_ARGS__), (err))
+
+struct module;
+#define THIS_MODULE	((struct module *)NULL)
+
+/* The probe entry point, for the tests */
+extern struct platform_driver *mock_platform_driver;
+
+#define module_platform_driver(drv)	struct platform_driver *mock_platform_driver = &(drv)
+#define module_param(name, type, perm)	extern int mock_module_info
+#define MODULE_PARM_DESC(name, desc)	extern int mock_module_info
+#define MODULE_DEVICE_TABLE(type, name)	extern int mock_module_info
+#define MODULE_AUTHOR(s)		extern int mock_module_info
+#define MODULE_DESCRIPTION(s)		extern int mock_module_info
+#define MODULE_LICENSE(s)		extern int mock_module_info
+
+/* Time */
+typedef s64 ktime_t;
+
+struct timespec64 {
+	s64 tv_sec;
+	long tv_nsec;
+};
+
+static inline ktime_t ns_to_ktime(u64 ns)
+{
+	return ns;
+}
+
+static inline struct timespec64 ns_to_timespec64(s64 ns)
+{
+	struct timespec64 ts = { ns / NSEC_PER_SEC, ns % NSEC_PER_SEC };
+
+	return ts;
+}
+
+/* hrtimers are never started by the tests, they have a doorbell */
+#ifndef CLOCK_MONOTONIC
+#define CLOCK_MONOTONIC		1
+#endif
+
+enum hrtimer_mode {
+	HRTIMER_MODE_REL,
+};
+
+enum hrtimer_restart {
+	HRTIMER_NORESTART,
+	HRTIMER_RESTART,
+};
+
+struct hrtimer {
+	enum hrtimer_restart (*function)(struct hrtimer *timer);
+};
+
+static inline void hrtimer_init(struct hrtimer *timer, int clock, enum hrtimer_mode mode)
+{
+	timer->function = NULL;
+}
+
+static inline void hrtimer_start(struct hrtimer *timer, ktime_t tim, enum hrtimer_mode mode)
+{
+}
+
+static inline int hrtimer_try_to_cancel(struct hrtimer *timer)
+{
+	return 0;
+}
+
+static inline int hrtimer_cancel(struct hrtimer *timer)
+{
+	return 0;
+}
+
+static inline u64 hrtimer_forward_now(struct hrtimer *timer, ktime_t interval)
+{
+	return 1;
+}
+
+/*
+ * Polling, one read per sleep_us up to timeout_us. Nothing runs while
+ * the driver polls, so whatever it waits for has to be there already.
+ */
+#define read_poll_timeout(op, val, cond, sleep_us, timeout_us, sleep_before_read, args...) \
+({ \
+	unsigned long __n = (timeout_us) / (sleep_us) + 1; \
+	int __ret = -ETIMEDOUT; \
+	while (__n--) { \
+		(val) = op(args); \
+		if (cond) { \
+			__ret = 0; \
+			break; \
+		} \
+	} \
+	__ret; \
+})
+
+/* Mailbox, one channel whose messages go to mock_mbox_sent */
+struct mbox_client {
+	struct device *dev;
+	void (*rx_callback)(struct mbox_client *cl, void *mssg);
+};
+
+struct mbox_chan {
+	struct mbox_client *cl;
+};
+
+extern struct mbox_chan mock_mbox_chan;
+extern void (*mock_mbox_sent)(void *mssg);
+
+struct mbox_chan *mbox_request_channel_byname(struct mbox_client *cl, const char *name);
+int mbox_send_message(struct mbox_chan *chan, void *mssg);
+void mbox_free_channel(struct mbox_chan *chan);
+
+#endif /* __MOCK_LINUX_KERNEL_H */
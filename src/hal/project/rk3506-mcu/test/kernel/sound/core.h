@@ -0,0 +1,9 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Mock ALSA API, see pcm.h */
+
+#ifndef __MOCK_SOUND_CORE_H
+#define __MOCK_SOUND_CORE_H
+
+#include <sound/pcm.h>
+
+#endif /* __MOCK_SOUND_CORE_H */
@@ -0,0 +1,289 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Mock of the ALSA driver API for host builds of picocalc-softpwm.c.
+ *
+ * One card with one playback substream. kernel_mock.c models the parts
+ * of the PCM core a playback driver sees: the prepare, start, drain and
+ * stop sequences, the pointer update on snd_pcm_period_elapsed() with
+ * its drain and xrun checks, and an application writing into the buffer.
+ * The other sound/ headers include this one.
+ */
+
+#ifndef __MOCK_SOUND_PCM_H
+#define __MOCK_SOUND_PCM_H
+
+#include <linux/kernel.h>
+
+typedef unsigned long snd_pcm_uframes_t;
+typedef long snd_pcm_sframes_t;
+typedef int snd_pcm_format_t;
+typedef int snd_pcm_state_t;
+
+#define SNDRV_PCM_FORMAT_U8		1
+#define SNDRV_PCM_FORMAT_S16_LE		2
+#define SNDRV_PCM_FMTBIT_U8		(1ULL << SNDRV_PCM_FORMAT_U8)
+#define SNDRV_PCM_FMTBIT_S16_LE		(1ULL << SNDRV_PCM_FORMAT_S16_LE)
+
+#define SNDRV_PCM_RATE_8000		(1 << 1)
+#define SNDRV_PCM_RATE_11025		(1 << 2)
+#define SNDRV_PCM_RATE_16000		(1 << 3)
+#define SNDRV_PCM_RATE_22050		(1 << 4)
+#define SNDRV_PCM_RATE_32000		(1 << 5)
+#define SNDRV_PCM_RATE_44100		(1 << 6)
+#define SNDRV_PCM_RATE_48000		(1 << 7)
+
+#define SNDRV_PCM_INFO_MMAP		0x00000001
+#define SNDRV_PCM_INFO_MMAP_VALID	0x00000002
+#define SNDRV_PCM_INFO_INTERLEAVED	0x00000100
+#define SNDRV_PCM_INFO_HALF_DUPLEX	0x00100000
+#define SNDRV_PCM_INFO_NO_REWINDS	0x00001000
+#define SNDRV_PCM_INFO_HAS_LINK_ATIME	0x01000000
+
+#define SNDRV_PCM_STREAM_PLAYBACK	0
+
+#define SNDRV_PCM_STATE_OPEN		0
+#define SNDRV_PCM_STATE_SETUP		1
+#define SNDRV_PCM_STATE_PREPARED	2
+#define SNDRV_PCM_STATE_RUNNING		3
+#define SNDRV_PCM_STATE_XRUN		4
+#define SNDRV_PCM_STATE_DRAINING	5
+
+#define SNDRV_PCM_TRIGGER_STOP		0
+#define SNDRV_PCM_TRIGGER_START		1
+
+#define SNDRV_PCM_HW_PARAM_PERIOD_SIZE	9
+#define SNDRV_PCM_HW_PARAM_BUFFER_SIZE	13
+
+#define SNDRV_PCM_AUDIO_TSTAMP_TYPE_DEFAULT	1
+#define SNDRV_PCM_AUDIO_TSTAMP_TYPE_LINK	2
+
+#define SNDRV_DEFAULT_IDX1		(-1)
+#define SNDRV_DEFAULT_STR1		NULL
+#define SNDRV_DEV_LOWLEVEL		0
+#define SNDRV_DMA_TYPE_CONTINUOUS	1
+
+struct snd_pcm_hardware {
+	unsigned int info;
+	u64 formats;
+	unsigned int rates;
+	unsigned int rate_min;
+	unsigned int rate_max;
+	unsigned int channels_min;
+	unsigned int channels_max;
+	size_t buffer_bytes_max;
+	size_t period_bytes_min;
+	size_t period_bytes_max;
+	unsigned int periods_min;
+	unsigned int periods_max;
+};
+
+struct snd_pcm_mmap_status {
+	snd_pcm_state_t state;
+	snd_pcm_uframes_t hw_ptr;
+};
+
+struct snd_pcm_mmap_control {
+	snd_pcm_uframes_t appl_ptr;
+};
+
+struct snd_pcm_runtime {
+	struct snd_pcm_mmap_status *status;
+	struct snd_pcm_mmap_control *control;
+	struct snd_pcm_hardware hw;
+	snd_pcm_format_t format;
+	unsigned int rate;
+	unsigned int channels;
+	unsigned int frame_bits;
+	snd_pcm_uframes_t period_size;
+	snd_pcm_uframes_t buffer_size;
+	snd_pcm_uframes_t boundary;
+	snd_pcm_uframes_t hw_ptr_base;
+	snd_pcm_sframes_t delay;
+	unsigned char *dma_area;
+};
+
+struct snd_pcm_hw_params {
+	unsigned int rate;
+	unsigned int channels;
+	snd_pcm_format_t format;
+};
+
+static inline unsigned int params_rate(const struct snd_pcm_hw_params *p)
+{
+	return p->rate;
+}
+
+static inline unsigned int params_channels(const struct snd_pcm_hw_params *p)
+{
+	return p->channels;
+}
+
+static inline snd_pcm_format_t params_format(const struct snd_pcm_hw_params *p)
+{
+	return p->format;
+}
+
+static inline size_t frames_to_bytes(struct snd_pcm_runtime *runtime, snd_pcm_sframes_t size)
+{
+	return size * runtime->frame_bits / 8;
+}
+
+struct snd_pcm_audio_tstamp_config {
+	u32 type_requested:4;
+};
+
+struct snd_pcm_audio_tstamp_report {
+	u32 actual_type:4;
+	u32 accuracy_report:1;
+	u32 accuracy;
+};
+
+struct snd_pcm_substream;
+
+struct snd_pcm_ops {
+	int (*open)(struct snd_pcm_substream *substream);
+	int (*close)(struct snd_pcm_substream *substream);
+	int (*ioctl)(struct snd_pcm_substream *substream, unsigned int cmd, void *arg);
+	int (*hw_params)(struct snd_pcm_substream *substream, struct snd_pcm_hw_params *params);
+	int (*hw_free)(struct snd_pcm_substream *substream);
+	int (*prepare)(struct snd_pcm_substream *substream);
+	int (*trigger)(struct snd_pcm_substream *substream, int cmd);
+	snd_pcm_uframes_t (*pointer)(struct snd_pcm_substream *substream);
+	int (*get_time_info)(struct snd_pcm_substream *substream,
+			     struct timespec64 *system_ts, struct timespec64 *audio_ts,
+			     struct snd_pcm_audio_tstamp_config *audio_tstamp_config,
+			     struct snd_pcm_audio_tstamp_report *audio_tstamp_report);
+};
+
+struct snd_pcm_substream {
+	struct snd_pcm *pcm;
+	int stream;
+	void *private_data;
+	const struct snd_pcm_ops *ops;
+	struct snd_pcm_runtime *runtime;
+};
+
+struct snd_card {
+	char driver[16];
+	char shortname[32];
+	char longname[80];
+	char mixername[80];
+	struct device *dev;
+};
+
+struct snd_pcm {
+	struct snd_card *card;
+	void *private_data;
+	unsigned int info_flags;
+	const struct snd_pcm_ops *ops;
+	size_t buffer_bytes;
+	struct snd_pcm_substream substream;
+};
+
+#define snd_pcm_substream_chip(substream)	((substream)->private_data)
+#define snd_pcm_chip(pcm)			((pcm)->private_data)
+
+struct snd_device;
+
+struct snd_device_ops {
+	int (*dev_free)(struct snd_device *dev);
+};
+
+int snd_card_new(struct device *parent, int idx, const char *xid,
+		 struct module *module, int extra_size, struct snd_card **card_ret);
+int snd_card_register(struct snd_card *card);
+int snd_card_free(struct snd_card *card);
+int snd_device_new(struct snd_card *card, int type, void *device_data,
+		   const struct snd_device_ops *ops);
+void snd_device_free(struct snd_card *card, void *device_data);
+int snd_pcm_new(struct snd_card *card, const char *id, int device,
+		int playback_count, int capture_count, struct snd_pcm **rpcm);
+void snd_pcm_set_ops(struct snd_pcm *pcm, int direction, const struct snd_pcm_ops *ops);
+void snd_pcm_set_managed_buffer_all(struct snd_pcm *pcm, int type, struct device *data,
+				    size_t size, size_t max);
+int snd_pcm_hw_constraint_step(struct snd_pcm_runtime *runtime, unsigned int cond,
+			       int var, unsigned long step);
+int snd_pcm_lib_ioctl(struct snd_pcm_substream *substream, unsigned int cmd, void *arg);
+void snd_pcm_gettime(struct snd_pcm_runtime *runtime, struct timespec64 *tv);
+void snd_pcm_period_elapsed(struct snd_pcm_substream *substream);
+
+/* Controls */
+#define SNDRV_CTL_ELEM_TYPE_INTEGER	2
+#define SNDRV_CTL_ELEM_IFACE_MIXER	2
+#define SNDRV_CTL_ELEM_ACCESS_READWRITE	3
+#define SNDRV_CTL_ELEM_ACCESS_TLV_READ	(1 << 4)
+
+#define TLV_DB_GAIN_MUTE		-9999999
+#define DECLARE_TLV_DB_LINEAR(name, min_dB, max_dB) \
+	unsigned int name[] = { 0, 2 * sizeof(unsigned int), (min_dB), (max_dB) }
+
+struct snd_ctl_elem_info {
+	int type;
+	unsigned int count;
+	union {
+		struct {
+			long min;
+			long max;
+		} integer;
+	} value;
+};
+
+struct snd_ctl_elem_value {
+	union {
+		struct {
+			long value[128];
+		} integer;
+	} value;
+};
+
+struct snd_kcontrol {
+	unsigned long private_value;
+	void *private_data;
+};
+
+struct snd_kcontrol_new {
+	int iface;
+	const char *name;
+	unsigned int access;
+	int (*info)(struct snd_kcontrol *kcontrol, struct snd_ctl_elem_info *uinfo);
+	int (*get)(struct snd_kcontrol *kcontrol, struct snd_ctl_elem_value *ucontrol);
+	int (*put)(struct snd_kcontrol *kcontrol, struct snd_ctl_elem_value *ucontrol);
+	union {
+		const unsigned int *p;
+	} tlv;
+	unsigned long private_value;
+};
+
+#define snd_kcontrol_chip(kcontrol)	((kcontrol)->private_data)
+
+struct snd_kcontrol *snd_ctl_new1(const struct snd_kcontrol_new *kcontrolnew, void *private_data);
+int snd_ctl_add(struct snd_card *card, struct snd_kcontrol *kcontrol);
+int snd_ctl_boolean_mono_info(struct snd_kcontrol *kcontrol, struct snd_ctl_elem_info *uinfo);
+
+/* Proc files */
+struct snd_info_entry {
+	void *private_data;
+};
+
+struct snd_info_buffer;
+
+int snd_card_ro_proc_new(struct snd_card *card, const char *name, void *private_data,
+			 void (*read)(struct snd_info_entry *, struct snd_info_buffer *));
+int snd_iprintf(struct snd_info_buffer *buffer, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+/* The PCM core as the application drives it, kernel_mock.c */
+extern struct snd_pcm *mock_pcm;	/* the last snd_pcm_new() */
+
+int mock_pcm_open(struct snd_pcm *pcm, struct snd_pcm_substream **substream);
+int mock_pcm_hw_params(struct snd_pcm_substream *substream, unsigned int rate,
+		       unsigned int channels, snd_pcm_format_t format,
+		       snd_pcm_uframes_t period_size, unsigned int periods);
+int mock_pcm_prepare(struct snd_pcm_substream *substream);
+int mock_pcm_start(struct snd_pcm_substream *substream);
+int mock_pcm_drain(struct snd_pcm_substream *substream);
+int mock_pcm_drop(struct snd_pcm_substream *substream);
+snd_pcm_uframes_t mock_pcm_write(struct snd_pcm_substream *substream, const void *buf,
+				 snd_pcm_uframes_t frames);
+
+#endif /* __MOCK_SOUND_PCM_H */
@@ -0,0 +1,519 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Host tests of the MCU firmware, built against the mock HAL in hal/.
+ *
+ * main.c is included whole, with its main() renamed, so the tests reach
+ * its static state and run its interrupt handlers one at a time:
+ *
+ * softpwm: Linux side duties go through the sample ring and the sample
+ * timer is fired until they are played. Every carrier cycle must have
+ * the period and the high times of its frame, on the GPIO pins of the
+ * edge engine or in the duty registers of the PWM engine (at several
+ * CLK_PWM1 rates and through the HAL fallback). The position, underrun
+ * count and period doorbells are checked too. The edge engine also runs
+ * with interrupt latency and slow HAL calls, where its cycles must still
+ * keep the carrier rate. The boot probe must pick the PWM engine only
+ * when PWM1 reaches the pins.
+ *
+ * mculog: _write() pushes through log rings of odd sizes, so every wrap
+ * offset is hit, and must return exactly what fit.
+ *
+ * usage: mcu_test [-b]     -b times the sample timer ISR as well
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define main mcu_main
+#include "main.c"
+#undef main
+
+/* Linker symbols of the shared regions, only main() uses them */
+uint32_t __linux_share_memory_start__[1], __linux_share_memory_end__[1];
+uint32_t __linux_rpmsg_start__[1], __linux_rpmsg_end__[1];
+
+#define SOFTPWM_FRAMES	5000
+#define BENCH_SAMPLES	(1u << 20)
+
+static uint8_t log_mem[SPSC_RING_HDR_SIZE + 4096] __attribute__((aligned(SPSC_RING_CACHELINE)));
+static uint8_t shm[SOFTPWM_SHM_HDR_SIZE + 8192] __attribute__((aligned(SPSC_RING_CACHELINE)));
+static struct spsc_ring linux_ring;
+static softpwm_sample_t duties[SOFTPWM_FRAMES * 2];
+static uint32_t queued;
+
+/* xorshift32 */
+static uint32_t rnd(uint32_t *s)
+{
+	uint32_t x = *s;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *s = x;
+}
+
+/* The firmware logs through HAL_DBG(), give it a ring nobody reads */
+static void log_setup(void)
+{
+	spsc_ring_init(&logring, log_mem, sizeof(log_mem));
+}
+
+/* What the Linux driver does before setting state to RUN */
+static void softpwm_setup(uint32_t chans, uint32_t period, uint32_t cps, uint32_t ring_bytes)
+{
+	memset(shm, 0, sizeof(shm));
+	softpwm = (struct softpwm_shm *)shm;
+	spsc_ring_init(&linux_ring, &softpwm->ring, SPSC_RING_HDR_SIZE + ring_bytes);
+	softpwm->period_frames = 64;
+	softpwm->pwm_period = period;
+	softpwm->carrier_per_sample = cps;
+	softpwm->channels = chans;
+	softpwm->encoding = SOFTPWM_ENCODING_DUTY16;
+	softpwm->state = SOFTPWM_STATE_RUN;
+
+	memset(&mock_mbox0, 0, sizeof(mock_mbox0));
+	memset(mock_gpio, 0, sizeof(mock_gpio));
+	cycle_init();
+	frames = 0;
+	underruns = 0;
+	queued = 0;
+}
+
+/*
+ * Random duties from @min to period - @min, with the extremes and equal
+ * pairs mixed in. The two duties of a frame are equal or @min apart.
+ */
+static void duties_fill(uint32_t period, uint32_t min, uint32_t seed)
+{
+	uint32_t i;
+
+	for (i = 0; i < SOFTPWM_FRAMES * 2; i++) {
+		switch (rnd(&seed) % 8) {
+		case 0:
+			duties[i] = min;
+			break;
+		case 1:
+			duties[i] = period - min;
+			break;
+		case 2:
+			duties[i] = i & 1 ? duties[i - 1] : period / 2;
+			break;
+		default:
+			duties[i] = min + rnd(&seed) % (period - 2 * min + 1);
+			break;
+		}
+		if (i & 1 && (uint32_t)abs(duties[i] - duties[i - 1]) < min)
+			duties[i] = duties[i - 1];
+	}
+}
+
+/* Linux side: queue whole frames while they fit */
+static void softpwm_feed(uint32_t chans, uint32_t upto)
+{
+	uint32_t bytes = chans * sizeof(softpwm_sample_t);
+	softpwm_sample_t frame[2];
+
+	while (queued < upto && spsc_ring_space(&linux_ring) >= bytes) {
+		frame[0] = duties[queued * 2];
+		frame[1] = duties[queued * 2 + 1];
+		spsc_ring_write(&linux_ring, frame, bytes);
+		queued++;
+	}
+}
+
+static void duty_expect(uint32_t chans, uint32_t n, uint32_t *left, uint32_t *right)
+{
+	*left = duties[n * 2];
+	*right = chans == 2 ? duties[n * 2 + 1] : *left;
+}
+
+/* The position, underruns and doorbells after @ticks sample ticks, @empty of them dry */
+static int softpwm_check_counts(const char *name, uint32_t ticks, uint32_t empty)
+{
+	if (softpwm->frames != ticks || softpwm->underruns != empty ||
+	    mock_mbox0.sent[DOORBELL_CHAN] != ticks / softpwm->period_frames) {
+		printf("FAIL %s: frames %u underruns %u doorbells %u, want %u %u %u\n", name,
+		       softpwm->frames, softpwm->underruns, mock_mbox0.sent[DOORBELL_CHAN],
+		       ticks, empty, ticks / softpwm->period_frames);
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * Handlers run @latency ticks after their timer expired and every HAL
+ * call takes EDGE_CALL_TICKS, which must not add up over the carrier
+ * cycles. Edges at least EDGE_SLACK past the latency are met exactly.
+ */
+#define EDGE_CALL_TICKS	3
+#define EDGE_SLACK	(16 * EDGE_CALL_TICKS)
+
+/*
+ * Edge engine: after each interrupt the pins hold their level until the
+ * timer expires again. Both pins rise together at the start of a carrier
+ * cycle, which is where the high times are checked. Duties down to @min
+ * ticks from either end are played; those the handler cannot meet move
+ * their edges but the carrier must keep its rate.
+ */
+static int edge_test_one(uint32_t chans, uint32_t period, uint32_t cps, uint32_t ring_bytes,
+			 uint32_t latency, uint32_t min)
+{
+	uint32_t cycle = 0, hi_left = 0, hi_right = 0, len = 0, level, prev = 0, dt;
+	uint32_t want_left, want_right, isrs = 0, errors = 0;
+	bool exact = !latency || min >= latency + EDGE_SLACK;
+	uint64_t due, first = 0, last = 0;
+	char name[80];
+
+	snprintf(name, sizeof(name), "edge %uch period %u x%u ring %u latency %u min %u", chans,
+		 period, cps, ring_bytes, latency, min);
+	mock_call_ticks = latency ? EDGE_CALL_TICKS : 0;
+	pwm_engine = false;
+	softpwm_setup(chans, period, cps, ring_bytes);
+	duties_fill(period, min, period * 31 + cps);
+	softpwm_feed(chans, SOFTPWM_FRAMES);
+	softpwm_start();
+
+	/* One cycle into the underrun that follows the last frame closes it */
+	while (cycle <= SOFTPWM_FRAMES * cps) {
+		due = mock_timer_expiry(timer);
+		mock_ticks = due + latency;
+		edge_timer_isr(timer_irq, NULL);
+		softpwm_feed(chans, SOFTPWM_FRAMES);
+		if (++isrs > (SOFTPWM_FRAMES + 1) * cps * 3) {
+			printf("FAIL %s: no carrier cycle after %u interrupts\n", name, isrs);
+			return 1;
+		}
+
+		level = GPIO4->level & PWM_PINS;
+		dt = (uint32_t)(mock_timer_expiry(timer) - due);
+		if (!prev && level == PWM_PINS) {
+			if (len) {
+				duty_expect(chans, (cycle - 1) / cps, &want_left, &want_right);
+				if (exact && (len != period || hi_left != want_left ||
+					      hi_right != want_right)) {
+					if (!errors++)
+						printf("FAIL %s: cycle %u is %u/%u of %u, want %u/%u of %u\n",
+						       name, cycle - 1, hi_left, hi_right, len,
+						       want_left, want_right, period);
+				}
+			} else {
+				first = due;
+			}
+			last = due;
+			cycle++;
+			hi_left = hi_right = len = 0;
+		}
+		if (level & PWM_LEFT_PIN)
+			hi_left += dt;
+		if (level & PWM_RIGHT_PIN)
+			hi_right += dt;
+		len += dt;
+		prev = level;
+	}
+	mock_call_ticks = 0;
+	if (errors)
+		return 1;
+	/* Late edges only move the ones after them within the cycle */
+	if (last - first > (uint64_t)(cycle - 1) * period + period / 2 ||
+	    last - first < (uint64_t)(cycle - 1) * period - period / 2) {
+		printf("FAIL %s: %u cycles in %llu ticks, want %llu\n", name, cycle - 1,
+		       (unsigned long long)(last - first), (unsigned long long)(cycle - 1) * period);
+		return 1;
+	}
+	if (softpwm_check_counts(name, SOFTPWM_FRAMES + 1, 1))
+		return 1;
+
+	/* Linux stops: the next sample tick idles the pins and the timer */
+	softpwm->state = SOFTPWM_STATE_STOP;
+	for (isrs = 0; enable && isrs < cps * 3 + 3; isrs++)
+		edge_timer_isr(timer_irq, NULL);
+	if (enable || timer->irq || (GPIO4->level & PWM_PINS) ||
+	    softpwm->mcu_state != SOFTPWM_STATE_STOP) {
+		printf("FAIL %s: still running after stop\n", name);
+		return 1;
+	}
+	return 0;
+}
+
+static int edge_test(void)
+{
+	int fail = 0;
+
+	/* 8 kHz from a 64 kHz carrier, 22.05 kHz at ~44 kHz, 1 cycle per sample */
+	fail |= edge_test_one(2, 375, 8, 4 * 37, 0, SOFTPWM_DUTY_MIN);
+	fail |= edge_test_one(2, 544, 2, 4 * 1000, 0, SOFTPWM_DUTY_MIN);
+	fail |= edge_test_one(1, 544, 2, 2 * 61, 0, SOFTPWM_DUTY_MIN);
+	fail |= edge_test_one(2, 3, 1, 4 * 5, 0, SOFTPWM_DUTY_MIN);
+	/* The same with the M0's interrupt latency, 1.7 us */
+	fail |= edge_test_one(2, 375, 8, 4 * 37, 40, 40 + EDGE_SLACK);
+	fail |= edge_test_one(1, 544, 2, 2 * 61, 40, 40 + EDGE_SLACK);
+	fail |= edge_test_one(2, 544, 2, 4 * 1000, 40, SOFTPWM_DUTY_MIN);
+
+	printf("softpwm edge engine: %s\n", fail ? "FAIL" : "ok");
+	return fail;
+}
+
+/* @count is @ticks at @hz rounded to nearest, give or take the Q16 scale */
+static int pwm_count_ok(uint32_t count, uint32_t ticks, uint32_t hz)
+{
+	double exact = (double)ticks * hz / SOFTPWM_TIMER_HZ;
+
+	return fabs(count - exact) <= 0.5 + exact / 65536;
+}
+
+/*
+ * PWM engine: one interrupt per sample loads the next duties, through
+ * the registers when the HAL's layout checked out and through
+ * HAL_PWM_SetConfig() otherwise.
+ */
+static int pwm_test_one(uint32_t chans, uint32_t period, uint32_t hz, bool layout_bad)
+{
+	uint32_t n, left, right, want_left, want_right, errors = 0;
+	char name[64];
+
+	snprintf(name, sizeof(name), "pwm %uch period %u at %u Hz%s", chans, period, hz,
+		 layout_bad ? " via HAL" : "");
+	memset(&mock_pwm1, 0, sizeof(mock_pwm1));
+	mock_pwm_layout_bad = layout_bad;
+	mock_clk_hz[CLK_PWM1] = hz;
+	pwm_engine = true;
+	pwm_clk_init();
+	softpwm_setup(chans, period, 1, 4 * 53);
+	duties_fill(period, SOFTPWM_DUTY_MIN, period * 17 + hz);
+	softpwm_feed(chans, SOFTPWM_FRAMES);
+	softpwm_start();
+
+	if (pwm_direct == layout_bad) {
+		printf("FAIL %s: direct register writes %s\n", name, pwm_direct ? "on" : "off");
+		return 1;
+	}
+	if (!pwm_count_ok(period_count, period, hz) ||
+	    mock_pwm1.ch[PWM_LEFT_CH][(layout_bad ? 0x20 : PWM_REG_PERIOD) / 4] != period_count) {
+		printf("FAIL %s: period %u counts, want ~%llu\n", name, period_count,
+		       (unsigned long long)period * hz / SOFTPWM_TIMER_HZ);
+		return 1;
+	}
+
+	for (n = 0; n < SOFTPWM_FRAMES; n++) {
+		pwm_timer_isr(timer_irq, NULL);
+		softpwm_feed(chans, SOFTPWM_FRAMES);
+		if (pwm_direct) {
+			left = *pwm_reg(PWM_LEFT_CH, PWM_REG_DUTY);
+			right = *pwm_reg(PWM_RIGHT_CH, PWM_REG_DUTY);
+		} else {
+			left = mock_pwm_config_duty[PWM_LEFT_CH];
+			right = mock_pwm_config_duty[PWM_RIGHT_CH];
+		}
+		duty_expect(chans, n, &want_left, &want_right);
+		/* The HAL must get back the count the ns were made from */
+		if (left != pwm_count(want_left) || right != pwm_count(want_right) ||
+		    !pwm_count_ok(left, want_left, hz) || !pwm_count_ok(right, want_right, hz) ||
+		    left >= period_count || right >= period_count) {
+			if (!errors++)
+				printf("FAIL %s: frame %u duty %u/%u counts, want %u/%u ticks\n",
+				       name, n, left, right, want_left, want_right);
+		}
+	}
+	if (errors)
+		return 1;
+	pwm_timer_isr(timer_irq, NULL);
+	if (softpwm_check_counts(name, SOFTPWM_FRAMES + 1, 1))
+		return 1;
+
+	softpwm->state = SOFTPWM_STATE_STOP;
+	pwm_timer_isr(timer_irq, NULL);
+	if (enable || timer->irq || (mock_pwm1.ch[PWM_LEFT_CH][0] & 1) ||
+	    (mock_pwm1.ch[PWM_RIGHT_CH][0] & 1) || softpwm->mcu_state != SOFTPWM_STATE_STOP) {
+		printf("FAIL %s: still running after stop\n", name);
+		return 1;
+	}
+	return 0;
+}
+
+static int pwm_test(void)
+{
+	static const uint32_t rates[] = { 24000000, 50000000, 100000000, 32768000 };
+	unsigned int i;
+	int fail = 0;
+
+	for (i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+		fail |= pwm_test_one(2, 544, rates[i], false);
+		fail |= pwm_test_one(1, 375, rates[i], false);
+		fail |= pwm_test_one(2, 544, rates[i], true);
+	}
+
+	printf("softpwm pwm engine: %s\n", fail ? "FAIL" : "ok");
+	return fail;
+}
+
+/*
+ * Engine choice: pwm_probe() must take the PWM engine only when PWM1
+ * reaches the pins, whatever the register layout, and leave the pins low
+ * and muxed for the engine it picked.
+ */
+static int probe_test(void)
+{
+	static const struct {
+		bool routed;
+		bool layout_bad;
+	} cases[] = { { true, false }, { true, true }, { false, false } };
+	unsigned int i;
+	bool got;
+	int fail = 0;
+
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		memset(mock_gpio, 0, sizeof(mock_gpio));
+		memset(&mock_pwm1, 0, sizeof(mock_pwm1));
+		mock_pwm_routed = cases[i].routed;
+		mock_pwm_layout_bad = cases[i].layout_bad;
+		mock_clk_hz[CLK_PWM1] = SOFTPWM_TIMER_HZ;
+		got = pwm_probe();
+		if (got != cases[i].routed ||
+		    GPIO4->func1 != (cases[i].routed ? PWM_PINS : 0) ||
+		    (mock_pwm1.ch[PWM_LEFT_CH][0] & 1) || (mock_pwm1.ch[PWM_RIGHT_CH][0] & 1) ||
+		    HAL_GPIO_GetPinLevel(GPIO4, PWM_LEFT_PIN) != GPIO_LOW ||
+		    HAL_GPIO_GetPinLevel(GPIO4, PWM_RIGHT_PIN) != GPIO_LOW) {
+			printf("FAIL probe %s%s: %s engine, FUNC1 pins %#x\n",
+			       cases[i].routed ? "routed" : "unrouted",
+			       cases[i].layout_bad ? " via HAL" : "", got ? "pwm" : "edge",
+			       GPIO4->func1);
+			fail = 1;
+		}
+	}
+	mock_pwm_routed = false;
+	mock_pwm_layout_bad = false;
+
+	printf("softpwm engine probe: %s\n", fail ? "FAIL" : "ok");
+	return fail;
+}
+
+/* Byte @i of the log stream */
+static uint8_t log_byte(uint32_t i)
+{
+	return (uint8_t)(i * 7 + (i >> 9));
+}
+
+static int mculog_test(void)
+{
+	/* data[] sizes, one byte less than that can be queued */
+	static const uint32_t sizes[] = { 2, 3, 61, 256, 4000 };
+	static uint8_t mem[SPSC_RING_HDR_SIZE + 4000] __attribute__((aligned(SPSC_RING_CACHELINE)));
+	uint32_t seed = 3, wrote, read, n, space, got, s, i;
+	struct spsc_ring reader;
+	char buf[300];
+	int fail = 0;
+
+	for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		spsc_ring_init(&logring, mem, SPSC_RING_HDR_SIZE + sizes[s]);
+		spsc_ring_attach(&reader, mem);
+		for (wrote = read = 0; read < 200000;) {
+			n = 1 + rnd(&seed) % (sizeof(buf) - 1);
+			for (i = 0; i < n; i++)
+				buf[i] = log_byte(wrote + i);
+			space = spsc_ring_space(&logring);
+			got = _write(1, buf, n);
+			if (got != (n < space ? n : space)) {
+				printf("FAIL log ring %u: wrote %u of %u with %u free\n", sizes[s],
+				       got, n, space);
+				fail = 1;
+				break;
+			}
+			wrote += got;
+
+			n = rnd(&seed) % sizeof(buf);
+			got = spsc_ring_read(&reader, buf, n);
+			for (i = 0; i < got; i++)
+				if ((uint8_t)buf[i] != log_byte(read + i))
+					break;
+			if (i < got) {
+				printf("FAIL log ring %u: byte %u corrupt\n", sizes[s], read + i);
+				fail = 1;
+				break;
+			}
+			read += got;
+		}
+	}
+	if (_write(3, buf, 1) != -1) {
+		printf("FAIL log ring: wrote to fd 3\n");
+		fail = 1;
+	}
+	log_setup();
+
+	printf("mculog: %s\n", fail ? "FAIL" : "ok");
+	return fail;
+}
+
+/*
+ * Host time and mock HAL calls of the sample timer interrupt of either
+ * engine, stereo at 22.05 kHz from a 44.1 kHz carrier. The host time only
+ * ranks changes to the handler; the M0 figures are in debugfs
+ * picocalc-mcu/stats.
+ */
+static void bench(bool pwm_block)
+{
+	struct timespec t0, t1;
+	unsigned long calls = 0, isrs = 0, n;
+	double ns = 0;
+	uint32_t i;
+
+	log_setup();
+	mock_clk_hz[CLK_PWM1] = SOFTPWM_TIMER_HZ;
+	mock_pwm_layout_bad = false;
+	pwm_engine = pwm_block;
+	if (pwm_engine)
+		pwm_clk_init();
+	softpwm_setup(2, 544, 2, 4 * 2000);
+	duties_fill(544, SOFTPWM_DUTY_MIN, 1);
+	softpwm_start();
+
+	while (frames < BENCH_SAMPLES) {
+		/* Refill outside the timed part, 1500 frames at a time */
+		queued = 0;
+		softpwm_feed(2, 1500);
+		n = mock_calls;
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		for (i = frames; frames < i + 1500;) {
+			if (pwm_engine)
+				pwm_timer_isr(timer_irq, NULL);
+			else
+				edge_timer_isr(timer_irq, NULL);
+			isrs++;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		ns += (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+		calls += mock_calls - n;
+	}
+
+	printf("%s engine: %.2f interrupts per sample, %.1f HAL calls per interrupt, "
+	       "%.1f ns per interrupt on this host\n", pwm_engine ? "pwm" : "edge",
+	       (double)isrs / frames, (double)calls / isrs, ns / isrs);
+}
+
+int main(int argc, char **argv)
+{
+	int opt, do_bench = 0, fail = 0;
+
+	while ((opt = getopt(argc, argv, "b")) != -1) {
+		if (opt != 'b') {
+			fprintf(stderr, "usage: %s [-b]\n", argv[0]);
+			return 2;
+		}
+		do_bench = 1;
+	}
+
+	log_setup();
+	fail |= edge_test();
+	fail |= pwm_test();
+	fail |= probe_test();
+	fail |= mculog_test();
+	if (fail)
+		return 1;
+	if (do_bench) {
+		bench(false);
+		bench(true);
+	}
+	return 0;
+}
@@ -0,0 +1,379 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Host simulation of the panel command queue, see panel.h.
+ *
+ * Linux is played the way ili9488.c and picocalc-mcu.c do it: HELLO first,
+ * then FLUSH records in rpmsg buffers, one flush in flight, waiting for
+ * its DONE. main.c runs against the mock HAL (see mcu_test.c) with main
+ * loop passes of rpmsg_poll(), panel_work() and rpmsg_flush(). A fake
+ * ILI9488 on the mock SPI decodes CASET/PASET/RAMWR from the D/C pin and
+ * the wire bytes into its own memory, which must end up equal to the
+ * framebuffer, one flush at a time and never more than PANEL_LINES lines
+ * per pass.
+ *
+ * Also covered: a burst beyond PICOCALC_PANEL_QUEUE (the excess is
+ * dropped, one DONE for the drained queue), a DONE retried while no
+ * vring buffer is free, and flushes ignored without PICOCALC_CAP_PANEL.
+ *
+ * The MCU reads the framebuffer through a 32 bit address, so it is mapped
+ * below 4 GB.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#define main mcu_main
+#include "main.c"
+#undef main
+
+/* Linker symbols of the shared regions, only main() uses them */
+uint32_t __linux_share_memory_start__[1], __linux_share_memory_end__[1];
+uint32_t __linux_rpmsg_start__[1], __linux_rpmsg_end__[1];
+
+#define FB_W		320
+#define FB_H		320
+#define FB_PITCH	(FB_W * 2 + 64)		/* padded, the MCU must use pitch */
+#define FB_SIZE		(FB_PITCH * FB_H)
+#define LINUX_ADDR	0x400
+#define FLUSHES		300
+
+static uint8_t log_mem[SPSC_RING_HDR_SIZE + 4096] __attribute__((aligned(SPSC_RING_CACHELINE)));
+static uint8_t *fb;
+
+/* Fake panel */
+static uint16_t panel_mem[FB_H][FB_W];
+static uint16_t panel_model[FB_H][FB_W];
+static uint8_t panel_cmd, panel_param[4];
+static uint32_t panel_nparam, panel_x, panel_y, panel_col[2], panel_row[2];
+static uint32_t panel_pixels, panel_errors;
+static int panel_msb = -1;
+
+/* Linux side */
+static uint8_t rx_buf[RPMSG_RX_SLOTS][RL_BUFFER_PAYLOAD_SIZE];
+static uint32_t rx_next, rx_used;
+static uint32_t linux_seq, done_seq, dones, hello_caps, hellos;
+
+/* xorshift32 */
+static uint32_t rnd(uint32_t *s)
+{
+	uint32_t x = *s;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *s = x;
+}
+
+static void panel_error(const char *what)
+{
+	if (!panel_errors++)
+		printf("FAIL panel: %s\n", what);
+}
+
+static void panel_pixel(uint16_t px)
+{
+	if (panel_y > panel_row[1]) {
+		panel_error("pixels past the window");
+		return;
+	}
+	panel_mem[panel_y][panel_x] = px;
+	panel_pixels++;
+	if (++panel_x > panel_col[1]) {
+		panel_x = panel_col[0];
+		panel_y++;
+	}
+}
+
+/* The ILI9488 side of SPI0: D/C low is a command byte, high its data */
+static void panel_rx(const uint8_t *buf, uint32_t len, bool cs)
+{
+	bool data = GPIO0->level & PANEL_DC_PIN;
+	uint32_t i;
+
+	if (!cs) {
+		panel_error("bytes without chip select");
+		return;
+	}
+	for (i = 0; i < len; i++) {
+		if (!data) {
+			panel_cmd = buf[i];
+			panel_nparam = 0;
+			panel_msb = -1;
+			if (panel_cmd == PANEL_RAMWR) {
+				panel_x = panel_col[0];
+				panel_y = panel_row[0];
+			}
+			continue;
+		}
+		switch (panel_cmd) {
+		case PANEL_CASET:
+		case PANEL_PASET:
+			if (panel_nparam == 4) {
+				panel_error("window with more than 4 bytes");
+				break;
+			}
+			panel_param[panel_nparam++] = buf[i];
+			if (panel_nparam == 4) {
+				uint32_t *w = panel_cmd == PANEL_CASET ? panel_col : panel_row;
+
+				w[0] = panel_param[0] << 8 | panel_param[1];
+				w[1] = panel_param[2] << 8 | panel_param[3];
+				if (w[0] > w[1] || w[1] >= (panel_cmd == PANEL_CASET ? FB_W : FB_H))
+					panel_error("bad window");
+			}
+			break;
+		case PANEL_RAMWR:
+			/* RGB565, most significant byte first */
+			if (panel_msb < 0) {
+				panel_msb = buf[i];
+			} else {
+				panel_pixel(panel_msb << 8 | buf[i]);
+				panel_msb = -1;
+			}
+			break;
+		default:
+			panel_error("unknown command");
+			break;
+		}
+	}
+}
+
+/* What picocalc-mcu.c gets back */
+static void linux_rx(uint32_t dst, const void *data, uint32_t size)
+{
+	const struct picocalc_msg *msg;
+	const struct picocalc_msg_hello *hello;
+	const struct picocalc_panel_done *done;
+	uint32_t pos = 0;
+
+	if (dst != LINUX_ADDR)
+		panel_error("reply to the wrong address");
+	while ((msg = picocalc_msg_next(data, size, &pos))) {
+		switch (msg->type) {
+		case PICOCALC_MSG_HELLO:
+			hello = (const void *)msg->data;
+			hello_caps = hello->caps;
+			hellos++;
+			break;
+		case PICOCALC_MSG_PANEL_DONE:
+			done = (const void *)msg->data;
+			done_seq = done->seq;
+			dones++;
+			break;
+		}
+	}
+}
+
+/* picocalc_mcu_queue(), records batched into the next rx buffer */
+static void linux_queue(uint16_t type, const void *data, uint16_t len)
+{
+	struct picocalc_msg *msg = (void *)(rx_buf[rx_next] + rx_used);
+
+	msg->type = type;
+	msg->len = len;
+	memcpy(msg->data, data, len);
+	rx_used += PICOCALC_MSG_SIZE(len);
+}
+
+/* picocalc_mcu_flush(), the MCU's rpmsg callback runs from its mailbox IRQ */
+static void linux_flush(void)
+{
+	if (rpmsg_rx_cb(rx_buf[rx_next], rx_used, LINUX_ADDR, NULL) != RL_HOLD)
+		panel_error("rpmsg buffer not held");
+	rx_next = (rx_next + 1) % RPMSG_RX_SLOTS;
+	rx_used = 0;
+}
+
+static void linux_hello(uint32_t version)
+{
+	struct picocalc_msg_hello hello = {
+		.version = version,
+		.caps = PICOCALC_CAP_PANEL,
+	};
+
+	linux_queue(PICOCALC_MSG_HELLO, &hello, sizeof(hello));
+	linux_flush();
+}
+
+/* ili9488_mcu_post() of the framebuffer rectangle [x1, x2) x [y1, y2) */
+static void linux_post(uint32_t x1, uint32_t y1, uint32_t x2, uint32_t y2)
+{
+	struct picocalc_panel_flush flush = {
+		.seq = ++linux_seq,
+		.addr = (uint32_t)(uintptr_t)(fb + y1 * FB_PITCH + x1 * 2),
+		.pitch = FB_PITCH,
+		.x1 = x1,
+		.y1 = y1,
+		.x2 = x2 - 1,
+		.y2 = y2 - 1,
+	};
+
+	linux_queue(PICOCALC_MSG_PANEL_FLUSH, &flush, sizeof(flush));
+}
+
+/* Linux renders: new pixels everywhere, the panel keeps the old ones */
+static void fb_render(uint32_t *seed)
+{
+	uint32_t i;
+
+	for (i = 0; i < FB_SIZE / 4; i++)
+		((uint32_t *)fb)[i] = rnd(seed);
+}
+
+/* What the panel should show once [x1, x2) x [y1, y2) went out */
+static void model_flush(uint32_t x1, uint32_t y1, uint32_t x2, uint32_t y2)
+{
+	uint32_t x, y;
+
+	for (y = y1; y < y2; y++)
+		for (x = x1; x < x2; x++)
+			memcpy(&panel_model[y][x], fb + y * FB_PITCH + x * 2, 2);
+}
+
+static int panel_check(const char *what)
+{
+	if (memcmp(panel_mem, panel_model, sizeof(panel_mem))) {
+		printf("FAIL panel: %s, panel differs from the framebuffer\n", what);
+		return 1;
+	}
+	return 0;
+}
+
+/* One pass of the MCU main loop, returns the pixels it clocked out */
+static uint32_t mcu_pass(void)
+{
+	uint32_t pixels = panel_pixels;
+
+	rpmsg_poll();
+	panel_work();
+	rpmsg_flush();
+	return panel_pixels - pixels;
+}
+
+/* Passes until the queue is empty, checking the per pass budget */
+static int mcu_run(uint32_t width)
+{
+	uint32_t passes;
+
+	for (passes = 0; passes < FB_H + 4; passes++) {
+		if (mcu_pass() > PANEL_LINES * width) {
+			panel_error("more than PANEL_LINES lines in one pass");
+			return 1;
+		}
+		if (panel_head == panel_tail && (!panel_report || mock_rpmsg_tx_busy))
+			return 0;
+	}
+	panel_error("queue never drained");
+	return 1;
+}
+
+static void *fb_map(void)
+{
+	static const uintptr_t hints[] = { 0x20000000, 0x40000000, 0x60000000 };
+	unsigned int i;
+	void *p;
+
+	for (i = 0; i < sizeof(hints) / sizeof(hints[0]); i++) {
+		p = mmap((void *)hints[i], FB_SIZE, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+		if (p != MAP_FAILED)
+			return p;
+	}
+	return NULL;
+}
+
+int main(void)
+{
+	uint32_t seed = 5, i, x1, y1, x2, y2, seq;
+	int fail = 0;
+
+	spsc_ring_init(&logring, log_mem, sizeof(log_mem));
+	fb = fb_map();
+	if (!fb) {
+		printf("FAIL panel: no framebuffer below 4 GB\n");
+		return 1;
+	}
+	mock_spi_tx = panel_rx;
+	mock_rpmsg_sent = linux_rx;
+	rpmsg = rpmsg_lite_remote_init(NULL, RPMSG_LINK_ID, RL_NO_FLAGS, &rpmsg_ctx);
+
+	/* Flushes before a HELLO that grants the panel are ignored */
+	linux_hello(PICOCALC_RPMSG_VERSION + 1);
+	mcu_pass();
+	fb_render(&seed);
+	linux_post(0, 0, FB_W, FB_H);
+	linux_flush();
+	mcu_pass();
+	if (hellos != 1 || hello_caps || panel_pixels || dones) {
+		printf("FAIL panel: flushed without PICOCALC_CAP_PANEL\n");
+		fail = 1;
+	}
+
+	linux_hello(PICOCALC_RPMSG_VERSION);
+	mcu_pass();
+	if (hellos != 2 || !(hello_caps & PICOCALC_CAP_PANEL)) {
+		printf("FAIL panel: HELLO granted 0x%x\n", hello_caps);
+		return 1;
+	}
+
+	/* Linux' own pace: one flush, wait for its DONE, render, next */
+	for (i = 0; i < FLUSHES && !fail; i++) {
+		fb_render(&seed);
+		if (i == 0) {
+			x1 = y1 = 0;
+			x2 = FB_W;
+			y2 = FB_H;
+		} else {
+			x1 = rnd(&seed) % FB_W;
+			y1 = rnd(&seed) % FB_H;
+			x2 = x1 + 1 + rnd(&seed) % (FB_W - x1);
+			y2 = y1 + 1 + rnd(&seed) % (FB_H - y1);
+		}
+		linux_post(x1, y1, x2, y2);
+		linux_flush();
+		model_flush(x1, y1, x2, y2);
+		/* Every 7th DONE finds the vring full first and is retried */
+		mock_rpmsg_tx_busy = i % 7 == 3;
+		fail |= mcu_run(x2 - x1);
+		if (mock_rpmsg_tx_busy) {
+			if (dones != i || !panel_report) {
+				printf("FAIL panel: DONE sent without a tx buffer\n");
+				fail = 1;
+			}
+			mock_rpmsg_tx_busy = false;
+			fail |= mcu_run(x2 - x1);
+		}
+		if (dones != i + 1 || done_seq != linux_seq) {
+			printf("FAIL panel: flush %u: %u DONEs, seq %u\n", linux_seq, dones,
+			       done_seq);
+			fail = 1;
+		}
+		fail |= panel_check("paced flushes");
+	}
+
+	/*
+	 * A burst of one more than the queue holds in one buffer: the extra
+	 * flush is dropped, the queue drains with a single DONE.
+	 */
+	fb_render(&seed);
+	for (i = 0; i <= PICOCALC_PANEL_QUEUE; i++) {
+		linux_post(i * 100, i * 100, i * 100 + 90, i * 100 + 90);
+		if (i < PICOCALC_PANEL_QUEUE)
+			model_flush(i * 100, i * 100, i * 100 + 90, i * 100 + 90);
+	}
+	seq = linux_seq - 1;
+	linux_flush();
+	fail |= mcu_run(90);
+	if (dones != FLUSHES + 1 || done_seq != seq) {
+		printf("FAIL panel: burst: %u DONEs, seq %u, want %u %u\n", dones, done_seq,
+		       FLUSHES + 1, seq);
+		fail = 1;
+	}
+	fail |= panel_check("burst");
+
+	if (panel_errors)
+		fail = 1;
+	printf("panel: %s\n", fail ? "FAIL" : "ok");
+	return fail;
+}
@@ -0,0 +1,253 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Host test of the Linux side of softpwm, sound/pwm/picocalc-softpwm.c,
+ * built against the mock kernel and ALSA core in kernel/.
+ *
+ * The driver is included whole and probed; the test plays the MCU, which
+ * takes one ring frame per sample tick and rings the doorbell once per
+ * period, and the application, which keeps the buffer full. A stream
+ * prepared again after a drain, an xrun or a drop must put exactly the
+ * same bytes into the ring as the first stream after open did.
+ */
+
+#include <stdio.h>
+
+#include "picocalc-softpwm.c"
+
+#define STREAM_FRAMES	3000
+#define XRUN_FRAMES	300
+#define PERIOD_FRAMES	256
+#define PERIODS		4
+#define CAPTURE_BYTES	(4 * STREAM_FRAMES)
+/* Sample ticks a stream may take before the test gives up on it */
+#define TICKS_MAX	(4 * STREAM_FRAMES)
+
+static uint8_t shm_mem[SOFTPWM_SHM_HDR_SIZE + 4096] __attribute__((aligned(SPSC_RING_CACHELINE)));
+static struct softpwm_shm *shm = (struct softpwm_shm *)shm_mem;
+
+void *picocalc_shm_get(u32 id, u32 *size)
+{
+	if (id != PICOCALC_SHM_SOFTPWM)
+		return ERR_PTR(-ENODEV);
+	*size = sizeof(shm_mem);
+	return shm_mem;
+}
+
+/* The MCU: its view of the ring and what it took out of it */
+static struct spsc_ring mcu_ring;
+static bool mcu_running;
+static bool mcu_byte_half;	/* mono ADPCM: second frame of a byte to play */
+static uint32_t mcu_ticks;
+static uint8_t capture[CAPTURE_BYTES];
+static uint32_t capture_len;
+
+static void mcu_doorbell(void *msg)
+{
+	if (READ_ONCE(shm->state) == SOFTPWM_STATE_RUN) {
+		if (mcu_running)
+			return;
+		spsc_ring_attach(&mcu_ring, &shm->ring);
+		mcu_running = true;
+		mcu_byte_half = false;
+		mcu_ticks = 0;
+		capture_len = 0;
+	} else {
+		mcu_running = false;
+	}
+	WRITE_ONCE(shm->mcu_state, mcu_running ? SOFTPWM_STATE_RUN : SOFTPWM_STATE_STOP);
+}
+
+/* One sample tick: load a frame, count it, ring the doorbell on a period */
+static void mcu_tick(void)
+{
+	uint32_t bytes = shm->channels * sizeof(softpwm_sample_t);
+	uint8_t frame[4];
+
+	if (shm->encoding == SOFTPWM_ENCODING_IMA_ADPCM)
+		bytes = 1;
+
+	if (mcu_byte_half) {
+		mcu_byte_half = false;
+	} else if (spsc_ring_read(&mcu_ring, frame, bytes) == bytes) {
+		if (capture_len + bytes <= CAPTURE_BYTES)
+			memcpy(capture + capture_len, frame, bytes);
+		capture_len += bytes;
+		mcu_byte_half = shm->encoding == SOFTPWM_ENCODING_IMA_ADPCM && shm->channels == 1;
+	} else {
+		shm->underruns++;
+	}
+	shm->frames++;
+
+	if (++mcu_ticks % shm->period_frames == 0)
+		mock_mbox_chan.cl->rx_callback(mock_mbox_chan.cl, NULL);
+}
+
+/* xorshift32, a different frame at every buffer position */
+static uint32_t rnd(uint32_t *s)
+{
+	uint32_t x = *s;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *s = x;
+}
+
+static uint8_t stream[STREAM_FRAMES * 4];
+
+/* Run until the stream leaves @state, false if it never does */
+static bool run_while(struct snd_pcm_runtime *runtime, snd_pcm_state_t state)
+{
+	uint32_t i;
+
+	for (i = 0; i < TICKS_MAX && runtime->status->state == state; i++)
+		mcu_tick();
+	return runtime->status->state != state;
+}
+
+/*
+ * Prepare, write STREAM_FRAMES frames a period at a time and drain. The
+ * application stays a buffer ahead, so the driver never reads a frame it
+ * has not written.
+ */
+static int play(struct snd_pcm_substream *substream, const char *name)
+{
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	snd_pcm_uframes_t written;
+	uint32_t i;
+	int ret;
+
+	ret = mock_pcm_prepare(substream);
+	if (ret) {
+		printf("FAIL %s: prepare %d\n", name, ret);
+		return 1;
+	}
+	written = mock_pcm_write(substream, stream, STREAM_FRAMES);
+	mock_pcm_start(substream);
+	while (written < STREAM_FRAMES && runtime->status->state == SNDRV_PCM_STATE_RUNNING) {
+		for (i = 0; i < shm->period_frames; i++)
+			mcu_tick();
+		written += mock_pcm_write(substream, stream + frames_to_bytes(runtime, written),
+					  STREAM_FRAMES - written);
+	}
+	ret = mock_pcm_drain(substream);
+	if (ret || !run_while(runtime, SNDRV_PCM_STATE_DRAINING) ||
+	    runtime->status->state != SNDRV_PCM_STATE_SETUP) {
+		printf("FAIL %s: drain %d, state %d\n", name, ret, runtime->status->state);
+		return 1;
+	}
+	return 0;
+}
+
+/* Start a short stream and let it run dry */
+static int xrun(struct snd_pcm_substream *substream)
+{
+	struct snd_pcm_runtime *runtime = substream->runtime;
+
+	if (mock_pcm_prepare(substream))
+		return 1;
+	mock_pcm_write(substream, stream, XRUN_FRAMES);
+	mock_pcm_start(substream);
+	return !run_while(runtime, SNDRV_PCM_STATE_RUNNING) ||
+	       runtime->status->state != SNDRV_PCM_STATE_XRUN;
+}
+
+/* Start a short stream and drop it a period in */
+static int drop(struct snd_pcm_substream *substream)
+{
+	uint32_t i;
+
+	if (mock_pcm_prepare(substream))
+		return 1;
+	mock_pcm_write(substream, stream, XRUN_FRAMES);
+	mock_pcm_start(substream);
+	for (i = 0; i < PERIOD_FRAMES; i++)
+		mcu_tick();
+	return mock_pcm_drop(substream);
+}
+
+struct pcm_case {
+	unsigned int rate;
+	unsigned int channels;
+	snd_pcm_format_t format;
+	int adpcm;
+};
+
+static int pcm_test_one(struct snd_pcm *pcm, const struct pcm_case *c)
+{
+	static uint8_t ref[CAPTURE_BYTES];
+	static const char *const after[] = { "drain", "xrun", "drop" };
+	struct snd_pcm_substream *substream;
+	uint32_t ref_len, seed = 1, i;
+	char name[64];
+	int fail = 0;
+
+	snprintf(name, sizeof(name), "%u Hz %uch %s %s", c->rate, c->channels,
+		 c->format == SNDRV_PCM_FORMAT_S16_LE ? "S16" : "U8",
+		 c->adpcm ? "adpcm" : "duty16");
+	for (i = 0; i < sizeof(stream); i++)
+		stream[i] = rnd(&seed);
+
+	adpcm = c->adpcm;
+	if (mock_pcm_open(pcm, &substream) ||
+	    mock_pcm_hw_params(substream, c->rate, c->channels, c->format,
+			       PERIOD_FRAMES, PERIODS)) {
+		printf("FAIL %s: open\n", name);
+		return 1;
+	}
+
+	if (play(substream, name))
+		return 1;
+	ref_len = capture_len;
+	memcpy(ref, capture, min(ref_len, (uint32_t)CAPTURE_BYTES));
+	if (!ref_len || ref_len > CAPTURE_BYTES) {
+		printf("FAIL %s: %u bytes played\n", name, ref_len);
+		return 1;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(after); i++) {
+		if ((i == 1 && xrun(substream)) || (i == 2 && drop(substream))) {
+			printf("FAIL %s: no %s\n", name, after[i]);
+			fail = 1;
+			continue;
+		}
+		if (play(substream, name))
+			fail = 1;
+		else if (capture_len != ref_len || memcmp(capture, ref, ref_len)) {
+			printf("FAIL %s: prepared after %s, %u bytes played differ from %u\n",
+			       name, after[i], capture_len, ref_len);
+			fail = 1;
+		}
+	}
+
+	substream->ops->close(substream);
+	return fail;
+}
+
+int main(void)
+{
+	static const struct pcm_case cases[] = {
+		{  8000, 2, SNDRV_PCM_FORMAT_S16_LE, 0 },
+		{ 44100, 2, SNDRV_PCM_FORMAT_S16_LE, 0 },
+		{ 22050, 2, SNDRV_PCM_FORMAT_S16_LE, 1 },
+		{  8000, 1, SNDRV_PCM_FORMAT_U8, 1 },
+		{ 48000, 1, SNDRV_PCM_FORMAT_S16_LE, 1 },
+	};
+	static struct platform_device pdev;
+	static struct device_node np;
+	int fail = 0;
+	uint32_t i;
+
+	mock_mbox_sent = mcu_doorbell;
+	pdev.dev.of_node = &np;
+	if (mock_platform_driver->probe(&pdev)) {
+		printf("FAIL probe\n");
+		return 1;
+	}
+	for (i = 0; i < ARRAY_SIZE(cases); i++)
+		fail |= pcm_test_one(mock_pcm, &cases[i]);
+
+	mock_platform_driver->remove(&pdev);
+	printf("softpwm pcm: %s\n", fail ? "FAIL" : "ok");
+	return fail;
+}
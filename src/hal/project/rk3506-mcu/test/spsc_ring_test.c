@@ -0,0 +1,225 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Host stress test and throughput benchmark for spsc_ring.h.
+ *
+ * A producer and a consumer thread push a pseudo random byte stream through
+ * rings whose sizes are not powers of two, with batch sizes that do not
+ * divide them, so the indices wrap at every possible offset. Both the copy
+ * (write/read) and the zero-copy (reserve/commit, peek/consume) APIs are
+ * used and the consumer checks every byte.
+ *
+ * usage: spsc_ring_test [-b]     -b runs the throughput benchmark as well
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "spsc_ring.h"
+
+#define STRESS_BYTES	(16u << 20)
+#define BENCH_BYTES	(256u << 20)
+
+struct job {
+	struct spsc_ring prod;
+	struct spsc_ring cons;
+	uint64_t bytes;
+	uint32_t max_batch;	/* 0: fixed batch of "batch" bytes */
+	uint32_t batch;
+	int zero_copy;
+	int check;
+	uint64_t errors;
+};
+
+/* xorshift32, both sides run the same generator to make and check the data */
+static inline uint32_t rnd(uint32_t *s)
+{
+	uint32_t x = *s;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *s = x;
+}
+
+static uint32_t batch_len(struct job *j, uint32_t *seed, uint64_t left)
+{
+	uint32_t n = j->max_batch ? 1 + rnd(seed) % j->max_batch : j->batch;
+
+	return n > left ? (uint32_t)left : n;
+}
+
+static void *producer(void *arg)
+{
+	struct job *j = arg;
+	uint32_t data = 1, seed = 7, pend = 0;
+	uint8_t buf[8192];
+	uint64_t done = 0;
+
+	while (done < j->bytes) {
+		uint32_t n = batch_len(j, &seed, j->bytes - done), i, w;
+		void *p;
+
+		if (j->zero_copy) {
+			w = spsc_ring_reserve(&j->prod, &p, n);
+			if (w > n)
+				w = n;
+			if (!j->check)
+				memset(p, 0x55, w);
+			else
+				for (i = 0; i < w; i++)
+					((uint8_t *)p)[i] = (uint8_t)rnd(&data);
+			spsc_ring_commit(&j->prod, w);
+		} else {
+			/* bytes a short write left over go first */
+			if (n < pend)
+				n = pend;
+			for (i = pend; i < n && j->check; i++)
+				buf[i] = (uint8_t)rnd(&data);
+			w = spsc_ring_write(&j->prod, buf, n);
+			pend = n - w;
+			memmove(buf, buf + w, pend);
+		}
+		/* full, let the consumer run when both share a core */
+		if (!w)
+			sched_yield();
+		done += w;
+	}
+	return NULL;
+}
+
+static void *consumer(void *arg)
+{
+	struct job *j = arg;
+	uint32_t data = 1, seed = 11;
+	uint8_t buf[8192];
+	uint64_t done = 0;
+
+	while (done < j->bytes) {
+		uint32_t n = batch_len(j, &seed, j->bytes - done), i, r;
+		const uint8_t *p;
+
+		if (j->zero_copy) {
+			r = spsc_ring_peek(&j->cons, (const void **)&p, n);
+			if (r > n)
+				r = n;
+		} else {
+			r = spsc_ring_read(&j->cons, buf, n);
+			p = buf;
+		}
+		if (j->check)
+			for (i = 0; i < r; i++)
+				if (p[i] != (uint8_t)rnd(&data))
+					j->errors++;
+		if (j->zero_copy)
+			spsc_ring_consume(&j->cons, r);
+		if (!r)
+			sched_yield();
+		done += r;
+	}
+	return NULL;
+}
+
+static double run(struct job *j, uint32_t len)
+{
+	struct timespec t0, t1;
+	pthread_t tp, tc;
+	void *mem;
+
+	if (posix_memalign(&mem, SPSC_RING_CACHELINE, len))
+		abort();
+	spsc_ring_init(&j->prod, mem, len);
+	spsc_ring_attach(&j->cons, mem);
+	j->errors = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	pthread_create(&tc, NULL, consumer, j);
+	pthread_create(&tp, NULL, producer, j);
+	pthread_join(tp, NULL);
+	pthread_join(tc, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	if (j->cons.head != j->prod.head || j->cons.tail != j->prod.head) {
+		fprintf(stderr, "ring %u: indices out of step\n", len);
+		j->errors++;
+	}
+	free(mem);
+	return (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+}
+
+static int stress(void)
+{
+	/* data[] sizes, one byte less than that can be queued */
+	static const uint32_t sizes[] = { 2, 3, 64, 256, 1001, 4094 };
+	static const uint32_t batches[] = { 1, 7, 64, 300, 5000 };
+	unsigned int s, b, z;
+	int fail = 0;
+
+	for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+		for (b = 0; b < sizeof(batches) / sizeof(batches[0]); b++)
+			for (z = 0; z < 2; z++) {
+				struct job j = {
+					.bytes = sizes[s] < 64 ? STRESS_BYTES / 64 : STRESS_BYTES,
+					.max_batch = batches[b],
+					.zero_copy = z,
+					.check = 1,
+				};
+
+				run(&j, SPSC_RING_HDR_SIZE + sizes[s]);
+				if (j.errors) {
+					printf("FAIL size %u batch <=%u %s: %llu bad bytes\n",
+					       sizes[s], batches[b], z ? "zero-copy" : "copy",
+					       (unsigned long long)j.errors);
+					fail = 1;
+				}
+			}
+
+	printf("stress: %s\n", fail ? "FAIL" : "ok");
+	return fail;
+}
+
+static void bench(void)
+{
+	/* the softpwm and mculog rings are a few KB */
+	static const uint32_t sizes[] = { 1024, 8192 };
+	static const uint32_t batches[] = { 1, 16, 256, 1024 };
+	unsigned int s, b, z;
+
+	for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+		for (b = 0; b < sizeof(batches) / sizeof(batches[0]); b++)
+			for (z = 0; z < 2; z++) {
+				struct job j = {
+					.bytes = batches[b] < 16 ? BENCH_BYTES / 16 : BENCH_BYTES,
+					.batch = batches[b],
+					.zero_copy = z,
+				};
+				double t = run(&j, SPSC_RING_HDR_SIZE + sizes[s]);
+
+				printf("ring %5u batch %5u %-9s %8.1f MB/s %7.1f Mops/s\n",
+				       sizes[s], batches[b], z ? "zero-copy" : "copy",
+				       j.bytes / t / 1e6, j.bytes / batches[b] / t / 1e6);
+			}
+}
+
+int main(int argc, char **argv)
+{
+	int opt, do_bench = 0;
+
+	while ((opt = getopt(argc, argv, "b")) != -1) {
+		if (opt != 'b') {
+			fprintf(stderr, "usage: %s [-b]\n", argv[0]);
+			return 2;
+		}
+		do_bench = 1;
+	}
+
+	if (stress())
+		return 1;
+	if (do_bench)
+		bench();
+	return 0;
+}
@@ -20,8 +20,10 @@
  #include <drm/drm_atomic_helper.h>
  #include <drm/drm_damage_helper.h>
  #include <drm/drm_drv.h>
+ #include <drm/drm_fb_dma_helper.h>
  #include <drm/drm_framebuffer.h>
  #include <drm/drm_fb_helper.h>
+ #include <drm/drm_fourcc.h>
  #include <drm/drm_format_helper.h>
  #include <drm/drm_gem_framebuffer_helper.h>
  #include <drm/drm_gem_atomic_helper.h>
@@ -29,6 +31,9 @@
  #include <drm/drm_managed.h>
  #include <drm/drm_mipi_dbi.h>
  #include <drm/drm_modeset_helper.h>
+ #include <drm/drm_print.h>
+ 
+ #include <soc/picocalc/panel.h>
 
 #define ILI9488_POSITIVE_GAMMA_CTRL		0xE0
 #define ILI9488_NEGATIVE_GAMMA_CTRL		0xE1
@@ -47,6 +52,34 @@
 #define ILI9488_SLEEP_OUT				0x11
 #define ILI9488_DISPLAY_ON				0x29
 
+/*
+ * With mcu_flush set and the MCU offering PICOCALC_CAP_PANEL, RGB565
+ * flushes are posted to the MCU, which drives SPI0 while Linux goes on
+ * rendering. Everything else still goes out through mipi_dbi, after the
+ * MCU is done with the bus. See soc/picocalc/panel.h.
+ */
+static bool mcu_flush;
+module_param(mcu_flush, bool, 0644);
+MODULE_PARM_DESC(mcu_flush, "Let the MCU flush RGB565 framebuffers (default: false)");
+
+/* A full frame takes ~20 ms at 80 MHz */
+#define ILI9488_MCU_TIMEOUT_MS	200
+
+struct ili9488 {
+	struct mipi_dbi_dev dbidev;
+	wait_queue_head_t mcu_wq;
+	bool mcu;			// DONE handler registered
+	bool mcu_failed;		// timed out, never post again
+	u32 mcu_seq;			// last posted flush
+	u32 mcu_done;			// last flush the MCU finished
+	struct drm_framebuffer *mcu_fb;	// held until mcu_done catches up
+};
+
+static struct ili9488 *to_ili9488(struct drm_device *drm)
+{
+	return container_of(drm, struct ili9488, dbidev.drm);
+}
+
 static int dummy_backlight_update_status(struct backlight_device *bd)
 {
 	return 0;
@@ -56,6 +89,117 @@ static const struct backlight_ops dummy_backlight_ops = {
 	.update_status = dummy_backlight_update_status,
 };
 
+/* Runs in the RPMsg receive path */
+static void ili9488_mcu_done(void *priv, const void *data, u16 len)
+{
+	const struct picocalc_panel_done *done = data;
+	struct ili9488 *ili = priv;
+
+	if (len < sizeof(*done))
+		return;
+
+	WRITE_ONCE(ili->mcu_done, done->seq);
+	wake_up(&ili->mcu_wq);
+}
+
+/* Wait until the MCU is off SPI0 and done reading the last framebuffer */
+static void ili9488_mcu_wait(struct ili9488 *ili)
+{
+	struct drm_framebuffer *fb = ili->mcu_fb;
+
+	if (!fb)
+		return;
+
+	if (!wait_event_timeout(ili->mcu_wq,
+				(s32)(READ_ONCE(ili->mcu_done) - ili->mcu_seq) >= 0,
+				msecs_to_jiffies(ILI9488_MCU_TIMEOUT_MS))) {
+		drm_warn(&ili->dbidev.drm, "MCU flush timed out, flushing from Linux\n");
+		ili->mcu_failed = true;
+	}
+	ili->mcu_fb = NULL;
+	drm_framebuffer_put(fb);
+}
+
+/* Post @rect of the plane to the MCU, false when Linux has to flush it */
+static bool ili9488_mcu_post(struct ili9488 *ili, struct drm_plane_state *state,
+			     const struct drm_rect *rect)
+{
+	struct mipi_dbi *dbi = &ili->dbidev.dbi;
+	struct drm_framebuffer *fb = state->fb;
+	struct picocalc_panel_flush flush;
+	struct drm_gem_dma_object *dma_obj;
+	u64 start, end;
+	int ret;
+
+	if (!READ_ONCE(mcu_flush) || !ili->mcu || ili->mcu_failed ||
+	    fb->format->format != DRM_FORMAT_RGB565 ||
+	    !(picocalc_mcu_caps() & PICOCALC_CAP_PANEL))
+		return false;
+
+	/* Without an IOMMU the DMA address is the physical one, see probe */
+	dma_obj = drm_fb_dma_get_gem_obj(fb, 0);
+	start = dma_obj->dma_addr + fb->offsets[0] +
+		rect->y1 * fb->pitches[0] + rect->x1 * fb->format->cpp[0];
+	end = start + (u64)(drm_rect_height(rect) - 1) * fb->pitches[0] +
+	      drm_rect_width(rect) * fb->format->cpp[0];
+	if (start < PICOCALC_PANEL_ADDR_MIN || end > PICOCALC_PANEL_ADDR_END) {
+		drm_dbg_kms(&ili->dbidev.drm, "Framebuffer at %pad out of the MCU's reach\n",
+			    &dma_obj->dma_addr);
+		return false;
+	}
+
+	flush.seq = ili->mcu_seq + 1;
+	flush.addr = start;
+	flush.pitch = fb->pitches[0];
+	flush.x1 = rect->x1 + dbi->left_offset;
+	flush.y1 = rect->y1 + dbi->top_offset;
+	flush.x2 = rect->x2 - 1 + dbi->left_offset;
+	flush.y2 = rect->y2 - 1 + dbi->top_offset;
+
+	ret = picocalc_mcu_queue(PICOCALC_MSG_PANEL_FLUSH, &flush, sizeof(flush));
+	if (!ret)
+		ret = picocalc_mcu_flush();
+	if (ret) {
+		drm_dbg_kms(&ili->dbidev.drm, "MCU flush not posted: %d\n", ret);
+		return false;
+	}
+
+	ili->mcu_seq = flush.seq;
+	drm_framebuffer_get(fb);
+	ili->mcu_fb = fb;
+	return true;
+}
+
+static void ili9488_pipe_update(struct drm_simple_display_pipe *pipe,
+				struct drm_plane_state *old_state)
+{
+	struct ili9488 *ili = to_ili9488(pipe->crtc.dev);
+	struct drm_plane_state *state = pipe->plane.state;
+	struct drm_rect rect;
+	bool posted = false;
+	int idx;
+
+	if (!pipe->crtc.state->active || !state->fb)
+		return;
+
+	ili9488_mcu_wait(ili);
+	if (!drm_atomic_helper_damage_merged(old_state, state, &rect))
+		return;
+
+	if (drm_dev_enter(pipe->crtc.dev, &idx)) {
+		posted = ili9488_mcu_post(ili, state, &rect);
+		drm_dev_exit(idx);
+	}
+	if (!posted)
+		mipi_dbi_pipe_update(pipe, old_state);
+}
+
+static void ili9488_pipe_disable(struct drm_simple_display_pipe *pipe)
+{
+	ili9488_mcu_wait(to_ili9488(pipe->crtc.dev));
+	mipi_dbi_pipe_disable(pipe);
+}
+
 static void ili9488_enable(struct drm_simple_display_pipe *pipe,
 			     struct drm_crtc_state *crtc_state,
 			     struct drm_plane_state *plane_state)
@@ -106,8 +250,8 @@ out_exit:
 static const struct drm_simple_display_pipe_funcs ili9488_pipe_funcs = {
 	.mode_valid = mipi_dbi_pipe_mode_valid,
 	.enable = ili9488_enable,
-	.disable = mipi_dbi_pipe_disable,
-	.update = mipi_dbi_pipe_update
+	.disable = ili9488_pipe_disable,
+	.update = ili9488_pipe_update
 };
 
 static const struct drm_display_mode ili9488_mode = {
@@ -145,6 +289,7 @@ static int ili9488_probe(struct spi_device *spi)
 {
 	struct device *dev = &spi->dev;
 	struct mipi_dbi_dev *dbidev;
+	struct ili9488 *ili;
 	struct drm_device *drm;
 	struct mipi_dbi *dbi;
 	struct gpio_desc *dc;
@@ -152,11 +297,12 @@ static int ili9488_probe(struct spi_device *spi)
 	u32 rotation = 0;
 	int ret;
 
-	dbidev = devm_drm_dev_alloc(dev, &ili9488_driver,
-				    struct mipi_dbi_dev, drm);
-	if (IS_ERR(dbidev))
-		return PTR_ERR(dbidev);
+	ili = devm_drm_dev_alloc(dev, &ili9488_driver,
+				 struct ili9488, dbidev.drm);
+	if (IS_ERR(ili))
+		return PTR_ERR(ili);
 
+	dbidev = &ili->dbidev;
 	dbi = &dbidev->dbi;
 	drm = &dbidev->drm;
 
@@ -195,9 +341,19 @@ static int ili9488_probe(struct spi_device *spi)
 
 	drm_mode_config_reset(drm);
 
+	init_waitqueue_head(&ili->mcu_wq);
+	/* The MCU gets physical addresses, an IOMMU would hand out others */
+	if (device_iommu_mapped(drm->dev))
+		drm_info(drm, "Behind an IOMMU, MCU flushes disabled\n");
+	else
+		ili->mcu = !picocalc_mcu_register(PICOCALC_MSG_PANEL_DONE, ili9488_mcu_done, ili);
+
 	ret = drm_dev_register(drm, 0);
-	if (ret)
+	if (ret) {
+		if (ili->mcu)
+			picocalc_mcu_unregister(PICOCALC_MSG_PANEL_DONE);
 		return ret;
+	}
 
 	spi_set_drvdata(spi, drm);
 
@@ -211,6 +367,8 @@ static void ili9488_remove(struct spi_device *spi)
 
 	drm_dev_unplug(drm);
 	drm_atomic_helper_shutdown(drm);
+	if (to_ili9488(drm)->mcu)
+		picocalc_mcu_unregister(PICOCALC_MSG_PANEL_DONE);
 }
 
 static void ili9488_shutdown(struct spi_device *spi)
@@ -222,6 +380,8 @@ static struct spi_driver ili9488_spi_driver = {
 	.driver = {
 		.name = "ili9488",
 		.of_match_table = ili9488_of_match,
+		/* the panel init sleeps 150 ms */
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,
 	},
 	.id_table = ili9488_id,
 	.probe = ili9488_probe,
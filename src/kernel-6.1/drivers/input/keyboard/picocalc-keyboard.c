@@ -2,14 +2,22 @@
 /*
  * Driver for Picocalc Keyboard
  *
+ * Either polls the keyboard controller over I2C itself, or, as
+ * "picocalc,mcu-keyboard", takes the key events the MCU pushes into
+ * shared memory. See soc/picocalc/keyboard.h.
+ *
  * Copyright 2025 nekocharm <jumba.jookiba@outlook.com>
  */
 
 #include <linux/module.h>
 #include <linux/i2c.h>
 #include <linux/input.h>
+#include <linux/mailbox_client.h>
+#include <linux/platform_device.h>
 #include <linux/workqueue.h>
 #include <linux/of.h>
+#include <soc/picocalc/keyboard.h>
+#include <soc/picocalc/shm_table.h>
 
 #define DRV_NAME    	"picocalc-keyboard"
 #define PCKB_REG		0x09
@@ -27,6 +35,10 @@ struct picocalc_keyboard {
 	struct delayed_work work;
 	int page_key;
 	int interval;
+	/* MCU pushed events, "picocalc,mcu-keyboard" only */
+	struct spsc_ring ring;
+	struct mbox_client mbox_cl;
+	struct mbox_chan *mbox;
 };
 
 static unsigned short xlate[KEYCODE_SIZE] = {
@@ -84,29 +96,13 @@ static unsigned short xlate[KEYCODE_SIZE] = {
 	[' '] = KEY_SPACE, ['\n'] = KEY_ENTER,
 };
 
-static void pckb_work_handler(struct work_struct *work)
+static void pckb_report(struct picocalc_keyboard *pckb, u8 keystate, u8 keycode)
 {
-    struct picocalc_keyboard *pckb = container_of(work,
-										struct picocalc_keyboard, work.work);
-    struct i2c_client *client = pckb->client;
-	u8 keystate;
-	u8 keycode;
-	int ret;
-
-	ret = i2c_smbus_read_word_data(client, PCKB_REG);
-	if (ret < 0) {
-		dev_err(&client->dev, "%d\n", ret);
-        goto reschedule;
-	}
-
-	keystate = (u8)(ret & 0xff);
-	keycode = (u8)((ret & 0xff00) >> 8);
-
 	if (keystate != KEY_STATE_PRESSED && keystate != KEY_STATE_RELEASED)
-		goto reschedule;
+		return;
 
 	if (xlate[keycode] == 0 || xlate[keycode] == KEY_UNKNOWN)
-		goto reschedule;
+		return;
 
 	if (keycode == 0xA2 || keycode == 0xA3)
 	{
@@ -126,39 +122,41 @@ static void pckb_work_handler(struct work_struct *work)
 
 	input_report_key(pckb->input, xlate[keycode], keystate == KEY_STATE_PRESSED);
     input_sync(pckb->input);
+}
+
+static void pckb_work_handler(struct work_struct *work)
+{
+    struct picocalc_keyboard *pckb = container_of(work,
+										struct picocalc_keyboard, work.work);
+    struct i2c_client *client = pckb->client;
+	int ret;
+
+	ret = i2c_smbus_read_word_data(client, PCKB_REG);
+	if (ret < 0) {
+		dev_err(&client->dev, "%d\n", ret);
+        goto reschedule;
+	}
+
+	pckb_report(pckb, (u8)(ret & 0xff), (u8)((ret & 0xff00) >> 8));
 
 reschedule:
     schedule_delayed_work(&pckb->work, msecs_to_jiffies(pckb->interval));
 }
 
-static int pckb_probe(struct i2c_client *client, const struct i2c_device_id *id)
+static int pckb_input_init(struct device *dev, struct picocalc_keyboard *pckb,
+			   u16 bustype)
 {
-	struct picocalc_keyboard *pckb;
-	struct device *dev = &client->dev;
 	int i;
 	int ret;
 
-	pckb = devm_kzalloc(dev, sizeof(*pckb), GFP_KERNEL);
-	if (!pckb)
-		return -ENOMEM;
-    
-    pckb->client = client;
-    pckb->interval = INTERVAL;
-	pckb->page_key = 0;
-
-	i2c_set_clientdata(client, pckb);
-
 	pckb->input = devm_input_allocate_device(dev);
 	if (!pckb->input)
-    {
-        ret = -ENOMEM;
-        goto error;
-    }
+		return -ENOMEM;
 
-	input_set_drvdata(pckb->input, client);
+	input_set_drvdata(pckb->input, pckb);
 
 	pckb->input->name = "Picocalc Keyboard";
-	pckb->input->id.bustype = BUS_I2C;
+	pckb->input->id.bustype = bustype;
 	pckb->input->id.vendor  = 0x0001;
 	pckb->input->id.product = 0x0001;
 	pckb->input->id.version = 0x0001;
@@ -170,16 +168,34 @@ static int pckb_probe(struct i2c_client *client, const struct i2c_device_id *id)
     }
 
 	ret = input_register_device(pckb->input);
-	if (ret) {
+	if (ret)
 		dev_err(dev, "Failed to register input: %d\n", ret);
-		goto error;
-	}
+	return ret;
+}
+
+static int pckb_probe(struct i2c_client *client, const struct i2c_device_id *id)
+{
+	struct picocalc_keyboard *pckb;
+	struct device *dev = &client->dev;
+	int ret;
+
+	pckb = devm_kzalloc(dev, sizeof(*pckb), GFP_KERNEL);
+	if (!pckb)
+		return -ENOMEM;
+    
+    pckb->client = client;
+    pckb->interval = INTERVAL;
+	pckb->page_key = 0;
+
+	i2c_set_clientdata(client, pckb);
+
+	ret = pckb_input_init(dev, pckb, BUS_I2C);
+	if (ret)
+		return ret;
 
     INIT_DELAYED_WORK(&pckb->work, pckb_work_handler);
     schedule_delayed_work(&pckb->work, msecs_to_jiffies(pckb->interval));
 	return 0;
-error:
-    return ret;
 }
 
 static void pckb_remove(struct i2c_client *client)
@@ -209,17 +225,141 @@ static struct i2c_driver pckb_driver = {
 	.driver		= {
 		.name		= DRV_NAME,
 		.of_match_table = pckb_of_match,
+		.probe_type	= PROBE_PREFER_ASYNCHRONOUS,
+	},
+};
+
+/*
+ * "picocalc,mcu-keyboard": the MCU owns I2C0, polls the controller and
+ * only rings the doorbell when it pushed events. Without a doorbell in
+ * the device tree the ring is polled at the old I2C rate instead.
+ */
+static void pckb_mcu_drain(struct picocalc_keyboard *pckb)
+{
+	struct picocalc_kbd_event ev;
+
+	while (spsc_ring_read(&pckb->ring, &ev, sizeof(ev)) == sizeof(ev))
+		pckb_report(pckb, ev.state, ev.code);
+}
+
+static void pckb_mcu_doorbell(struct mbox_client *cl, void *msg)
+{
+	struct picocalc_keyboard *pckb = container_of(cl, struct picocalc_keyboard, mbox_cl);
+
+	pckb_mcu_drain(pckb);
+}
+
+static void pckb_mcu_work_handler(struct work_struct *work)
+{
+	struct picocalc_keyboard *pckb = container_of(work,
+					struct picocalc_keyboard, work.work);
+
+	pckb_mcu_drain(pckb);
+	schedule_delayed_work(&pckb->work, msecs_to_jiffies(pckb->interval));
+}
+
+static int pckb_mcu_probe(struct platform_device *pdev)
+{
+	struct picocalc_keyboard *pckb;
+	struct device *dev = &pdev->dev;
+	void *shmem_addr;
+	u32 shmem_length;
+	int ret;
+
+	pckb = devm_kzalloc(dev, sizeof(*pckb), GFP_KERNEL);
+	if (!pckb)
+		return -ENOMEM;
+
+	shmem_addr = picocalc_shm_get(PICOCALC_SHM_KEYBOARD, &shmem_length);
+	if (IS_ERR(shmem_addr))
+		return dev_err_probe(dev, PTR_ERR(shmem_addr), "No keyboard channel\n");
+	if (shmem_length < SPSC_RING_HDR_SIZE + 2 * sizeof(struct picocalc_kbd_event)) {
+		dev_err(dev, "Share memory is too small\n");
+		return -EINVAL;
+	}
+
+	pckb->interval = INTERVAL;
+	platform_set_drvdata(pdev, pckb);
+
+	ret = pckb_input_init(dev, pckb, BUS_HOST);
+	if (ret)
+		return ret;
+
+	/*
+	 * Whole events only: keep the ring an even number of events long. Set
+	 * up before the doorbell, whose callback drains the ring right away.
+	 */
+	WRITE_ONCE(((struct spsc_ring_hdr *)shmem_addr)->sync, 0);
+	spsc_ring_init(&pckb->ring, shmem_addr, SPSC_RING_HDR_SIZE +
+		       round_down(shmem_length - SPSC_RING_HDR_SIZE,
+				  sizeof(struct picocalc_kbd_event)));
+	INIT_DELAYED_WORK(&pckb->work, pckb_mcu_work_handler);
+
+	pckb->mbox_cl.dev = dev;
+	pckb->mbox_cl.rx_callback = pckb_mcu_doorbell;
+	pckb->mbox = mbox_request_channel_byname(&pckb->mbox_cl, "doorbell");
+	if (IS_ERR(pckb->mbox)) {
+		ret = PTR_ERR(pckb->mbox);
+		if (ret == -EPROBE_DEFER)
+			return ret;
+		dev_info(dev, "No MCU doorbell, polling the event ring\n");
+		pckb->mbox = NULL;
+	}
+
+	/* The MCU starts polling the controller once it sees the sync word */
+	WRITE_ONCE(pckb->ring.hdr->sync, PICOCALC_KBD_SYNC_LINUX);
+
+	if (!pckb->mbox)
+		schedule_delayed_work(&pckb->work, msecs_to_jiffies(pckb->interval));
+	return 0;
+}
+
+static int pckb_mcu_remove(struct platform_device *pdev)
+{
+	struct picocalc_keyboard *pckb = platform_get_drvdata(pdev);
+
+	/* The MCU stops polling once the sync word is gone */
+	WRITE_ONCE(pckb->ring.hdr->sync, 0);
+	if (pckb->mbox)
+		mbox_free_channel(pckb->mbox);
+	cancel_delayed_work_sync(&pckb->work);
+	return 0;
+}
+
+static const struct of_device_id pckb_mcu_of_match[] = {
+	{ .compatible = "picocalc,mcu-keyboard" },
+	{ }
+};
+MODULE_DEVICE_TABLE(of, pckb_mcu_of_match);
+
+static struct platform_driver pckb_mcu_driver = {
+	.probe		= pckb_mcu_probe,
+	.remove		= pckb_mcu_remove,
+	.driver		= {
+		.name		= DRV_NAME "-mcu",
+		.of_match_table = pckb_mcu_of_match,
+		.probe_type	= PROBE_PREFER_ASYNCHRONOUS,
 	},
 };
 
 static int __init pckb_i2c_init(void)
 {
-	return i2c_add_driver(&pckb_driver);
+	int ret;
+
+	ret = i2c_add_driver(&pckb_driver);
+	if (ret)
+		return ret;
+
+	ret = platform_driver_register(&pckb_mcu_driver);
+	if (ret)
+		i2c_del_driver(&pckb_driver);
+	return ret;
 }
 subsys_initcall(pckb_i2c_init);
 
 static void __exit pckb_i2c_exit(void)
 {
+	platform_driver_unregister(&pckb_mcu_driver);
 	i2c_del_driver(&pckb_driver);
 }
 module_exit(pckb_i2c_exit);
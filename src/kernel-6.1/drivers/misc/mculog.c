@@ -5,7 +5,6 @@
  * Copyright 2025 nekocharm <jumba.jookiba@outlook.com>
  */
 
-#include <linux/delay.h>
 #include <linux/module.h>
 #include <linux/property.h>
 #include <linux/miscdevice.h>
@@ -13,18 +12,23 @@
 #include <linux/uaccess.h>
 #include <linux/platform_device.h>
 #include <linux/of.h>
-#include <linux/of_reserved_mem.h>
 #include <linux/io.h>
+#include <linux/workqueue.h>
+#include <soc/picocalc/spsc_ring.h>
+#include <soc/picocalc/shm_table.h>
 
+#define MCULOG_SYNC_LINUX	0x4D43554C	// MCUL(MCULOG)
+#define MCULOG_SYNC_MCU		0x554C4F47	// ULOG(MCULOG)
 
-struct mculog_buffer {
-	u32 init_flag;
-	u32 max_size;
-	size_t head;
-    size_t tail;
-	u8 buf[0];
-};
-struct mculog_buffer *logbuf;
+/* How long the M0 gets to answer, checked every jiffy */
+#define MCULOG_HANDSHAKE_MS	100
+
+/* Linux is the consumer, the M0 firmware is the producer */
+static struct spsc_ring logring;
+static struct delayed_work handshake_work;
+static unsigned long handshake_timeout;
+static bool registered;
+static struct device *mculog_dev;
 
 static int mculog_open(struct inode *inode, struct file *file)
 {
@@ -38,43 +42,22 @@ static int mculog_release(struct inode *inode, struct file *file)
  
 static ssize_t mculog_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
 {
-	DEFINE_WAIT(wait);
-    size_t avail, head;
-	size_t len, to_end;
-	int ret = 0;
-
-    while (1) {
-		head = logbuf->head; // ensure head atomicity
-        avail = (head >= logbuf->tail) ? (head - logbuf->tail) : (logbuf->max_size - logbuf->tail + head);
-        if (avail > 0) {
-            break;
-        }
-		return 0;
-    }
-
-    len = min(count, avail);
-    to_end = logbuf->max_size - logbuf->tail;
-
-    if (len > to_end) {
-        if (copy_to_user(buf, logbuf->buf + logbuf->tail, to_end)) {
-            ret = -EFAULT;
-            goto out;
-        }
-        if (copy_to_user(buf + to_end, logbuf->buf, len - to_end)) {
-            ret = -EFAULT;
-            goto out;
-        }
-    } else {
-        if (copy_to_user(buf, logbuf->buf + logbuf->tail, len)) {
-            ret = -EFAULT;
-            goto out;
-        }
-    }
-
-    logbuf->tail = (logbuf->tail + len) % logbuf->max_size;
-    ret = len;
-out:
-    return ret;
+	const void *src;
+	size_t done = 0;
+	u32 len;
+
+	while (done < count) {
+		len = spsc_ring_peek(&logring, &src, 1);
+		if (!len)
+			break;
+		len = min_t(size_t, len, count - done);
+		if (copy_to_user(buf + done, src, len))
+			return done ? done : -EFAULT;
+		spsc_ring_consume(&logring, len);
+		done += len;
+	}
+
+	return done;
 }
  
 static const struct file_operations mculog_fops = {
@@ -97,74 +80,65 @@ static const struct of_device_id mculog_of_match[] = {
 };
 MODULE_DEVICE_TABLE(of, log_mcu_of_match);
 
-static int __init mculog_probe(struct platform_device *pdev)
+/*
+ * The M0 answers the handshake while it boots, which may be later than
+ * us. Wait for it from a work item, so the probe does not hold up boot.
+ */
+static void mculog_handshake(struct work_struct *work)
 {
-	struct device *dev = &pdev->dev;
-	struct reserved_mem *rmem;
-	struct device_node *np = dev->of_node;
-	struct device_node *shmem_np;
-	u32 shmem_offset, shmem_length;	
-	volatile void __iomem *shmem_addr;
-	int ret, timeout;
-
-	if (!np) {
-        dev_err(dev, "No device tree node found\n");
-        return -ENODEV;
-    }
-
-	shmem_np = of_parse_phandle(np, "memory-region", 0);
-	if (!shmem_np)
-		return -EINVAL;
-	rmem = of_reserved_mem_lookup(shmem_np);
-	of_node_put(shmem_np);
-	if (!rmem) {
-		dev_err(dev, "Unable to acquire memory-region\n");
-		return -EINVAL;
-	}
+	int ret;
 
-	if (of_property_read_u32(np, "shmem-offset", &shmem_offset)) {
-    	dev_err(dev, "Failed to read 'shmem-offset' property\n");
-    	return -EINVAL;
+	if (READ_ONCE(logring.hdr->sync) != MCULOG_SYNC_MCU) {
+		if (time_after(jiffies, handshake_timeout)) {
+			dev_err(mculog_dev, "Failed to handshake with the M0 core\n");
+			return;
+		}
+		schedule_delayed_work(&handshake_work, 1);
+		return;
 	}
-	if (of_property_read_u32(np, "shmem-length", &shmem_length)) {
-    	dev_err(dev, "Failed to read 'shmem-length' property\n");
-    	return -EINVAL;
+
+	ret = misc_register(&mculog_misc_device);
+	if (ret) {
+		dev_err(mculog_dev, "Failed to register misc device\n");
+		return;
 	}
-	if (shmem_length > rmem->size - shmem_offset) {
+	registered = true;
+}
+
+/* Not __init: it defers until the shared memory table is up */
+static int mculog_probe(struct platform_device *pdev)
+{
+	struct device *dev = &pdev->dev;
+	u32 shmem_length;
+	void *shmem_addr;
+
+	shmem_addr = picocalc_shm_get(PICOCALC_SHM_MCULOG, &shmem_length);
+	if (IS_ERR(shmem_addr))
+		return dev_err_probe(dev, PTR_ERR(shmem_addr), "No mculog channel\n");
+	if (shmem_length <= SPSC_RING_HDR_SIZE) {
 		dev_err(dev, "Share memory is too small\n");
     	return -EINVAL;
 	}
 
-	shmem_addr = devm_memremap(dev, rmem->base, rmem->size, MEMREMAP_WC);
-	logbuf = (struct mculog_buffer*)(shmem_addr + shmem_offset);
-	//logbuf = (struct mculog_buffer*)(shmem_addr + 32);
-
-	logbuf->max_size = shmem_length - sizeof(struct mculog_buffer);
-	logbuf->head = 0;
-	logbuf->tail = 0;
+	spsc_ring_init(&logring, shmem_addr, shmem_length);
 
-	logbuf->init_flag = 0x4D43554C;	// MCUL(MCULOG)
+	WRITE_ONCE(logring.hdr->sync, MCULOG_SYNC_LINUX);
 	wmb();
-	while(logbuf->init_flag != 0x554C4F47){	// ULOG(MCULOG)
-		msleep(1);
-		if(timeout++ > 100) {
-			dev_err(dev, "Failed to handshake with the M0 core\n");
-			return -ENODEV;
-		}
-	}
 
-	ret = misc_register(&mculog_misc_device);
-    if (ret) {
-        dev_err(dev, "Failed to register misc device\n");
-        return ret;
-    }
+	mculog_dev = dev;
+	handshake_timeout = jiffies + msecs_to_jiffies(MCULOG_HANDSHAKE_MS);
+	INIT_DELAYED_WORK(&handshake_work, mculog_handshake);
+	schedule_delayed_work(&handshake_work, 0);
 
 	return 0;
 }
 
 static int mculog_remove(struct platform_device *pdev)
 {
-	misc_deregister(&mculog_misc_device);
+	cancel_delayed_work_sync(&handshake_work);
+	if (registered)
+		misc_deregister(&mculog_misc_device);
+	registered = false;
     return 0;
 }
 
@@ -175,6 +149,7 @@ static struct platform_driver mculog_driver = {
         .name = "mculog_driver",
         .of_match_table = mculog_of_match,
         .owner = THIS_MODULE,
+        .probe_type = PROBE_PREFER_ASYNCHRONOUS,
     },
 };
 module_platform_driver(mculog_driver);
@@ -0,0 +1,458 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Command channel to the PicoCalc M0 firmware over RPMsg
+ *
+ * Services queue records with picocalc_mcu_queue(), which packs them into
+ * one RPMsg buffer until it is full or picocalc_mcu_flush() is called.
+ * Received buffers are split into records in place and handed to the
+ * handler registered for their type. See soc/picocalc/mcu_rpmsg.h.
+ *
+ * Also shows the MCU's interrupt profile in debugfs picocalc-mcu/stats,
+ * any write resets it. See soc/picocalc/mcu_stats.h.
+ *
+ * Copyright 2025 nekocharm <jumba.jookiba@outlook.com>
+ */
+
+#include <linux/debugfs.h>
+#include <linux/err.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/rpmsg.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <soc/picocalc/mcu_rpmsg.h>
+#include <soc/picocalc/mcu_stats.h>
+#include <soc/picocalc/shm_table.h>
+
+/* RPMsg buffer payload when the transport does not report its MTU */
+#define PICOCALC_MCU_MTU_DEFAULT	496
+
+#define PICOCALC_MCU_CAPS	(PICOCALC_CAP_SOFTPWM | PICOCALC_CAP_MCULOG | \
+				 PICOCALC_CAP_KEYBOARD | PICOCALC_CAP_PANEL)
+
+struct picocalc_mcu {
+	struct rpmsg_device *rpdev;
+	u8 *tx_buf;
+	size_t tx_size;
+	size_t tx_used;
+	u32 version;		// of the MCU, 0 until it answered HELLO
+	u32 caps;
+};
+
+/* There is one MCU. mcu_lock covers the pointer and the tx batch */
+static DEFINE_MUTEX(mcu_lock);
+static struct picocalc_mcu *mcu;
+
+static DEFINE_SPINLOCK(handler_lock);
+static struct {
+	picocalc_mcu_handler_t fn;
+	void *priv;
+} handlers[PICOCALC_MSG_MAX];
+
+static int picocalc_mcu_send(struct picocalc_mcu *m)
+{
+	int ret;
+
+	if (!m->tx_used)
+		return 0;
+
+	ret = rpmsg_send(m->rpdev->ept, m->tx_buf, m->tx_used);
+	m->tx_used = 0;
+	return ret;
+}
+
+static int __picocalc_mcu_queue(struct picocalc_mcu *m, u16 type,
+				const void *data, u16 len)
+{
+	size_t size = PICOCALC_MSG_SIZE(len);
+	struct picocalc_msg *msg;
+	int ret;
+
+	if (size > m->tx_size)
+		return -EMSGSIZE;
+
+	if (m->tx_used + size > m->tx_size) {
+		ret = picocalc_mcu_send(m);
+		if (ret)
+			return ret;
+	}
+
+	msg = (struct picocalc_msg *)(m->tx_buf + m->tx_used);
+	msg->type = type;
+	msg->len = len;
+	memcpy(msg->data, data, len);
+	memset(msg->data + len, 0, size - sizeof(*msg) - len);
+	m->tx_used += size;
+	return 0;
+}
+
+/**
+ * picocalc_mcu_queue() - add a record to the next buffer sent to the MCU
+ * @type: PICOCALC_MSG_* of a service the MCU granted
+ * @data: payload
+ * @len: payload length, at most the RPMsg MTU minus the record header
+ *
+ * May sleep. Sends the pending batch first when the record does not fit.
+ */
+int picocalc_mcu_queue(u16 type, const void *data, u16 len)
+{
+	int ret;
+
+	mutex_lock(&mcu_lock);
+	if (!mcu)
+		ret = -ENODEV;
+	else if (!mcu->version)
+		ret = -EAGAIN;
+	else
+		ret = __picocalc_mcu_queue(mcu, type, data, len);
+	mutex_unlock(&mcu_lock);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(picocalc_mcu_queue);
+
+/* Send the pending batch. May sleep */
+int picocalc_mcu_flush(void)
+{
+	int ret;
+
+	mutex_lock(&mcu_lock);
+	ret = mcu ? picocalc_mcu_send(mcu) : -ENODEV;
+	mutex_unlock(&mcu_lock);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(picocalc_mcu_flush);
+
+/* Services the MCU granted, 0 until the handshake is done */
+u32 picocalc_mcu_caps(void)
+{
+	u32 caps = 0;
+
+	mutex_lock(&mcu_lock);
+	if (mcu)
+		caps = READ_ONCE(mcu->caps);
+	mutex_unlock(&mcu_lock);
+	return caps;
+}
+EXPORT_SYMBOL_GPL(picocalc_mcu_caps);
+
+/*
+ * Call @fn for every record of @type from the MCU. Handlers run in the
+ * RPMsg receive path, must not sleep and must copy what they keep.
+ */
+int picocalc_mcu_register(u16 type, picocalc_mcu_handler_t fn, void *priv)
+{
+	unsigned long flags;
+	int ret = 0;
+
+	if (type >= PICOCALC_MSG_MAX || type == PICOCALC_MSG_HELLO)
+		return -EINVAL;
+
+	spin_lock_irqsave(&handler_lock, flags);
+	if (handlers[type].fn) {
+		ret = -EBUSY;
+	} else {
+		handlers[type].fn = fn;
+		handlers[type].priv = priv;
+	}
+	spin_unlock_irqrestore(&handler_lock, flags);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(picocalc_mcu_register);
+
+void picocalc_mcu_unregister(u16 type)
+{
+	unsigned long flags;
+
+	if (type >= PICOCALC_MSG_MAX)
+		return;
+
+	spin_lock_irqsave(&handler_lock, flags);
+	handlers[type].fn = NULL;
+	handlers[type].priv = NULL;
+	spin_unlock_irqrestore(&handler_lock, flags);
+}
+EXPORT_SYMBOL_GPL(picocalc_mcu_unregister);
+
+static void picocalc_mcu_hello(struct picocalc_mcu *m, const struct picocalc_msg *msg)
+{
+	const struct picocalc_msg_hello *hello = (const void *)msg->data;
+	struct device *dev = &m->rpdev->dev;
+
+	if (msg->len < sizeof(*hello))
+		return;
+
+	if (hello->version != PICOCALC_RPMSG_VERSION) {
+		dev_err(dev, "MCU speaks protocol v%u, expected v%u\n",
+			hello->version, PICOCALC_RPMSG_VERSION);
+		return;
+	}
+
+	WRITE_ONCE(m->caps, hello->caps & PICOCALC_MCU_CAPS);
+	WRITE_ONCE(m->version, hello->version);
+	dev_info(dev, "MCU protocol v%u, services %#x\n", hello->version, m->caps);
+}
+
+static int picocalc_mcu_cb(struct rpmsg_device *rpdev, void *data, int len,
+			   void *priv, u32 src)
+{
+	struct picocalc_mcu *m = dev_get_drvdata(&rpdev->dev);
+	const struct picocalc_msg *msg;
+	picocalc_mcu_handler_t fn;
+	unsigned long flags;
+	u32 pos = 0;
+
+	while ((msg = picocalc_msg_next(data, len, &pos))) {
+		if (msg->type == PICOCALC_MSG_HELLO) {
+			picocalc_mcu_hello(m, msg);
+			continue;
+		}
+		if (msg->type >= PICOCALC_MSG_MAX)
+			continue;
+
+		spin_lock_irqsave(&handler_lock, flags);
+		fn = handlers[msg->type].fn;
+		if (fn)
+			fn(handlers[msg->type].priv, msg->data, msg->len);
+		spin_unlock_irqrestore(&handler_lock, flags);
+	}
+	if (pos < len)
+		dev_warn_ratelimited(&rpdev->dev, "Dropped a truncated record\n");
+
+	return 0;
+}
+
+static ssize_t version_show(struct device *dev, struct device_attribute *attr,
+			    char *buf)
+{
+	struct picocalc_mcu *m = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%u\n", READ_ONCE(m->version));
+}
+static DEVICE_ATTR_RO(version);
+
+static ssize_t caps_show(struct device *dev, struct device_attribute *attr,
+			 char *buf)
+{
+	struct picocalc_mcu *m = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%#x\n", READ_ONCE(m->caps));
+}
+static DEVICE_ATTR_RO(caps);
+
+static struct attribute *picocalc_mcu_attrs[] = {
+	&dev_attr_version.attr,
+	&dev_attr_caps.attr,
+	NULL
+};
+ATTRIBUTE_GROUPS(picocalc_mcu);
+
+static int picocalc_mcu_probe(struct rpmsg_device *rpdev)
+{
+	struct picocalc_msg_hello hello = {
+		.version = PICOCALC_RPMSG_VERSION,
+		.caps = PICOCALC_MCU_CAPS,
+	};
+	struct device *dev = &rpdev->dev;
+	struct picocalc_mcu *m;
+	ssize_t mtu;
+	int ret;
+
+	m = devm_kzalloc(dev, sizeof(*m), GFP_KERNEL);
+	if (!m)
+		return -ENOMEM;
+
+	mtu = rpmsg_get_mtu(rpdev->ept);
+	m->tx_size = mtu > 0 ? mtu : PICOCALC_MCU_MTU_DEFAULT;
+	m->tx_buf = devm_kzalloc(dev, m->tx_size, GFP_KERNEL);
+	if (!m->tx_buf)
+		return -ENOMEM;
+	m->rpdev = rpdev;
+	dev_set_drvdata(dev, m);
+
+	mutex_lock(&mcu_lock);
+	if (mcu) {
+		mutex_unlock(&mcu_lock);
+		return -EBUSY;
+	}
+	ret = __picocalc_mcu_queue(m, PICOCALC_MSG_HELLO, &hello, sizeof(hello));
+	if (!ret)
+		ret = picocalc_mcu_send(m);
+	if (!ret)
+		mcu = m;
+	mutex_unlock(&mcu_lock);
+
+	if (ret)
+		dev_err(dev, "Failed to greet the MCU: %d\n", ret);
+	return ret;
+}
+
+static void picocalc_mcu_remove(struct rpmsg_device *rpdev)
+{
+	mutex_lock(&mcu_lock);
+	mcu = NULL;
+	mutex_unlock(&mcu_lock);
+}
+
+static const struct rpmsg_device_id picocalc_mcu_id_table[] = {
+	{ .name = PICOCALC_RPMSG_NAME },
+	{},
+};
+MODULE_DEVICE_TABLE(rpmsg, picocalc_mcu_id_table);
+
+static const char * const picocalc_mcu_isr_names[PICOCALC_STATS_ISRS] = {
+	[PICOCALC_STATS_SAMPLE] = "sample",
+	[PICOCALC_STATS_POLL] = "poll",
+	[PICOCALC_STATS_DOORBELL] = "doorbell",
+};
+
+static struct dentry *picocalc_mcu_debugfs;
+
+static struct picocalc_mcu_stats *picocalc_mcu_stats_get(void)
+{
+	struct picocalc_mcu_stats *stats;
+	u32 size;
+
+	stats = picocalc_shm_get(PICOCALC_SHM_STATS, &size);
+	if (!IS_ERR(stats) && size < sizeof(*stats))
+		return ERR_PTR(-EINVAL);
+	return stats;
+}
+
+static u64 picocalc_mcu_ns(u64 val, u32 hz)
+{
+	return div_u64(val * NSEC_PER_SEC, hz);
+}
+
+static int picocalc_mcu_stats_show(struct seq_file *s, void *unused)
+{
+	const struct picocalc_isr_stats *st;
+	struct picocalc_mcu_stats *stats, *snap;
+	int tries = 100, i, j;
+	u32 seq;
+
+	stats = picocalc_mcu_stats_get();
+	if (IS_ERR(stats))
+		return PTR_ERR(stats);
+
+	snap = kmalloc(sizeof(*snap), GFP_KERNEL);
+	if (!snap)
+		return -ENOMEM;
+
+	/* The MCU writes a snapshot in a few us, it never holds seq odd long */
+	do {
+		seq = READ_ONCE(stats->seq);
+		dma_rmb();
+		memcpy(snap, stats, sizeof(*snap));
+		dma_rmb();
+	} while (((seq & 1) || seq != READ_ONCE(stats->seq)) && --tries);
+
+	if (!tries || !snap->run_hz || !snap->timer_hz) {
+		seq_puts(s, "No snapshot from the MCU\n");
+		goto out;
+	}
+
+	seq_printf(s, "idle: %u.%u%% (min %u.%u%%)\n",
+		   snap->idle / 10, snap->idle % 10,
+		   snap->idle_min / 10, snap->idle_min % 10);
+	seq_puts(s, "isr        count  latency min/avg/max ns     run min/avg/max ns\n");
+	for (i = 0; i < PICOCALC_STATS_ISRS; i++) {
+		st = &snap->isr[i];
+		seq_printf(s, "%-8s %7u", picocalc_mcu_isr_names[i], st->count);
+		if (!st->count) {
+			seq_puts(s, "\n");
+			continue;
+		}
+		if (st->lat_min <= st->lat_max)
+			seq_printf(s, "  %6llu/%6llu/%6llu",
+				   picocalc_mcu_ns(st->lat_min, snap->timer_hz),
+				   picocalc_mcu_ns(div_u64(st->lat_sum, st->count), snap->timer_hz),
+				   picocalc_mcu_ns(st->lat_max, snap->timer_hz));
+		else
+			seq_printf(s, "  %20s", "-");
+		seq_printf(s, "  %6llu/%6llu/%6llu\n",
+			   picocalc_mcu_ns(st->run_min, snap->run_hz),
+			   picocalc_mcu_ns(div_u64(st->run_sum, st->count), snap->run_hz),
+			   picocalc_mcu_ns(st->run_max, snap->run_hz));
+	}
+
+	seq_puts(s, "latency histogram, ns:\n");
+	for (i = 0; i < PICOCALC_STATS_ISRS; i++) {
+		st = &snap->isr[i];
+		if (st->lat_min > st->lat_max)
+			continue;
+		seq_printf(s, "%-8s", picocalc_mcu_isr_names[i]);
+		for (j = 0; j < PICOCALC_STATS_HIST; j++) {
+			if (j < PICOCALC_STATS_HIST - 1)
+				seq_printf(s, " <%llu:%u",
+					   picocalc_mcu_ns(PICOCALC_STATS_HIST_BASE << j,
+							   snap->timer_hz),
+					   st->hist[j]);
+			else
+				seq_printf(s, " more:%u", st->hist[j]);
+		}
+		seq_puts(s, "\n");
+	}
+out:
+	kfree(snap);
+	return 0;
+}
+
+static int picocalc_mcu_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, picocalc_mcu_stats_show, NULL);
+}
+
+/* The MCU clears its counters with the next snapshot */
+static ssize_t picocalc_mcu_stats_write(struct file *file, const char __user *buf,
+					size_t count, loff_t *ppos)
+{
+	struct picocalc_mcu_stats *stats = picocalc_mcu_stats_get();
+
+	if (IS_ERR(stats))
+		return PTR_ERR(stats);
+
+	WRITE_ONCE(stats->reset, READ_ONCE(stats->reset) + 1);
+	return count;
+}
+
+static const struct file_operations picocalc_mcu_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = picocalc_mcu_stats_open,
+	.read = seq_read,
+	.write = picocalc_mcu_stats_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static struct rpmsg_driver picocalc_mcu_driver = {
+	.drv = {
+		.name = "picocalc-mcu",
+		.dev_groups = picocalc_mcu_groups,
+	},
+	.id_table = picocalc_mcu_id_table,
+	.probe = picocalc_mcu_probe,
+	.callback = picocalc_mcu_cb,
+	.remove = picocalc_mcu_remove,
+};
+
+static int __init picocalc_mcu_init(void)
+{
+	picocalc_mcu_debugfs = debugfs_create_dir("picocalc-mcu", NULL);
+	debugfs_create_file("stats", 0600, picocalc_mcu_debugfs, NULL,
+			    &picocalc_mcu_stats_fops);
+
+	return register_rpmsg_driver(&picocalc_mcu_driver);
+}
+module_init(picocalc_mcu_init);
+
+static void __exit picocalc_mcu_exit(void)
+{
+	unregister_rpmsg_driver(&picocalc_mcu_driver);
+	debugfs_remove_recursive(picocalc_mcu_debugfs);
+}
+module_exit(picocalc_mcu_exit);
+
+MODULE_DESCRIPTION("PicoCalc MCU command channel");
+MODULE_AUTHOR("nekocharm <jumba.jookiba@outlook.com>");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,217 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * remoteproc driver for the RK3506 M0
+ *
+ * U-Boot starts the M0 from the FIT image before Linux, which also sets
+ * its boot address. This driver attaches to that core and lets userspace
+ * stop it and start another raw firmware image linked for the same load
+ * address, through /sys/class/remoteproc:
+ *
+ *   echo stop > state
+ *   echo mcu-audio.bin > firmware
+ *   echo start > state
+ *
+ * The restarted firmware finds the channels it already had, see
+ * picocalc_shm_republish(). RPMsg state does not survive a restart, so
+ * the transport of picocalc,rpmsg is unbound before the core stops and
+ * bound again once the new firmware is up: it announces its channel
+ * anew and picocalc-mcu greets it with a fresh HELLO.
+ *
+ * Stopping needs the "mcu" reset. Without one, as in the PicoCalc
+ * device tree today, the driver is attach only: the remoteproc shows the
+ * core running what U-Boot started, and its state and firmware are read
+ * only.
+ *
+ * Copyright 2025 nekocharm <jumba.jookiba@outlook.com>
+ */
+
+#include <linux/err.h>
+#include <linux/firmware.h>
+#include <linux/io.h>
+#include <linux/module.h>
+#include <linux/of.h>
+#include <linux/of_platform.h>
+#include <linux/of_reserved_mem.h>
+#include <linux/platform_device.h>
+#include <linux/remoteproc.h>
+#include <linux/reset.h>
+#include <soc/picocalc/shm_table.h>
+
+struct picocalc_rproc {
+	struct device *dev;
+	struct reset_control *reset;	// NULL: cannot stop the core
+	struct device *rpmsg;		// RPMsg transport, NULL if none
+	void __iomem *mem;		// the MCU's memory-region
+	phys_addr_t mem_base;
+	size_t mem_size;
+	u32 load_addr;			// where U-Boot loads the image
+};
+
+static int picocalc_rproc_load(struct rproc *rproc, const struct firmware *fw)
+{
+	struct picocalc_rproc *pr = rproc->priv;
+	size_t offset = pr->load_addr - pr->mem_base;
+
+	if (fw->size > pr->mem_size - offset) {
+		dev_err(pr->dev, "Firmware of %zu bytes does not fit\n", fw->size);
+		return -EFBIG;
+	}
+
+	memcpy_toio(pr->mem + offset, fw->data, fw->size);
+	return 0;
+}
+
+static int picocalc_rproc_start(struct rproc *rproc)
+{
+	struct picocalc_rproc *pr = rproc->priv;
+	int ret;
+
+	if (!pr->reset)
+		return -EOPNOTSUPP;
+
+	ret = reset_control_deassert(pr->reset);
+	if (ret)
+		return ret;
+
+	ret = picocalc_shm_republish();
+	if (ret) {
+		dev_err(pr->dev, "MCU did not come up: %d\n", ret);
+		reset_control_assert(pr->reset);
+		return ret;
+	}
+
+	/* As at boot, the transport comes up after the firmware */
+	if (pr->rpmsg) {
+		ret = device_attach(pr->rpmsg);
+		if (ret <= 0)
+			dev_warn(pr->dev, "RPMsg transport not bound: %d\n", ret);
+	}
+	return 0;
+}
+
+static int picocalc_rproc_stop(struct rproc *rproc)
+{
+	struct picocalc_rproc *pr = rproc->priv;
+
+	if (!pr->reset) {
+		dev_err(pr->dev, "No MCU reset, cannot stop the core\n");
+		return -EOPNOTSUPP;
+	}
+
+	/* Takes the picocalc-mcu channel and its handshake with it */
+	if (pr->rpmsg)
+		device_release_driver(pr->rpmsg);
+
+	return reset_control_assert(pr->reset);
+}
+
+/* Nothing to do, U-Boot started the core */
+static int picocalc_rproc_attach(struct rproc *rproc)
+{
+	return 0;
+}
+
+static const struct rproc_ops picocalc_rproc_ops = {
+	.load = picocalc_rproc_load,
+	.start = picocalc_rproc_start,
+	.stop = picocalc_rproc_stop,
+	.attach = picocalc_rproc_attach,
+};
+
+static void picocalc_rproc_put_device(void *data)
+{
+	put_device(data);
+}
+
+static int picocalc_rproc_probe(struct platform_device *pdev)
+{
+	struct device *dev = &pdev->dev;
+	const char *firmware = "mcu.bin";
+	struct device_node *mem_np, *rpmsg_np;
+	struct platform_device *rpmsg_pdev;
+	struct picocalc_rproc *pr;
+	struct reserved_mem *rmem;
+	struct rproc *rproc;
+	int ret;
+
+	of_property_read_string(dev->of_node, "firmware-name", &firmware);
+	rproc = devm_rproc_alloc(dev, dev_name(dev), &picocalc_rproc_ops,
+				 firmware, sizeof(*pr));
+	if (!rproc)
+		return -ENOMEM;
+
+	pr = rproc->priv;
+	pr->dev = dev;
+
+	mem_np = of_parse_phandle(dev->of_node, "memory-region", 0);
+	if (!mem_np)
+		return -EINVAL;
+	rmem = of_reserved_mem_lookup(mem_np);
+	of_node_put(mem_np);
+	if (!rmem) {
+		dev_err(dev, "Unable to acquire memory-region\n");
+		return -EINVAL;
+	}
+	pr->mem_base = rmem->base;
+	pr->mem_size = rmem->size;
+
+	if (of_property_read_u32(dev->of_node, "picocalc,load-addr", &pr->load_addr) ||
+	    pr->load_addr < pr->mem_base ||
+	    pr->load_addr >= pr->mem_base + pr->mem_size) {
+		dev_err(dev, "Invalid 'picocalc,load-addr' property\n");
+		return -EINVAL;
+	}
+
+	pr->mem = devm_ioremap(dev, pr->mem_base, pr->mem_size);
+	if (!pr->mem)
+		return -ENOMEM;
+
+	pr->reset = devm_reset_control_get_optional_exclusive(dev, "mcu");
+	if (IS_ERR(pr->reset))
+		return dev_err_probe(dev, PTR_ERR(pr->reset), "Failed to get the MCU reset\n");
+	if (!pr->reset)
+		dev_info(dev, "No MCU reset, attach only\n");
+
+	rpmsg_np = of_parse_phandle(dev->of_node, "picocalc,rpmsg", 0);
+	if (rpmsg_np) {
+		rpmsg_pdev = of_find_device_by_node(rpmsg_np);
+		of_node_put(rpmsg_np);
+		if (!rpmsg_pdev)
+			return -EPROBE_DEFER;
+		pr->rpmsg = &rpmsg_pdev->dev;
+		ret = devm_add_action_or_reset(dev, picocalc_rproc_put_device, pr->rpmsg);
+		if (ret)
+			return ret;
+	}
+
+	/* Running the image U-Boot loaded, rproc_add() attaches to it */
+	rproc->state = RPROC_DETACHED;
+	rproc->auto_boot = true;
+	rproc->sysfs_read_only = !pr->reset;
+
+	ret = devm_rproc_add(dev, rproc);
+	if (ret)
+		return dev_err_probe(dev, ret, "Failed to register remoteproc\n");
+
+	platform_set_drvdata(pdev, rproc);
+	return 0;
+}
+
+static const struct of_device_id picocalc_rproc_of_match[] = {
+	{ .compatible = "picocalc,rk3506-mcu" },
+	{},
+};
+MODULE_DEVICE_TABLE(of, picocalc_rproc_of_match);
+
+static struct platform_driver picocalc_rproc_driver = {
+	.probe = picocalc_rproc_probe,
+	.driver = {
+		.name = "picocalc-rproc",
+		.of_match_table = picocalc_rproc_of_match,
+	},
+};
+module_platform_driver(picocalc_rproc_driver);
+
+MODULE_DESCRIPTION("PicoCalc RK3506 M0 remoteproc");
+MODULE_AUTHOR("nekocharm <jumba.jookiba@outlook.com>");
+MODULE_LICENSE("GPL");
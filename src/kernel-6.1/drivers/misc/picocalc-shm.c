@@ -0,0 +1,195 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Shared memory resource table of the PicoCalc MCU
+ *
+ * Owns shmem_reserved, places the channels listed in picocalc,channels
+ * behind the table and publishes it to the MCU. The channel drivers get
+ * their window with picocalc_shm_get(). See soc/picocalc/shm_table.h.
+ *
+ * Copyright 2025 nekocharm <jumba.jookiba@outlook.com>
+ */
+
+#include <linux/align.h>
+#include <linux/err.h>
+#include <linux/io.h>
+#include <linux/iopoll.h>
+#include <linux/module.h>
+#include <linux/of.h>
+#include <linux/of_reserved_mem.h>
+#include <linux/platform_device.h>
+#include <soc/picocalc/shm_table.h>
+
+static struct picocalc_shm_table *shm_table;
+
+/**
+ * picocalc_shm_get() - look up a shared memory channel
+ * @id: PICOCALC_SHM_*
+ * @size: returns the size granted to the channel
+ *
+ * Returns the mapped channel, ERR_PTR(-EPROBE_DEFER) before the table is
+ * published and ERR_PTR(-ENOENT) for a channel the table does not list.
+ */
+void *picocalc_shm_get(u32 id, u32 *size)
+{
+	struct picocalc_shm_table *table = READ_ONCE(shm_table);
+	const struct picocalc_shm_entry *entry;
+
+	if (!table)
+		return ERR_PTR(-EPROBE_DEFER);
+
+	entry = picocalc_shm_find(table, id);
+	if (!entry)
+		return ERR_PTR(-ENOENT);
+
+	*size = entry->size;
+	return (void *)table + entry->offset;
+}
+EXPORT_SYMBOL_GPL(picocalc_shm_get);
+
+/**
+ * picocalc_shm_republish() - publish the table to a restarted MCU
+ *
+ * Called right after the MCU left reset. Waits for the firmware to clear
+ * magic, which it does first thing, and publishes the unchanged table
+ * again with restarts bumped. Returns -ETIMEDOUT if the firmware never
+ * cleared magic.
+ */
+int picocalc_shm_republish(void)
+{
+	struct picocalc_shm_table *table = READ_ONCE(shm_table);
+	u32 magic;
+	int ret;
+
+	if (!table)
+		return -ENODEV;
+
+	ret = read_poll_timeout(READ_ONCE, magic, !magic, USEC_PER_MSEC,
+				100 * USEC_PER_MSEC, false, table->magic);
+	if (ret)
+		return ret;
+
+	table->restarts++;
+	dma_wmb();
+	WRITE_ONCE(table->magic, PICOCALC_SHM_MAGIC);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(picocalc_shm_republish);
+
+/*
+ * picocalc,channels is a list of <id size> pairs. A size of 0 takes the
+ * rest of the region, shared evenly when several channels ask for it.
+ */
+static int picocalc_shm_layout(struct device *dev, struct picocalc_shm_table *table,
+			       u32 region)
+{
+	struct device_node *np = dev->of_node;
+	u32 used = PICOCALC_SHM_TABLE_SIZE, rest = 0, id, size, offset, i;
+	int count;
+
+	count = of_property_count_u32_elems(np, "picocalc,channels");
+	if (count <= 0 || count % 2 || count / 2 > PICOCALC_SHM_MAX) {
+		dev_err(dev, "Invalid 'picocalc,channels' property\n");
+		return -EINVAL;
+	}
+	count /= 2;
+
+	for (i = 0; i < count; i++) {
+		of_property_read_u32_index(np, "picocalc,channels", 2 * i, &id);
+		of_property_read_u32_index(np, "picocalc,channels", 2 * i + 1, &size);
+		table->entry[i].id = id;
+		table->entry[i].size = ALIGN(size, PICOCALC_SHM_ALIGN);
+		if (size)
+			used += table->entry[i].size;
+		else
+			rest++;
+	}
+	if (used > region) {
+		dev_err(dev, "Channels need %u bytes, region has %u\n", used, region);
+		return -ENOSPC;
+	}
+	if (rest)
+		rest = ALIGN_DOWN((region - used) / rest, PICOCALC_SHM_ALIGN);
+
+	offset = PICOCALC_SHM_TABLE_SIZE;
+	for (i = 0; i < count; i++) {
+		if (!table->entry[i].size)
+			table->entry[i].size = rest;
+		if (!table->entry[i].size) {
+			dev_err(dev, "No room left for channel %u\n", table->entry[i].id);
+			return -ENOSPC;
+		}
+		table->entry[i].offset = offset;
+		offset += table->entry[i].size;
+		dev_dbg(dev, "channel %u: %#x bytes at %#x\n", table->entry[i].id,
+			table->entry[i].size, table->entry[i].offset);
+	}
+	table->count = count;
+	return 0;
+}
+
+static int picocalc_shm_probe(struct platform_device *pdev)
+{
+	struct device *dev = &pdev->dev;
+	struct picocalc_shm_table *table;
+	struct device_node *shmem_np;
+	struct reserved_mem *rmem;
+	int ret;
+
+	shmem_np = of_parse_phandle(dev->of_node, "memory-region", 0);
+	if (!shmem_np)
+		return -EINVAL;
+	rmem = of_reserved_mem_lookup(shmem_np);
+	of_node_put(shmem_np);
+	if (!rmem) {
+		dev_err(dev, "Unable to acquire memory-region\n");
+		return -EINVAL;
+	}
+	if (rmem->size <= PICOCALC_SHM_TABLE_SIZE) {
+		dev_err(dev, "Share memory is too small\n");
+		return -EINVAL;
+	}
+
+	table = devm_memremap(dev, rmem->base, rmem->size, MEMREMAP_WC);
+	if (IS_ERR(table))
+		return PTR_ERR(table);
+
+	WRITE_ONCE(table->magic, 0);
+	memset(table->entry, 0, sizeof(table->entry));
+	ret = picocalc_shm_layout(dev, table, rmem->size);
+	if (ret)
+		return ret;
+	table->version = PICOCALC_SHM_VERSION;
+	table->size = rmem->size;
+	table->restarts = 0;
+
+	dma_wmb();
+	WRITE_ONCE(table->magic, PICOCALC_SHM_MAGIC);
+	WRITE_ONCE(shm_table, table);
+	return 0;
+}
+
+static const struct of_device_id picocalc_shm_of_match[] = {
+	{ .compatible = "picocalc,shm-table" },
+	{},
+};
+MODULE_DEVICE_TABLE(of, picocalc_shm_of_match);
+
+static struct platform_driver picocalc_shm_driver = {
+	.probe = picocalc_shm_probe,
+	.driver = {
+		.name = "picocalc-shm",
+		.of_match_table = picocalc_shm_of_match,
+		.suppress_bind_attrs = true,
+	},
+};
+
+static int __init picocalc_shm_init(void)
+{
+	return platform_driver_register(&picocalc_shm_driver);
+}
+/* before the channel drivers, so they rarely have to defer */
+subsys_initcall(picocalc_shm_init);
+
+MODULE_DESCRIPTION("PicoCalc MCU shared memory table");
+MODULE_AUTHOR("nekocharm <jumba.jookiba@outlook.com>");
+MODULE_LICENSE("GPL");
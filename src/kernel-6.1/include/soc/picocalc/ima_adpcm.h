@@ -0,0 +1,107 @@
+/* SPDX-License-Identifier: (GPL-2.0+ OR BSD-3-Clause) */
+/*
+ * IMA ADPCM (4 bits per sample) shared by the softpwm encoder in Linux and
+ * the decoder in the MCU timer path.
+ *
+ * Both sides run the very same ima_adpcm_update() on the same nibbles, so
+ * the predictors stay bit exact without any block headers as long as the
+ * stream is lossless, which the sample ring is. Only shifts and adds: the
+ * M0 has no divider.
+ *
+ * Used by sound/pwm/picocalc-softpwm.c and the MCU firmware
+ * (hal/project/rk3506-mcu/src/ima_adpcm.h is a link to this file).
+ *
+ * Copyright 2025 nekocharm <jumba.jookiba@outlook.com>
+ */
+
+#ifndef __SOC_PICOCALC_IMA_ADPCM_H
+#define __SOC_PICOCALC_IMA_ADPCM_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdint.h>
+#endif
+
+struct ima_adpcm {
+	int32_t pred;
+	int32_t index;
+};
+
+static const uint16_t ima_adpcm_step[89] = {
+	7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+	19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+	50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+	130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+	337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+	876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+	2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+	5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+	15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+static const int8_t ima_adpcm_index[8] = {
+	-1, -1, -1, -1, 2, 4, 6, 8
+};
+
+static inline void ima_adpcm_reset(struct ima_adpcm *st)
+{
+	st->pred = 0;
+	st->index = 0;
+}
+
+/* Apply @nibble to the predictor, returns the new sample */
+static inline int32_t ima_adpcm_update(struct ima_adpcm *st, uint32_t nibble)
+{
+	int32_t step = ima_adpcm_step[st->index];
+	int32_t diff = step >> 3;
+
+	if (nibble & 4)
+		diff += step;
+	if (nibble & 2)
+		diff += step >> 1;
+	if (nibble & 1)
+		diff += step >> 2;
+
+	st->pred += (nibble & 8) ? -diff : diff;
+	if (st->pred > 32767)
+		st->pred = 32767;
+	else if (st->pred < -32768)
+		st->pred = -32768;
+
+	st->index += ima_adpcm_index[nibble & 7];
+	if (st->index < 0)
+		st->index = 0;
+	else if (st->index > 88)
+		st->index = 88;
+
+	return st->pred;
+}
+
+/* Encode @sample, returns the nibble (bit 3 is the sign) */
+static inline uint32_t ima_adpcm_encode(struct ima_adpcm *st, int32_t sample)
+{
+	int32_t step = ima_adpcm_step[st->index];
+	int32_t diff = sample - st->pred;
+	uint32_t nibble = 0;
+
+	if (diff < 0) {
+		nibble = 8;
+		diff = -diff;
+	}
+	if (diff >= step) {
+		nibble |= 4;
+		diff -= step;
+	}
+	if (diff >= step >> 1) {
+		nibble |= 2;
+		diff -= step >> 1;
+	}
+	if (diff >= step >> 2)
+		nibble |= 1;
+
+	ima_adpcm_update(st, nibble);
+	return nibble;
+}
+
+#endif /* __SOC_PICOCALC_IMA_ADPCM_H */
@@ -0,0 +1,45 @@
+/* SPDX-License-Identifier: (GPL-2.0+ OR BSD-3-Clause) */
+/*
+ * PicoCalc keyboard events pushed by the MCU.
+ *
+ * With the PICOCALC_SHM_KEYBOARD channel in the resource table, the M0
+ * owns the keyboard controller on I2C0. It drains the controller FIFO
+ * every few ms, drops events that do not change a key's state and appends
+ * the rest to an spsc_ring in the channel, then rings the keyboard
+ * doorbell once per batch. Linux consumes the ring from the doorbell, so
+ * the A7s are not woken up while nobody types.
+ *
+ * Linux initialises the ring and writes PICOCALC_KBD_SYNC_LINUX to its
+ * sync word, the MCU attaches and answers PICOCALC_KBD_SYNC_MCU. It only
+ * touches I2C0 from then on and stops again when Linux clears the word.
+ *
+ * Used by drivers/input/keyboard/picocalc-keyboard.c and the MCU firmware
+ * (hal/project/rk3506-mcu/src/keyboard.h is a link to this file).
+ *
+ * Copyright 2025 nekocharm <jumba.jookiba@outlook.com>
+ */
+
+#ifndef __SOC_PICOCALC_KEYBOARD_H
+#define __SOC_PICOCALC_KEYBOARD_H
+
+#include "spsc_ring.h"
+
+#define PICOCALC_KBD_SYNC_LINUX		0x4b42444c	// KBDL
+#define PICOCALC_KBD_SYNC_MCU		0x4b42444d	// KBDM
+
+/* Doorbell command sent by the MCU after appending events */
+#define PICOCALC_KBD_DOORBELL		0x4b424445	// KBDE
+
+/* Keyboard controller FIFO register and the states it reports */
+#define PICOCALC_KBD_REG_FIFO		0x09
+#define PICOCALC_KBD_IDLE		0	/* FIFO empty */
+#define PICOCALC_KBD_PRESSED		1
+#define PICOCALC_KBD_HOLD		2
+#define PICOCALC_KBD_RELEASED		3
+
+struct picocalc_kbd_event {
+	uint8_t state;		/* PICOCALC_KBD_PRESSED or _RELEASED */
+	uint8_t code;		/* controller key code */
+};
+
+#endif /* __SOC_PICOCALC_KEYBOARD_H */
@@ -0,0 +1,117 @@
+/* SPDX-License-Identifier: (GPL-2.0+ OR BSD-3-Clause) */
+/*
+ * Command channel between Linux and the RK3506 M0 core over RPMsg.
+ *
+ * The MCU announces the PICOCALC_RPMSG_NAME endpoint once the vdev is up.
+ * Linux opens with a HELLO carrying its protocol version and the services
+ * it wants, the MCU answers with its own version and the services it has.
+ * Services only start talking once both sides agreed on a version, so a
+ * new service is a new capability bit and a few record types rather than
+ * another carve-out of the shared memory.
+ *
+ * One RPMsg buffer carries one or more records back to back, so a burst of
+ * small commands costs a single mailbox kick. The MCU builds and parses the
+ * records in place in the vring buffers. Bulk streams (the softpwm samples,
+ * the MCU log) keep their own rings in shmem_reserved.
+ *
+ * Used by drivers/misc/picocalc-mcu.c and the MCU firmware
+ * (hal/project/rk3506-mcu/src/mcu_rpmsg.h is a link to this file).
+ *
+ * Copyright 2025 nekocharm <jumba.jookiba@outlook.com>
+ */
+
+#ifndef __SOC_PICOCALC_MCU_RPMSG_H
+#define __SOC_PICOCALC_MCU_RPMSG_H
+
+#ifdef __KERNEL__
+#include <linux/errno.h>
+#include <linux/types.h>
+#else
+#include <stdint.h>
+#endif
+
+#define PICOCALC_RPMSG_NAME		"picocalc-mcu"
+#define PICOCALC_RPMSG_MCU_ADDR		0x4d43		// MC
+
+/* Bumped on incompatible changes of the records below */
+#define PICOCALC_RPMSG_VERSION		1
+
+/* Services, negotiated by HELLO */
+#define PICOCALC_CAP_SOFTPWM		(1u << 0)
+#define PICOCALC_CAP_MCULOG		(1u << 1)
+#define PICOCALC_CAP_KEYBOARD		(1u << 2)
+#define PICOCALC_CAP_PANEL		(1u << 3)
+
+/* Record types, types below PICOCALC_MSG_MAX can get a handler */
+#define PICOCALC_MSG_HELLO		0x0001	/* struct picocalc_msg_hello, both ways */
+#define PICOCALC_MSG_PANEL_FLUSH	0x0002	/* panel.h, Linux -> MCU */
+#define PICOCALC_MSG_PANEL_DONE		0x0003	/* panel.h, MCU -> Linux */
+#define PICOCALC_MSG_MAX		32
+
+struct picocalc_msg {
+	uint16_t type;
+	uint16_t len;		/* payload bytes following the header */
+	uint8_t data[];
+};
+
+struct picocalc_msg_hello {
+	uint32_t version;	/* PICOCALC_RPMSG_VERSION of the sender */
+	uint32_t caps;		/* Linux: wanted, MCU: granted */
+};
+
+/* Records start 4 byte aligned */
+#define PICOCALC_MSG_SIZE(len) \
+	((sizeof(struct picocalc_msg) + (len) + 3) & ~3u)
+
+/*
+ * Next record of @buf from @pos on, NULL at the end or at a record that
+ * does not fit, so a corrupt length never walks off the buffer.
+ */
+static inline const struct picocalc_msg *
+picocalc_msg_next(const void *buf, uint32_t size, uint32_t *pos)
+{
+	const struct picocalc_msg *msg;
+
+	if (*pos >= size || size - *pos < sizeof(*msg))
+		return 0;
+
+	msg = (const struct picocalc_msg *)((const uint8_t *)buf + *pos);
+	if (msg->len > size - *pos - sizeof(*msg))
+		return 0;
+
+	*pos += PICOCALC_MSG_SIZE(msg->len);
+	return msg;
+}
+
+#ifdef __KERNEL__
+/* Linux side service API, see drivers/misc/picocalc-mcu.c */
+typedef void (*picocalc_mcu_handler_t)(void *priv, const void *data, u16 len);
+
+#if IS_ENABLED(CONFIG_PICOCALC_MCU)
+int picocalc_mcu_register(u16 type, picocalc_mcu_handler_t fn, void *priv);
+void picocalc_mcu_unregister(u16 type);
+int picocalc_mcu_queue(u16 type, const void *data, u16 len);
+int picocalc_mcu_flush(void);
+u32 picocalc_mcu_caps(void);
+#else
+static inline int picocalc_mcu_register(u16 type, picocalc_mcu_handler_t fn, void *priv)
+{
+	return -ENODEV;
+}
+static inline void picocalc_mcu_unregister(u16 type) {}
+static inline int picocalc_mcu_queue(u16 type, const void *data, u16 len)
+{
+	return -ENODEV;
+}
+static inline int picocalc_mcu_flush(void)
+{
+	return -ENODEV;
+}
+static inline u32 picocalc_mcu_caps(void)
+{
+	return 0;
+}
+#endif
+#endif
+
+#endif /* __SOC_PICOCALC_MCU_RPMSG_H */
@@ -0,0 +1,70 @@
+/* SPDX-License-Identifier: (GPL-2.0+ OR BSD-3-Clause) */
+/*
+ * MCU interrupt and idle profile, the PICOCALC_SHM_STATS channel.
+ *
+ * The MCU stamps its interrupt handlers on entry and exit with a free
+ * running timer (SysTick belongs to the HAL tick) and, for the timer
+ * interrupts, reads how far the timer has run past its expiry. It sums these up in its own RAM and snapshots them into this
+ * block every PICOCALC_STATS_WINDOW_MS, together with the time it spent
+ * in WFI over that window. seq is odd while a snapshot is written.
+ *
+ * Linux asks for a reset by bumping reset; the MCU clears its counters at
+ * the next snapshot and copies the value to reset_ack.
+ *
+ * Read by drivers/misc/picocalc-mcu.c (debugfs picocalc-mcu/stats) and
+ * written by the MCU firmware (hal/project/rk3506-mcu/src/mcu_stats.h is
+ * a link to this file).
+ *
+ * Copyright 2025 nekocharm <jumba.jookiba@outlook.com>
+ */
+
+#ifndef __SOC_PICOCALC_MCU_STATS_H
+#define __SOC_PICOCALC_MCU_STATS_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdint.h>
+#endif
+
+#define PICOCALC_STATS_WINDOW_MS	500
+
+/* Profiled interrupts */
+#define PICOCALC_STATS_SAMPLE		0	/* softpwm sample/edge timer */
+#define PICOCALC_STATS_POLL		1	/* poll timer */
+#define PICOCALC_STATS_DOORBELL		2	/* mailbox doorbell, no latency */
+#define PICOCALC_STATS_ISRS		3
+
+/*
+ * Latency histogram, log2 buckets of timer ticks: bucket 0 counts entries
+ * less than PICOCALC_STATS_HIST_BASE ticks late, bucket n less than
+ * PICOCALC_STATS_HIST_BASE << n, the last one everything later.
+ */
+#define PICOCALC_STATS_HIST		8
+#define PICOCALC_STATS_HIST_BASE	8
+
+struct picocalc_isr_stats {
+	uint32_t count;
+	uint32_t lat_min;	/* timer ticks from expiry to entry */
+	uint32_t lat_max;
+	uint32_t run_min;	/* run_hz ticks from entry to exit */
+	uint32_t run_max;
+	uint32_t __pad;
+	uint64_t lat_sum;
+	uint64_t run_sum;
+	uint32_t hist[PICOCALC_STATS_HIST];
+};
+
+struct picocalc_mcu_stats {
+	uint32_t seq;		/* odd while the MCU writes a snapshot */
+	uint32_t reset;		/* bumped by Linux */
+	uint32_t reset_ack;	/* last reset the MCU did */
+	uint32_t run_hz;	/* 0 until the first snapshot */
+	uint32_t timer_hz;
+	uint32_t idle;		/* per-mille of the last window spent in WFI */
+	uint32_t idle_min;	/* lowest window since the reset */
+	uint32_t __pad;
+	struct picocalc_isr_stats isr[PICOCALC_STATS_ISRS];
+};
+
+#endif /* __SOC_PICOCALC_MCU_STATS_H */
@@ -0,0 +1,53 @@
+/* SPDX-License-Identifier: (GPL-2.0+ OR BSD-3-Clause) */
+/*
+ * Panel flushes run by the MCU, the PICOCALC_CAP_PANEL service of the
+ * command channel (see mcu_rpmsg.h).
+ *
+ * Linux posts the damaged rectangle of an RGB565 framebuffer as a FLUSH
+ * record with the physical address of its first pixel. The MCU sends
+ * CASET/PASET/RAMWR on SPI0 and clocks the lines out as 16 bit words, so
+ * the little endian pixels go out big endian without a byte swap. It
+ * answers with a DONE record once its queue ran empty; until then Linux
+ * keeps the framebuffer alive and does not touch SPI0 itself.
+ *
+ * The MCU reads the pixels over its own bus, which sees DDR at the same
+ * addresses as the A7s (the shared memory at 0x3c00000 is reached that
+ * way), except for the first 32 KB where its SRAM is mapped for it, see
+ * mcu_reserved in the device tree and GCC/gcc_bus_m0.ld. So a flush must
+ * lie in [PICOCALC_PANEL_ADDR_MIN, PICOCALC_PANEL_ADDR_END) physically,
+ * which ili9488.c checks per flush; it also refuses buffers behind an
+ * IOMMU, whose DMA addresses mean nothing to the MCU.
+ *
+ * Used by drivers/gpu/drm/tiny/ili9488.c and the MCU firmware
+ * (hal/project/rk3506-mcu/src/panel.h is a link to this file).
+ *
+ * Copyright 2025 nekocharm <jumba.jookiba@outlook.com>
+ */
+
+#ifndef __SOC_PICOCALC_PANEL_H
+#define __SOC_PICOCALC_PANEL_H
+
+#include "mcu_rpmsg.h"
+
+/* Physical window the MCU can read a flush from, see above */
+#define PICOCALC_PANEL_ADDR_MIN		0x8000ULL
+#define PICOCALC_PANEL_ADDR_END		0x100000000ULL
+
+/* Flushes the MCU queues, a power of two. Linux keeps one in flight */
+#define PICOCALC_PANEL_QUEUE		2
+
+/* PICOCALC_MSG_PANEL_FLUSH, Linux -> MCU */
+struct picocalc_panel_flush {
+	uint32_t seq;
+	uint32_t addr;		/* of pixel (x1, y1), RGB565 */
+	uint32_t pitch;		/* bytes from one line to the next */
+	uint16_t x1, y1;	/* panel window, inclusive */
+	uint16_t x2, y2;
+};
+
+/* PICOCALC_MSG_PANEL_DONE, MCU -> Linux */
+struct picocalc_panel_done {
+	uint32_t seq;		/* of the last flush that went out */
+};
+
+#endif /* __SOC_PICOCALC_PANEL_H */
@@ -0,0 +1,78 @@
+/* SPDX-License-Identifier: (GPL-2.0+ OR BSD-3-Clause) */
+/*
+ * Resource table at the start of shmem_reserved.
+ *
+ * Linux (drivers/misc/picocalc-shm.c) lays out the channels at boot from
+ * the sizes they ask for, each starting on its own cache line, writes the
+ * table and publishes it by writing magic last. The MCU clears magic when
+ * it starts, waits for it and then looks its channels up by id, so the
+ * offsets exist in exactly one place.
+ *
+ * When Linux restarts the MCU (drivers/misc/picocalc-rproc.c) the layout
+ * stays as it is. Linux waits for the new firmware to clear magic, bumps
+ * restarts and publishes the table again; a non-zero restarts tells the
+ * firmware that the channels are still set up from its last run, so it
+ * attaches to rings whose sync word already carries its own answer.
+ *
+ * Used by the Linux drivers and the MCU firmware
+ * (hal/project/rk3506-mcu/src/shm_table.h is a link to this file).
+ *
+ * Copyright 2025 nekocharm <jumba.jookiba@outlook.com>
+ */
+
+#ifndef __SOC_PICOCALC_SHM_TABLE_H
+#define __SOC_PICOCALC_SHM_TABLE_H
+
+#include "spsc_ring.h"
+
+#define PICOCALC_SHM_MAGIC		0x50435354	// PCST
+#define PICOCALC_SHM_VERSION		2
+
+/* Channels start on their own cache line, no false sharing between them */
+#define PICOCALC_SHM_ALIGN		SPSC_RING_CACHELINE
+#define PICOCALC_SHM_MAX		8
+
+/* Channel ids, also used in the picocalc,channels property */
+#define PICOCALC_SHM_SOFTPWM		1
+#define PICOCALC_SHM_MCULOG		2
+#define PICOCALC_SHM_KEYBOARD		3
+#define PICOCALC_SHM_STATS		4
+
+struct picocalc_shm_entry {
+	uint32_t id;
+	uint32_t offset;	/* from the table, PICOCALC_SHM_ALIGN aligned */
+	uint32_t size;
+	uint32_t __pad;
+};
+
+struct picocalc_shm_table {
+	uint32_t magic;		/* written last by Linux */
+	uint32_t version;
+	uint32_t size;		/* of the whole region */
+	uint32_t count;
+	uint32_t restarts;	/* MCU restarts since Linux booted */
+	uint32_t __pad0[3];
+	struct picocalc_shm_entry entry[PICOCALC_SHM_MAX];
+	uint8_t __pad[3 * SPSC_RING_CACHELINE - 8 * sizeof(uint32_t) -
+		      PICOCALC_SHM_MAX * sizeof(struct picocalc_shm_entry)];
+};
+
+#define PICOCALC_SHM_TABLE_SIZE		sizeof(struct picocalc_shm_table)
+
+static inline const struct picocalc_shm_entry *
+picocalc_shm_find(const struct picocalc_shm_table *table, uint32_t id)
+{
+	uint32_t i, count = SPSC_RING_LOAD(table->count);
+
+	for (i = 0; i < count && i < PICOCALC_SHM_MAX; i++)
+		if (table->entry[i].id == id)
+			return &table->entry[i];
+	return 0;
+}
+
+#ifdef __KERNEL__
+void *picocalc_shm_get(u32 id, u32 *size);
+int picocalc_shm_republish(void);
+#endif
+
+#endif /* __SOC_PICOCALC_SHM_TABLE_H */
@@ -0,0 +1,78 @@
+/* SPDX-License-Identifier: (GPL-2.0+ OR BSD-3-Clause) */
+/*
+ * Shared memory layout of the PicoCalc soft PWM audio channel.
+ *
+ * Linux streams PWM duty values into the sample ring, the M0 timer pulls
+ * one frame per sample tick and rings the doorbell every period_frames.
+ * Used by sound/pwm/picocalc-softpwm.c and the MCU firmware
+ * (hal/project/rk3506-mcu/src/softpwm.h is a link to this file).
+ *
+ * Copyright 2025 nekocharm <jumba.jookiba@outlook.com>
+ */
+
+#ifndef __SOC_PICOCALC_SOFTPWM_H
+#define __SOC_PICOCALC_SOFTPWM_H
+
+#include "spsc_ring.h"
+#include "ima_adpcm.h"
+
+/*
+ * The MCU Timers' frequency is 24 MHz. Linux picks pwm_period (timer ticks
+ * per carrier cycle) and carrier_per_sample for the stream rate, e.g. at
+ * 8 kHz: 64 kHz carrier, pwm_period = 24 MHz / 64 kHz = 375, 8 cycles per
+ * sample.
+ */
+#define SOFTPWM_TIMER_HZ		24000000
+
+/* Valid duty values are 1 ~ pwm_period - 1, 0 would stall the edge timer */
+#define SOFTPWM_DUTY_MIN		1
+
+#define SOFTPWM_STATE_STOP		0
+#define SOFTPWM_STATE_RUN		1
+
+/* Doorbell command sent by the MCU when a period has been played */
+#define SOFTPWM_DOORBELL_PERIOD		0x50574d50	// PWMP
+
+/*
+ * Doorbell command sent by Linux after changing state. The MCU sleeps in
+ * WFI between events and only polls shm at a low rate as a fallback.
+ */
+#define SOFTPWM_DOORBELL_STATE		0x50574d53	// PWMS
+
+/*
+ * Ring encodings. DUTY16: one softpwm_sample_t duty per channel and frame.
+ * IMA_ADPCM: one 4-bit IMA ADPCM nibble per channel and frame (low nibble
+ * first, a stereo frame is one byte, a mono byte holds two frames) coding
+ * (duty - pwm_period / 2) << SOFTPWM_ADPCM_SHIFT, see ima_adpcm.h.
+ */
+#define SOFTPWM_ENCODING_DUTY16		0
+#define SOFTPWM_ENCODING_IMA_ADPCM	1
+
+#define SOFTPWM_ADPCM_SHIFT		7
+
+/* One ring sample: a duty value, a frame holds one per channel */
+typedef uint16_t softpwm_sample_t;
+
+struct softpwm_shm {
+	/* written by Linux */
+	uint32_t state;
+	uint32_t period_frames;
+	uint32_t pwm_period;
+	uint32_t carrier_per_sample;
+	uint32_t channels;		/* 1 or 2, interleaved L/R in the ring */
+	uint32_t encoding;		/* SOFTPWM_ENCODING_* */
+	uint8_t __pad0[SPSC_RING_CACHELINE - 6 * sizeof(uint32_t)];
+	/* written by the MCU */
+	uint32_t mcu_state;
+	uint32_t frames;		/* free running count of sample ticks, kept over restarts */
+	uint32_t underruns;		/* of those, ticks that found the ring empty */
+	uint32_t mcu_load;		/* timer ISR share of the M0, per-mille */
+	uint32_t mcu_load_max;		/* highest mcu_load since the MCU booted */
+	uint8_t __pad1[SPSC_RING_CACHELINE - 5 * sizeof(uint32_t)];
+	/* Linux -> MCU samples, must stay last */
+	struct spsc_ring_hdr ring;
+};
+
+#define SOFTPWM_SHM_HDR_SIZE	sizeof(struct softpwm_shm)
+
+#endif /* __SOC_PICOCALC_SOFTPWM_H */
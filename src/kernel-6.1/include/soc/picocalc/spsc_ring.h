@@ -0,0 +1,249 @@
+/* SPDX-License-Identifier: (GPL-2.0+ OR BSD-3-Clause) */
+/*
+ * Single-producer/single-consumer byte ring living in the memory shared
+ * between the Linux A7 cores and the RK3506 M0 core.
+ *
+ * This header is used unchanged by the kernel drivers, by the MCU firmware
+ * (hal/project/rk3506-mcu/src/spsc_ring.h is a link to this file) and by
+ * host tools, so it only depends on fixed-width integer types and memcpy.
+ *
+ * Copyright 2025 nekocharm <jumba.jookiba@outlook.com>
+ */
+
+#ifndef __SOC_PICOCALC_SPSC_RING_H
+#define __SOC_PICOCALC_SPSC_RING_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/string.h>
+#include <linux/compiler.h>
+#include <asm/barrier.h>
+#else
+#include <stdint.h>
+#include <string.h>
+#endif
+
+/*
+ * Cortex-A7 cache line size. The producer index, the consumer index and the
+ * read-only ring description each get a line of their own so that neither
+ * side ever writes into a line the other side is writing.
+ */
+#define SPSC_RING_CACHELINE	64
+
+/*
+ * Index accessors and barriers.
+ *
+ * The M0 is not part of the A7 inner shareable domain, so the kernel side
+ * has to use the DMA flavour of the barriers rather than the smp_* ones.
+ * The producer publishes data before the head index (release), the consumer
+ * reads the head index before the data (acquire) and finishes reading the
+ * data before it publishes the tail index (release).
+ */
+#if defined(__KERNEL__)
+#define SPSC_RING_LOAD(x)	READ_ONCE(x)
+#define SPSC_RING_STORE(x, v)	WRITE_ONCE(x, v)
+#define SPSC_RING_ACQUIRE()	dma_rmb()
+#define SPSC_RING_RELEASE_W()	dma_wmb()
+#define SPSC_RING_RELEASE_R()	mb()
+#elif defined(__CORTEX_M)
+#define SPSC_RING_LOAD(x)	(*(volatile uint32_t *)&(x))
+#define SPSC_RING_STORE(x, v)	(*(volatile uint32_t *)&(x) = (v))
+#define SPSC_RING_ACQUIRE()	__DMB()
+#define SPSC_RING_RELEASE_W()	__DMB()
+#define SPSC_RING_RELEASE_R()	__DMB()
+#else
+#define SPSC_RING_LOAD(x)	__atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define SPSC_RING_STORE(x, v)	__atomic_store_n(&(x), v, __ATOMIC_RELAXED)
+#define SPSC_RING_ACQUIRE()	__atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define SPSC_RING_RELEASE_W()	__atomic_thread_fence(__ATOMIC_RELEASE)
+#define SPSC_RING_RELEASE_R()	__atomic_thread_fence(__ATOMIC_SEQ_CST)
+#endif
+
+/*
+ * Shared layout. "size" is the size of data[] in bytes; one byte is always
+ * left empty so that head == tail means empty. Indices stay in [0, size)
+ * and wrap by subtraction, so the M0 (which has no divider) never needs a
+ * modulo and the size does not have to be a power of two.
+ */
+struct spsc_ring_hdr {
+	uint32_t head;		/* written by the producer only */
+	uint8_t __pad0[SPSC_RING_CACHELINE - sizeof(uint32_t)];
+	uint32_t tail;		/* written by the consumer only */
+	uint8_t __pad1[SPSC_RING_CACHELINE - sizeof(uint32_t)];
+	uint32_t size;		/* written once by spsc_ring_init() */
+	uint32_t sync;		/* free for the users' handshake */
+	uint8_t __pad2[SPSC_RING_CACHELINE - 2 * sizeof(uint32_t)];
+	uint8_t data[];
+};
+
+#define SPSC_RING_HDR_SIZE	sizeof(struct spsc_ring_hdr)
+
+/*
+ * Private per-side handle. Each side keeps its own index locally and a
+ * cached copy of the peer index, which is only re-read from shared memory
+ * when the cached value says the ring is full (producer) or empty
+ * (consumer). This keeps uncached reads off the fast path.
+ */
+struct spsc_ring {
+	struct spsc_ring_hdr *hdr;
+	uint8_t *data;
+	uint32_t size;
+	uint32_t head;
+	uint32_t tail;
+};
+
+/*
+ * Format @mem (@len bytes) as an empty ring. Done by one side only. @mem
+ * should be SPSC_RING_CACHELINE aligned for the index separation to hold.
+ */
+static inline void spsc_ring_init(struct spsc_ring *r, void *mem, uint32_t len)
+{
+	r->hdr = (struct spsc_ring_hdr *)mem;
+	r->data = r->hdr->data;
+	r->size = len - SPSC_RING_HDR_SIZE;
+	r->head = 0;
+	r->tail = 0;
+
+	SPSC_RING_STORE(r->hdr->head, 0);
+	SPSC_RING_STORE(r->hdr->tail, 0);
+	SPSC_RING_STORE(r->hdr->size, r->size);
+	SPSC_RING_RELEASE_W();
+}
+
+/* Open a ring previously formatted by the other side. */
+static inline void spsc_ring_attach(struct spsc_ring *r, void *mem)
+{
+	r->hdr = (struct spsc_ring_hdr *)mem;
+	r->data = r->hdr->data;
+	r->size = SPSC_RING_LOAD(r->hdr->size);
+	r->head = SPSC_RING_LOAD(r->hdr->head);
+	r->tail = SPSC_RING_LOAD(r->hdr->tail);
+	SPSC_RING_ACQUIRE();
+}
+
+static inline uint32_t spsc_ring_wrap(const struct spsc_ring *r, uint32_t idx)
+{
+	return idx >= r->size ? idx - r->size : idx;
+}
+
+static inline uint32_t __spsc_ring_used(const struct spsc_ring *r)
+{
+	return r->head >= r->tail ? r->head - r->tail : r->size - r->tail + r->head;
+}
+
+/* Producer: bytes that can be written right now. */
+static inline uint32_t spsc_ring_space(struct spsc_ring *r)
+{
+	r->tail = SPSC_RING_LOAD(r->hdr->tail);
+	return r->size - 1 - __spsc_ring_used(r);
+}
+
+/* Consumer: bytes that can be read right now. */
+static inline uint32_t spsc_ring_used(struct spsc_ring *r)
+{
+	r->head = SPSC_RING_LOAD(r->hdr->head);
+	SPSC_RING_ACQUIRE();
+	return __spsc_ring_used(r);
+}
+
+/*
+ * Producer zero-copy API: spsc_ring_reserve() returns the number of bytes
+ * that can be written contiguously at *@ptr (at least @want if possible),
+ * spsc_ring_commit() publishes @n of them.
+ */
+static inline uint32_t spsc_ring_reserve(struct spsc_ring *r, void **ptr,
+					 uint32_t want)
+{
+	uint32_t space = r->size - 1 - __spsc_ring_used(r);
+	uint32_t to_end = r->size - r->head;
+
+	if (space < want)
+		space = spsc_ring_space(r);
+
+	*ptr = r->data + r->head;
+	return space < to_end ? space : to_end;
+}
+
+static inline void spsc_ring_commit(struct spsc_ring *r, uint32_t n)
+{
+	r->head = spsc_ring_wrap(r, r->head + n);
+	SPSC_RING_RELEASE_W();
+	SPSC_RING_STORE(r->hdr->head, r->head);
+}
+
+/*
+ * Consumer zero-copy API: spsc_ring_peek() returns the number of bytes that
+ * can be read contiguously at *@ptr, spsc_ring_consume() releases @n of them
+ * back to the producer.
+ */
+static inline uint32_t spsc_ring_peek(struct spsc_ring *r, const void **ptr,
+				      uint32_t want)
+{
+	uint32_t used = __spsc_ring_used(r);
+	uint32_t to_end = r->size - r->tail;
+
+	if (used < want)
+		used = spsc_ring_used(r);
+
+	*ptr = r->data + r->tail;
+	return used < to_end ? used : to_end;
+}
+
+static inline void spsc_ring_consume(struct spsc_ring *r, uint32_t n)
+{
+	r->tail = spsc_ring_wrap(r, r->tail + n);
+	SPSC_RING_RELEASE_R();
+	SPSC_RING_STORE(r->hdr->tail, r->tail);
+}
+
+/* Batch copy in. Returns the number of bytes written, possibly short. */
+static inline uint32_t spsc_ring_write(struct spsc_ring *r, const void *src,
+				       uint32_t len)
+{
+	const uint8_t *p = (const uint8_t *)src;
+	uint32_t space = r->size - 1 - __spsc_ring_used(r);
+	uint32_t to_end;
+
+	if (space < len)
+		space = spsc_ring_space(r);
+	if (len > space)
+		len = space;
+
+	to_end = r->size - r->head;
+	if (len > to_end) {
+		memcpy(r->data + r->head, p, to_end);
+		memcpy(r->data, p + to_end, len - to_end);
+	} else {
+		memcpy(r->data + r->head, p, len);
+	}
+
+	spsc_ring_commit(r, len);
+	return len;
+}
+
+/* Batch copy out. Returns the number of bytes read, possibly short. */
+static inline uint32_t spsc_ring_read(struct spsc_ring *r, void *dst,
+				      uint32_t len)
+{
+	uint8_t *p = (uint8_t *)dst;
+	uint32_t used = __spsc_ring_used(r);
+	uint32_t to_end;
+
+	if (used < len)
+		used = spsc_ring_used(r);
+	if (len > used)
+		len = used;
+
+	to_end = r->size - r->tail;
+	if (len > to_end) {
+		memcpy(p, r->data + r->tail, to_end);
+		memcpy(p + to_end, r->data, len - to_end);
+	} else {
+		memcpy(p, r->data + r->tail, len);
+	}
+
+	spsc_ring_consume(r, len);
+	return len;
+}
+
+#endif /* __SOC_PICOCALC_SPSC_RING_H */
@@ -11,110 +11,589 @@
 #include <linux/io.h>
 #include <linux/platform_device.h>
 #include <linux/of.h>
-#include <linux/of_reserved_mem.h>
 #include <linux/hrtimer.h>
+#include <linux/iopoll.h>
+#include <linux/mailbox_client.h>
 #include <sound/core.h>
 #include <sound/initval.h>
 #include <sound/pcm.h>
+#include <sound/info.h>
+#include <sound/control.h>
+#include <sound/tlv.h>
+#include <soc/picocalc/softpwm.h>
+#include <soc/picocalc/shm_table.h>
 
-/* 
- * DEFAULT_PERIOD/DEFAULT_PWM_PERIOD
- * The MCU Timers' frequency is 24 MHz
- * The PWM's frequency is 64 kHz
- * The Sample rate is 8 kHz, so each sample has 8 cycles
- * DEFAULT_PERIOD = 1 / 8 kHz = 125000 ns
- * DEFAULT_PWM_PERIOD = 24 MHz / 64 kHz = 375
+/*
+ * The sample clock lives on the MCU: it pulls one frame per sample tick
+ * from the ring in shared memory and rings the doorbell once per period.
+ * Linux refills the ring on doorbells, a fixed lead ahead of the play
+ * position as a DMA engine would read. Without a doorbell mailbox in the
+ * device tree, a period rate hrtimer takes its place. The same mailbox channel wakes the MCU
+ * up when Linux starts or stops the stream.
+ */
+
+/* Same layout as the Rockchip mailbox controller's message */
+struct softpwm_mbox_msg {
+	u32 cmd;
+	u32 data;
+};
+
+/* How many periods the ring may run ahead of the MCU */
+#define SOFTPWM_LEAD_PERIODS	2
+
+/*
+ * IMA ADPCM packs 4x the frames of 16 bit duties into the ring. By default
+ * it is used when SOFTPWM_LEAD_PERIODS periods of duties would not fit.
+ */
+static int adpcm = -1;
+module_param(adpcm, int, 0644);
+MODULE_PARM_DESC(adpcm, "Ring encoding: 0 = 16 bit duties, 1 = IMA ADPCM, -1 = auto (default)");
+
+/*
+ * Carrier settings per sample rate. The carrier has to be a whole number
+ * of cycles per sample, so the 44.1 kHz family runs at 363 ticks (66.1 kHz)
+ * and plays 0.05% slow, which the MCU driven pointer reports faithfully.
+ * 32/44.1/48 kHz are accepted as is and decimated 2:1 while filling the
+ * ring, so applications can open hw directly; 48 kHz plays 0.1% fast.
+ */
+struct softpwm_rate {
+	unsigned int rate;
+	u32 pwm_period;
+	u32 carrier_per_sample;
+	u32 dec_shift;		// log2 of the decimation factor
+};
+
+static const struct softpwm_rate softpwm_rates[] = {
+	{  8000, 375, 8, 0 },
+	{ 11025, 363, 6, 0 },
+	{ 16000, 375, 4, 0 },
+	{ 22050, 363, 3, 0 },
+	{ 32000, 375, 4, 1 },
+	{ 44100, 363, 3, 1 },
+	{ 48000, 333, 3, 1 },
+};
+
+/*
+ * Master volume in percent, up to +6 dB of gain. The default makes up
+ * for the +5 dB RetroArch used to add in software.
  */
-#define DEFAULT_PERIOD (125000)
-#define DEFAULT_PWM_PERIOD (375)
+#define SOFTPWM_VOLUME_UNITY	100
+#define SOFTPWM_VOLUME_MAX	200
+#define SOFTPWM_VOLUME_DEFAULT	178
+
+static const DECLARE_TLV_DB_LINEAR(softpwm_volume_tlv, TLV_DB_GAIN_MUTE, 602);
+
+/*
+ * 2:1 decimation filter: 23 tap half-band FIR (Kaiser window, beta 6).
+ * Flat to 0.25 fs, -6 dB at the new Nyquist, -52 dB at 0.33 fs where the
+ * first aliases would land at 0.17 fs. Only the odd taps next to the
+ * centre are non-zero, listed from the centre out in Q14; the centre tap
+ * is 1/2.
+ */
+#define SOFTPWM_HB_TAPS		23
+#define SOFTPWM_HB_SHIFT	14
+
+static const s16 softpwm_hb_coef[] = { 5097, -1413, 575, -217, 61, -7 };
 
-struct softpwm_config {
-	u32 left_duty; // 0~374, 0 and 375 for stop, use 0 to implement mute
-	u32 right_duty;
+/* Delay line of one channel, stored twice so a window never wraps */
+struct softpwm_hb {
+	s32 x[2 * SOFTPWM_HB_TAPS];
+	u32 pos;
 };
 
+/* Duty LUT resolution: 256 steps over the full input scale, Q16 duty */
+#define SOFTPWM_LUT_SIZE	256
+#define SOFTPWM_LUT_SHIFT	16
+
 struct softpwm_sound {
     struct platform_device *pdev;
 	struct snd_card *snd_card;
 	struct snd_pcm_substream *substream;
 	struct hrtimer timer;
+	struct mbox_client mbox_cl;
+	struct mbox_chan *mbox;
+	struct softpwm_mbox_msg mbox_msg;	// Linux -> MCU, must outlive the send
 	spinlock_t lock;
-	u32 data_ptr;
-	u32 period_ptr;
+	snd_pcm_uframes_t pushed;	// in appl_ptr units
+	u32 pushed_frames;		// frames pushed since start, as softpwm_played()
+	u32 frames_base;		// shm->frames at trigger start
+	u32 period_count;		// periods reported so far
 	u32 channels;
+	snd_pcm_format_t format;
+	const struct softpwm_rate *rate;
+	u32 lut[SOFTPWM_LUT_SIZE + 1];
+	u32 volume;
+	u32 mute;
+	u32 ns_err[2];			// noise shaping error per channel, Q16
+	struct softpwm_hb hb[2];	// decimation filter per channel
+	u32 adpcm;			// ring carries IMA ADPCM instead of duties
+	struct ima_adpcm adpcm_st[2];
+	s32 adpcm_nibble;		// mono: first nibble of an incomplete byte, or -1
 	u32 is_on;
-    struct softpwm_config *softpwm;
+	struct softpwm_shm *shm;
+	u32 shm_length;
+	struct spsc_ring ring;
+	/* statistics, see /proc/asound/cardX/softpwm */
+	u32 underruns_base;		// shm->underruns at probe
+	u32 xruns;
+	u32 late_periods;		// handled more than half a period late
+	u32 max_lateness_us;
 };
 
-enum hrtimer_restart softpwm_hrtimer_callback(struct hrtimer *t)
+/*
+ * lut[i] is the Q16 duty for an unsigned 16 bit level of i * 256, with the
+ * master volume and mute folded in, so gain costs nothing per sample. The
+ * top entry stays just below the last duty step so that adding the noise
+ * shaping error never rounds past pwm_period - 1. Called with the lock
+ * held once the rate is known.
+ */
+static void softpwm_build_lut(struct softpwm_sound *softpwm_snd)
 {
-	struct softpwm_sound *softpwm_snd = container_of(t, struct softpwm_sound, timer);
-	u32 buffer_size, period_size;
-	u32 period_elapsed = 0;
-	u8 *data;
+	u32 lo = SOFTPWM_DUTY_MIN << SOFTPWM_LUT_SHIFT;
+	u32 span = ((softpwm_snd->rate->pwm_period - 1 - SOFTPWM_DUTY_MIN) << SOFTPWM_LUT_SHIFT) - 1;
+	s32 gain = softpwm_snd->mute ? 0 : softpwm_snd->volume;
+	s32 level;
+	int i;
+
+	for (i = 0; i <= SOFTPWM_LUT_SIZE; i++) {
+		level = (i * 256 - 32768) * gain / SOFTPWM_VOLUME_UNITY;
+		level = clamp(level, -32768, 32768) + 32768;
+		softpwm_snd->lut[i] = lo + (u32)div_u64((u64)span * level, 65536);
+	}
+}
 
-	
+/*
+ * Map an unsigned 16 bit level to a Q16 duty: LUT lookup on the high byte,
+ * linear interpolation on the low byte.
+ */
+static inline u32 softpwm_lut(const u32 *lut, u16 level)
+{
+	u32 hi = level >> 8, lo = level & 0xff;
 
-	if (!softpwm_snd->is_on)
-		return HRTIMER_NORESTART;
+	return lut[hi] + (((lut[hi + 1] - lut[hi]) * lo) >> 8);
+}
 
-	data = softpwm_snd->substream->runtime->dma_area;
-	buffer_size = softpwm_snd->substream->runtime->buffer_size;
-	period_size = softpwm_snd->substream->runtime->period_size;
-	if (++softpwm_snd->data_ptr >= buffer_size)
-		softpwm_snd->data_ptr = 0;
-
-	// The audio bit width is 8 bit (0~255)
-	// The range of left_duty and right_duty is 0~374
-	// We need map 0~255 to 0~374
-	// TODO: Stereo channel can't work
-	switch (softpwm_snd->channels) {
-	case 1: //Mono
-		softpwm_snd->softpwm->left_duty = (u32)data[softpwm_snd->data_ptr] * (u32)(DEFAULT_PWM_PERIOD - 1) / 255;
-		softpwm_snd->softpwm->right_duty = (u32)data[softpwm_snd->data_ptr] * (u32)(DEFAULT_PWM_PERIOD - 1) / 255;
-		break;
-	case 2: //Stereo
-		softpwm_snd->softpwm->left_duty = (u32)data[softpwm_snd->data_ptr] * (u32)(DEFAULT_PWM_PERIOD - 1) / 255;
-		softpwm_snd->softpwm->right_duty = (u32)data[softpwm_snd->data_ptr++] * (u32)(DEFAULT_PWM_PERIOD - 1) / 255;
-		break;
+/*
+ * Map an unsigned 16 bit level to a duty value, with first order noise
+ * shaping (error feedback) of the quantisation to the integer duty.
+ */
+static inline softpwm_sample_t softpwm_duty(const u32 *lut, u32 *err, u16 level)
+{
+	u32 v = softpwm_lut(lut, level) + *err;
+
+	*err = v & ((1 << SOFTPWM_LUT_SHIFT) - 1);
+	return v >> SOFTPWM_LUT_SHIFT;
+}
+
+/* Sample @i of @src as an unsigned 16 bit level */
+static inline u32 softpwm_level(snd_pcm_format_t format, const void *src,
+				snd_pcm_uframes_t i)
+{
+	if (format == SNDRV_PCM_FORMAT_S16_LE)
+		return (u16)le16_to_cpu(((const __le16 *)src)[i]) ^ 0x8000;
+	// Replicate the byte so that 0xff maps to full scale
+	return ((const u8 *)src)[i] * 0x101;
+}
+
+static inline void softpwm_hb_push(struct softpwm_hb *hb, s32 v)
+{
+	hb->x[hb->pos] = v;
+	hb->x[hb->pos + SOFTPWM_HB_TAPS] = v;
+	if (++hb->pos == SOFTPWM_HB_TAPS)
+		hb->pos = 0;
+}
+
+/*
+ * Level of ring frame @i of channel @c at decimated rates: input frames
+ * 2i and 2i + 1 go into the half-band filter, one output comes out.
+ */
+static u32 softpwm_decimate(struct softpwm_sound *softpwm_snd, const void *src,
+			    snd_pcm_uframes_t i, u32 c)
+{
+	struct softpwm_hb *hb = &softpwm_snd->hb[c];
+	snd_pcm_format_t format = softpwm_snd->format;
+	u32 ch = softpwm_snd->channels;
+	const s32 *x, *mid;
+	s32 acc;
+	int k;
+
+	softpwm_hb_push(hb, (s32)softpwm_level(format, src, 2 * i * ch + c) - 32768);
+	softpwm_hb_push(hb, (s32)softpwm_level(format, src, (2 * i + 1) * ch + c) - 32768);
+
+	// Oldest to newest sample at x[0] ~ x[SOFTPWM_HB_TAPS - 1]
+	x = hb->x + hb->pos;
+	mid = x + SOFTPWM_HB_TAPS / 2;
+	acc = mid[0] * (1 << (SOFTPWM_HB_SHIFT - 1));
+	for (k = 0; k < ARRAY_SIZE(softpwm_hb_coef); k++)
+		acc += softpwm_hb_coef[k] * (mid[-2 * k - 1] + mid[2 * k + 1]);
+	acc = (acc + (1 << (SOFTPWM_HB_SHIFT - 1))) >> SOFTPWM_HB_SHIFT;
+
+	return clamp(acc, -32768, 32767) + 32768;
+}
+
+/*
+ * Convert @frames ring frames. Interleaved samples, each channel keeps its
+ * own shaping error; decimated rates filter 2 input frames per ring frame.
+ */
+static void softpwm_convert(struct softpwm_sound *softpwm_snd, softpwm_sample_t *dst,
+			    const void *src, snd_pcm_uframes_t frames)
+{
+	const u32 *lut = softpwm_snd->lut;
+	snd_pcm_format_t format = softpwm_snd->format;
+	u32 *err = softpwm_snd->ns_err;
+	u32 ch = softpwm_snd->channels;
+	u32 dec_shift = softpwm_snd->rate->dec_shift;
+	snd_pcm_uframes_t i, n = frames * ch;
+	u32 c;
+
+	if (!dec_shift) {
+		for (i = 0; i < n; i++)
+			dst[i] = softpwm_duty(lut, &err[i & (ch - 1)], softpwm_level(format, src, i));
+		return;
 	}
 
-	if (++softpwm_snd->period_ptr >= period_size) {
-		softpwm_snd->period_ptr = 0;
-		period_elapsed = 1;
+	for (i = 0; i < frames; i++, dst += ch)
+		for (c = 0; c < ch; c++)
+			dst[c] = softpwm_duty(lut, &err[c], softpwm_decimate(softpwm_snd, src, i, c));
+}
+
+/*
+ * IMA ADPCM variant of softpwm_convert(). The ADPCM quantiser takes the
+ * place of the noise shaping, so the Q16 duty goes in unrounded. Returns
+ * the ring bytes written; an odd mono frame waits for its partner nibble.
+ */
+static u32 softpwm_encode(struct softpwm_sound *softpwm_snd, u8 *dst,
+			  const void *src, snd_pcm_uframes_t frames)
+{
+	const u32 *lut = softpwm_snd->lut;
+	snd_pcm_format_t format = softpwm_snd->format;
+	u32 ch = softpwm_snd->channels;
+	u32 dec_shift = softpwm_snd->rate->dec_shift;
+	s32 mid = softpwm_snd->rate->pwm_period << (SOFTPWM_ADPCM_SHIFT - 1);
+	snd_pcm_uframes_t i;
+	u32 c, level, nibble, bytes = 0;
+	s32 x;
+
+	for (i = 0; i < frames; i++) {
+		for (c = 0; c < ch; c++) {
+			if (dec_shift)
+				level = softpwm_decimate(softpwm_snd, src, i, c);
+			else
+				level = softpwm_level(format, src, i * ch + c);
+
+			x = (softpwm_lut(lut, level) >> (SOFTPWM_LUT_SHIFT - SOFTPWM_ADPCM_SHIFT)) - mid;
+			nibble = ima_adpcm_encode(&softpwm_snd->adpcm_st[c], x);
+
+			if (softpwm_snd->adpcm_nibble < 0) {
+				softpwm_snd->adpcm_nibble = nibble;
+			} else {
+				dst[bytes++] = softpwm_snd->adpcm_nibble | nibble << 4;
+				softpwm_snd->adpcm_nibble = -1;
+			}
+		}
+	}
+	return bytes;
+}
+
+/* Ring frames held by @bytes of ring */
+static inline u32 softpwm_ring_frames(struct softpwm_sound *softpwm_snd, u32 bytes)
+{
+	if (softpwm_snd->adpcm)
+		return bytes << (2 - softpwm_snd->channels);
+	return bytes / (softpwm_snd->channels * sizeof(softpwm_sample_t));
+}
+
+/* Played frames since start, in ALSA frames */
+static u32 softpwm_played(struct softpwm_sound *softpwm_snd)
+{
+	return (READ_ONCE(softpwm_snd->shm->frames) - softpwm_snd->frames_base)
+		<< softpwm_snd->rate->dec_shift;
+}
+
+/*
+ * ALSA frames per ring unit: decimated rates take input frames in pairs,
+ * a mono ADPCM byte holds two ring frames.
+ */
+static inline u32 softpwm_step(struct softpwm_sound *softpwm_snd)
+{
+	u32 step = 1 << softpwm_snd->rate->dec_shift;
+
+	if (softpwm_snd->adpcm && softpwm_snd->channels == 1)
+		step <<= 1;
+	return step;
+}
+
+static void softpwm_advance(struct softpwm_sound *softpwm_snd, u32 n)
+{
+	struct snd_pcm_runtime *runtime = softpwm_snd->substream->runtime;
+
+	softpwm_snd->pushed_frames += n;
+	softpwm_snd->pushed += n;
+	if (softpwm_snd->pushed >= runtime->boundary)
+		softpwm_snd->pushed -= runtime->boundary;
+}
+
+/*
+ * Mono ADPCM: complete a byte still waiting for its second nibble with a
+ * silent one, so that its frame gets played. The pad counts as pushed.
+ */
+static void softpwm_flush_nibble(struct softpwm_sound *softpwm_snd)
+{
+	struct ima_adpcm *st = &softpwm_snd->adpcm_st[0];
+	u8 byte;
+
+	if (softpwm_snd->adpcm_nibble < 0)
+		return;
+
+	byte = softpwm_snd->adpcm_nibble | ima_adpcm_encode(st, st->pred) << 4;
+	if (spsc_ring_write(&softpwm_snd->ring, &byte, 1) != 1)
+		return;
+	softpwm_snd->adpcm_nibble = -1;
+	softpwm_advance(softpwm_snd, 1 << softpwm_snd->rate->dec_shift);
+}
+
+/*
+ * A draining mono ADPCM stream can end on an odd ring frame, whose byte
+ * has no second nibble coming. Encode it and pad the byte with a silent
+ * nibble, so the last frame is played too.
+ */
+static void softpwm_drain_tail(struct softpwm_sound *softpwm_snd)
+{
+	struct snd_pcm_runtime *runtime = softpwm_snd->substream->runtime;
+	u32 frame = 1 << softpwm_snd->rate->dec_shift;
+	snd_pcm_sframes_t left;
+	void *src;
+	u8 none;
+
+	if (!softpwm_snd->adpcm || softpwm_snd->channels != 1)
+		return;
+
+	left = runtime->control->appl_ptr - softpwm_snd->pushed;
+	if (left < 0)
+		left += runtime->boundary;
+	if (left < frame || left >= 2 * frame || !spsc_ring_space(&softpwm_snd->ring))
+		return;
+
+	src = runtime->dma_area + frames_to_bytes(runtime, softpwm_snd->pushed % runtime->buffer_size);
+	softpwm_encode(softpwm_snd, &none, src, 1);
+	softpwm_advance(softpwm_snd, frame);
+	softpwm_flush_nibble(softpwm_snd);
+}
+
+/*
+ * Keep the sample ring SOFTPWM_LEAD_PERIODS ahead of the MCU, reading the
+ * buffer from the play position on whatever appl_ptr says, as DMA would.
+ * dmix never moves the slave's appl_ptr, it mixes into the buffer ahead
+ * of hw_ptr and silences what has been played. Frames in the ring can no
+ * longer change, the rest of the buffer is left for dmix to mix into.
+ * Only a draining stream stops at appl_ptr, so nothing past its end is
+ * played.
+ */
+static void softpwm_refill(struct softpwm_sound *softpwm_snd)
+{
+	struct snd_pcm_runtime *runtime = softpwm_snd->substream->runtime;
+	snd_pcm_sframes_t avail, left;
+	u32 frame_bytes = softpwm_snd->channels * sizeof(softpwm_sample_t);
+	u32 dec_shift = softpwm_snd->rate->dec_shift;
+	snd_pcm_uframes_t pos, n, queued, lead;
+	u32 space, bytes, step = softpwm_step(softpwm_snd);
+	s32 lag;
+	void *p, *src;
+
+	/*
+	 * The MCU keeps counting frames through an underrun, as DMA would.
+	 * What it played as silence is skipped, so the ring stays in step with
+	 * the pointer. The ring is empty then, a pending nibble goes out first.
+	 */
+	lag = softpwm_played(softpwm_snd) - softpwm_snd->pushed_frames;
+	if (lag > 0) {
+		softpwm_flush_nibble(softpwm_snd);
+		lag = softpwm_played(softpwm_snd) - softpwm_snd->pushed_frames;
+		if (lag > 0)
+			softpwm_advance(softpwm_snd, round_up(lag, step));
+	}
+
+	space = spsc_ring_space(&softpwm_snd->ring);
+	queued = softpwm_ring_frames(softpwm_snd, softpwm_snd->ring.size - 1 - space) << dec_shift;
+	lead = SOFTPWM_LEAD_PERIODS * runtime->period_size;
+	if (queued >= lead)
+		return;
+	avail = lead - queued;
+
+	if (runtime->status->state == SNDRV_PCM_STATE_DRAINING) {
+		left = runtime->control->appl_ptr - softpwm_snd->pushed;
+		if (left < 0)
+			left += runtime->boundary;
+		// Already pushed past appl_ptr before the drain began
+		if (left > runtime->buffer_size)
+			left = 0;
+		avail = min(avail, left);
+	}
+	// Only whole ring units
+	avail = round_down(avail, step);
+
+	if (softpwm_snd->adpcm)
+		frame_bytes = 1;
+
+	while (avail > 0) {
+		space = spsc_ring_reserve(&softpwm_snd->ring, &p, frame_bytes);
+		n = softpwm_ring_frames(softpwm_snd, space) << dec_shift;
+		if (!n)
+			break;
+
+		pos = softpwm_snd->pushed % runtime->buffer_size;
+		n = min3(n, (snd_pcm_uframes_t)avail, runtime->buffer_size - pos);
+		src = runtime->dma_area + frames_to_bytes(runtime, pos);
+		if (softpwm_snd->adpcm) {
+			bytes = softpwm_encode(softpwm_snd, p, src, n >> dec_shift);
+		} else {
+			softpwm_convert(softpwm_snd, p, src, n >> dec_shift);
+			bytes = (n >> dec_shift) * frame_bytes;
+		}
+		spsc_ring_commit(&softpwm_snd->ring, bytes);
+
+		softpwm_advance(softpwm_snd, n);
+		avail -= n;
+	}
+
+	if (avail <= 0 && runtime->status->state == SNDRV_PCM_STATE_DRAINING)
+		softpwm_drain_tail(softpwm_snd);
+}
+
+static void softpwm_update(struct softpwm_sound *softpwm_snd)
+{
+	struct snd_pcm_runtime *runtime;
+	unsigned long flags;
+	u32 played, periods, late;
+
+	spin_lock_irqsave(&softpwm_snd->lock, flags);
+	if (!softpwm_snd->is_on) {
+		spin_unlock_irqrestore(&softpwm_snd->lock, flags);
+		return;
+	}
+	runtime = softpwm_snd->substream->runtime;
+	softpwm_refill(softpwm_snd);
+	played = softpwm_played(softpwm_snd);
+	periods = played / runtime->period_size;
+	if (periods == softpwm_snd->period_count) {
+		periods = 0;
+	} else {
+		softpwm_snd->period_count = periods;
+		// How far the MCU got past the period boundary before we ran
+		late = played - periods * runtime->period_size;
+		if (late > runtime->period_size / 2)
+			softpwm_snd->late_periods++;
+		late = div_u64((u64)late * USEC_PER_SEC, runtime->rate);
+		if (late > softpwm_snd->max_lateness_us)
+			softpwm_snd->max_lateness_us = late;
 	}
+	spin_unlock_irqrestore(&softpwm_snd->lock, flags);
 
-	if (period_elapsed)
+	if (periods)
 		snd_pcm_period_elapsed(softpwm_snd->substream);
+}
+
+static void softpwm_doorbell(struct mbox_client *cl, void *msg)
+{
+	struct softpwm_sound *softpwm_snd = container_of(cl, struct softpwm_sound, mbox_cl);
+
+	softpwm_update(softpwm_snd);
+}
+
+enum hrtimer_restart softpwm_hrtimer_callback(struct hrtimer *t)
+{
+	struct softpwm_sound *softpwm_snd = container_of(t, struct softpwm_sound, timer);
+	struct snd_pcm_runtime *runtime;
+
+	if (!softpwm_snd->is_on)
+		return HRTIMER_NORESTART;
+
+	softpwm_update(softpwm_snd);
 
-	hrtimer_forward_now(t, ktime_set(0, DEFAULT_PERIOD));
+	runtime = softpwm_snd->substream->runtime;
+	hrtimer_forward_now(t, ns_to_ktime(div_u64((u64)runtime->period_size * NSEC_PER_SEC,
+						   runtime->rate)));
 
 	return HRTIMER_RESTART;
 }
 
+/* Wake the MCU up after a state change, it falls back to polling anyway */
+static void softpwm_kick(struct softpwm_sound *softpwm_snd)
+{
+	int ret;
+
+	if (!softpwm_snd->mbox)
+		return;
+
+	ret = mbox_send_message(softpwm_snd->mbox, &softpwm_snd->mbox_msg);
+	if (ret < 0)
+		dev_warn_ratelimited(&softpwm_snd->pdev->dev,
+				     "MCU doorbell failed: %d\n", ret);
+}
+
 static int softpwm_enable(struct softpwm_sound *softpwm_snd)
 {
-    softpwm_snd->timer.function = &softpwm_hrtimer_callback;
-    hrtimer_start(&softpwm_snd->timer, ktime_set(0, DEFAULT_PERIOD), HRTIMER_MODE_REL);
+	struct snd_pcm_runtime *runtime = softpwm_snd->substream->runtime;
+
+	softpwm_snd->frames_base = READ_ONCE(softpwm_snd->shm->frames);
+	softpwm_snd->period_count = 0;
+	// The pointer starts from hw_ptr, which prepare has just reset
+	softpwm_snd->pushed = runtime->status->hw_ptr;
+	softpwm_snd->pushed_frames = 0;
+	softpwm_refill(softpwm_snd);
+
+	WRITE_ONCE(softpwm_snd->shm->period_frames,
+		   runtime->period_size >> softpwm_snd->rate->dec_shift);
+	WRITE_ONCE(softpwm_snd->shm->pwm_period, softpwm_snd->rate->pwm_period);
+	WRITE_ONCE(softpwm_snd->shm->carrier_per_sample, softpwm_snd->rate->carrier_per_sample);
+	WRITE_ONCE(softpwm_snd->shm->channels, softpwm_snd->channels);
+	WRITE_ONCE(softpwm_snd->shm->encoding, softpwm_snd->adpcm ?
+		   SOFTPWM_ENCODING_IMA_ADPCM : SOFTPWM_ENCODING_DUTY16);
+	wmb();
+	WRITE_ONCE(softpwm_snd->shm->state, SOFTPWM_STATE_RUN);
+	softpwm_kick(softpwm_snd);
+
+	if (!softpwm_snd->mbox) {
+		softpwm_snd->timer.function = &softpwm_hrtimer_callback;
+		hrtimer_start(&softpwm_snd->timer,
+			      ns_to_ktime(div_u64((u64)runtime->period_size * NSEC_PER_SEC,
+						  runtime->rate)),
+			      HRTIMER_MODE_REL);
+	}
 
-    return 0;
+	return 0;
 }
 
 static void softpwm_disable(struct softpwm_sound *softpwm_snd)
 {
-    softpwm_snd->softpwm->left_duty = 0;
-	softpwm_snd->softpwm->right_duty = 0;
+	WRITE_ONCE(softpwm_snd->shm->state, SOFTPWM_STATE_STOP);
+	wmb();
+	softpwm_kick(softpwm_snd);
 }
 
 static int softpwm_pcm_hw_params(struct snd_pcm_substream *substream,
 		struct snd_pcm_hw_params *hw_params)
 {
 	struct softpwm_sound *softpwm_snd = snd_pcm_substream_chip(substream);
-	if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK) {
-		softpwm_snd->channels = params_channels(hw_params);
-		return 0;
-	}
-    return -EINVAL;
+	unsigned long flags;
+	int i;
+
+	if (substream->stream != SNDRV_PCM_STREAM_PLAYBACK)
+		return -EINVAL;
+
+	for (i = 0; i < ARRAY_SIZE(softpwm_rates); i++)
+		if (softpwm_rates[i].rate == params_rate(hw_params))
+			break;
+	if (i == ARRAY_SIZE(softpwm_rates))
+		return -EINVAL;
+
+	spin_lock_irqsave(&softpwm_snd->lock, flags);
+	softpwm_snd->rate = &softpwm_rates[i];
+	softpwm_snd->channels = params_channels(hw_params);
+	softpwm_snd->format = params_format(hw_params);
+	softpwm_build_lut(softpwm_snd);
+	spin_unlock_irqrestore(&softpwm_snd->lock, flags);
+	return 0;
 }
 
 static int softpwm_pcm_hw_free(struct snd_pcm_substream *substream)
@@ -126,16 +605,21 @@ static const struct snd_pcm_hardware softpwm_pcm_playback_hw = {
 	.info				= (SNDRV_PCM_INFO_MMAP |
 						   SNDRV_PCM_INFO_MMAP_VALID |
 						   SNDRV_PCM_INFO_INTERLEAVED |
-						   SNDRV_PCM_INFO_HALF_DUPLEX),
-	.formats			= SNDRV_PCM_FMTBIT_U8,
-	.rates				= SNDRV_PCM_RATE_8000,
+						   SNDRV_PCM_INFO_HALF_DUPLEX |
+						   SNDRV_PCM_INFO_NO_REWINDS |
+						   SNDRV_PCM_INFO_HAS_LINK_ATIME),
+	.formats			= SNDRV_PCM_FMTBIT_U8 | SNDRV_PCM_FMTBIT_S16_LE,
+	.rates				= SNDRV_PCM_RATE_8000 | SNDRV_PCM_RATE_11025 |
+						  SNDRV_PCM_RATE_16000 | SNDRV_PCM_RATE_22050 |
+						  SNDRV_PCM_RATE_32000 | SNDRV_PCM_RATE_44100 |
+						  SNDRV_PCM_RATE_48000,
 	.rate_min			= 8000,
-	.rate_max			= 8000,
+	.rate_max			= 48000,
 	.channels_min		= 1,
-	.channels_max		= 1, //TODO Stereo channel can't work
-	.buffer_bytes_max	= 8 * 1024,
+	.channels_max		= 2,
+	.buffer_bytes_max	= 32 * 1024,
 	.period_bytes_min	= 4,
-	.period_bytes_max	= 4 * 1024,
+	.period_bytes_max	= 16 * 1024,
 	.periods_min		= 4,
 	.periods_max		= 1024,
 };
@@ -146,6 +630,10 @@ static int softpwm_pcm_open(struct snd_pcm_substream *substream)
 
 	substream->runtime->hw = softpwm_pcm_playback_hw;
 	softpwm_snd->substream = substream;
+
+	// Decimated rates consume input frames in pairs
+	snd_pcm_hw_constraint_step(substream->runtime, 0, SNDRV_PCM_HW_PARAM_PERIOD_SIZE, 2);
+	snd_pcm_hw_constraint_step(substream->runtime, 0, SNDRV_PCM_HW_PARAM_BUFFER_SIZE, 2);
 	return 0;
 }
 
@@ -156,6 +644,33 @@ static int softpwm_pcm_close(struct snd_pcm_substream *substream)
 
 static int softpwm_pcm_prepare(struct snd_pcm_substream *substream)
 {
+	struct softpwm_sound *softpwm_snd = snd_pcm_substream_chip(substream);
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	u32 state, duty_bytes;
+	int ret;
+
+	if (substream->runtime->status->state == SNDRV_PCM_STATE_XRUN)
+		softpwm_snd->xruns++;
+
+	// The MCU does not touch the ring any more once it reports stop
+	ret = read_poll_timeout(READ_ONCE, state, state == SOFTPWM_STATE_STOP,
+				100, 10000, false, softpwm_snd->shm->mcu_state);
+	if (ret) {
+		dev_err(&softpwm_snd->pdev->dev, "MCU did not stop\n");
+		return ret;
+	}
+
+	spsc_ring_init(&softpwm_snd->ring, &softpwm_snd->shm->ring,
+		       softpwm_snd->shm_length - offsetof(struct softpwm_shm, ring));
+	memset(softpwm_snd->ns_err, 0, sizeof(softpwm_snd->ns_err));
+	memset(softpwm_snd->hb, 0, sizeof(softpwm_snd->hb));
+
+	duty_bytes = SOFTPWM_LEAD_PERIODS * (runtime->period_size >> softpwm_snd->rate->dec_shift) *
+		     softpwm_snd->channels * sizeof(softpwm_sample_t);
+	softpwm_snd->adpcm = adpcm < 0 ? duty_bytes >= softpwm_snd->ring.size : !!adpcm;
+	ima_adpcm_reset(&softpwm_snd->adpcm_st[0]);
+	ima_adpcm_reset(&softpwm_snd->adpcm_st[1]);
+	softpwm_snd->adpcm_nibble = -1;
 	return 0;
 }
 
@@ -163,27 +678,11 @@ static int softpwm_pcm_trigger(struct snd_pcm_substream *substream, int cmd)
 {
 	struct softpwm_sound *softpwm_snd = snd_pcm_substream_chip(substream);
 	unsigned long flags;
-	unsigned char *data;
 	int ret = 0;
 
 	spin_lock_irqsave(&softpwm_snd->lock, flags);
 	switch (cmd) {
 	case SNDRV_PCM_TRIGGER_START:
-		data = softpwm_snd->substream->runtime->dma_area;
-
-		switch (softpwm_snd->channels) {
-		case 1: //Mono
-			softpwm_snd->softpwm->left_duty = (u32)data[0] * (u32)(DEFAULT_PWM_PERIOD - 1) / 255;
-			softpwm_snd->softpwm->right_duty = (u32)data[0] * (u32)(DEFAULT_PWM_PERIOD - 1) / 255;
-			softpwm_snd->data_ptr = 0;
-			break;
-		case 2: //Stereo
-			softpwm_snd->softpwm->left_duty = (u32)data[0] * (u32)(DEFAULT_PWM_PERIOD - 1) / 255;
-			softpwm_snd->softpwm->right_duty = (u32)data[1] * (u32)(DEFAULT_PWM_PERIOD - 1) / 255;
-			softpwm_snd->data_ptr = 1;
-			break;
-		}
-		softpwm_snd->period_ptr = 0;
 		if (softpwm_enable(softpwm_snd) == 0)
 			softpwm_snd->is_on = 1;
 		else
@@ -193,8 +692,8 @@ static int softpwm_pcm_trigger(struct snd_pcm_substream *substream, int cmd)
 		if (!softpwm_snd->is_on)
 			break;
 		softpwm_snd->is_on = 0;
-		softpwm_snd->softpwm->left_duty = 0;
-		softpwm_snd->softpwm->right_duty = 0;
+		softpwm_disable(softpwm_snd);
+		hrtimer_try_to_cancel(&softpwm_snd->timer);
 		break;
 	default:
 		ret = -EINVAL;
@@ -204,10 +703,42 @@ static int softpwm_pcm_trigger(struct snd_pcm_substream *substream, int cmd)
 	return ret;
 }
 
+/*
+ * The MCU counts a frame as played when it loads it, so everything between
+ * the pointer and appl_ptr is still queued. The frame on the pins right now
+ * is the only one in flight.
+ */
 static snd_pcm_uframes_t softpwm_pcm_pointer(struct snd_pcm_substream *substream)
 {
 	struct softpwm_sound *softpwm_snd = snd_pcm_substream_chip(substream);
-	return softpwm_snd->data_ptr;
+
+	substream->runtime->delay = 1;
+	return softpwm_played(softpwm_snd) % substream->runtime->buffer_size;
+}
+
+/* Link timestamps come straight from the MCU frame counter */
+static int softpwm_pcm_get_time_info(struct snd_pcm_substream *substream,
+			struct timespec64 *system_ts, struct timespec64 *audio_ts,
+			struct snd_pcm_audio_tstamp_config *audio_tstamp_config,
+			struct snd_pcm_audio_tstamp_report *audio_tstamp_report)
+{
+	struct softpwm_sound *softpwm_snd = snd_pcm_substream_chip(substream);
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	u32 played;
+
+	if (audio_tstamp_config->type_requested != SNDRV_PCM_AUDIO_TSTAMP_TYPE_LINK) {
+		audio_tstamp_report->actual_type = SNDRV_PCM_AUDIO_TSTAMP_TYPE_DEFAULT;
+		return 0;
+	}
+
+	played = softpwm_played(softpwm_snd);
+	snd_pcm_gettime(runtime, system_ts);
+	*audio_ts = ns_to_timespec64(div_u64((u64)played * NSEC_PER_SEC, runtime->rate));
+
+	audio_tstamp_report->actual_type = SNDRV_PCM_AUDIO_TSTAMP_TYPE_LINK;
+	audio_tstamp_report->accuracy_report = 1;
+	audio_tstamp_report->accuracy = NSEC_PER_SEC / runtime->rate;
+	return 0;
 }
 
 static struct snd_pcm_ops softpwm_pcm_playback_ops = {
@@ -219,14 +750,120 @@ static struct snd_pcm_ops softpwm_pcm_playback_ops = {
 	.prepare = softpwm_pcm_prepare,
 	.trigger = softpwm_pcm_trigger,
 	.pointer = softpwm_pcm_pointer,
+	.get_time_info = softpwm_pcm_get_time_info,
+};
+
+static int softpwm_volume_info(struct snd_kcontrol *kcontrol,
+			       struct snd_ctl_elem_info *uinfo)
+{
+	uinfo->type = SNDRV_CTL_ELEM_TYPE_INTEGER;
+	uinfo->count = 1;
+	uinfo->value.integer.min = 0;
+	uinfo->value.integer.max = SOFTPWM_VOLUME_MAX;
+	return 0;
+}
+
+static int softpwm_volume_get(struct snd_kcontrol *kcontrol,
+			      struct snd_ctl_elem_value *ucontrol)
+{
+	struct softpwm_sound *softpwm_snd = snd_kcontrol_chip(kcontrol);
+
+	ucontrol->value.integer.value[0] = softpwm_snd->volume;
+	return 0;
+}
+
+static int softpwm_switch_get(struct snd_kcontrol *kcontrol,
+			      struct snd_ctl_elem_value *ucontrol)
+{
+	struct softpwm_sound *softpwm_snd = snd_kcontrol_chip(kcontrol);
+
+	ucontrol->value.integer.value[0] = !softpwm_snd->mute;
+	return 0;
+}
+
+/* Shared by both controls, kcontrol->private_value selects the field */
+static int softpwm_mixer_put(struct snd_kcontrol *kcontrol,
+			     struct snd_ctl_elem_value *ucontrol)
+{
+	struct softpwm_sound *softpwm_snd = snd_kcontrol_chip(kcontrol);
+	long val = ucontrol->value.integer.value[0];
+	unsigned long flags;
+	u32 *field;
+	int changed;
+
+	if (kcontrol->private_value) {
+		if (val < 0 || val > SOFTPWM_VOLUME_MAX)
+			return -EINVAL;
+		field = &softpwm_snd->volume;
+	} else {
+		val = !val;
+		field = &softpwm_snd->mute;
+	}
+
+	spin_lock_irqsave(&softpwm_snd->lock, flags);
+	changed = *field != val;
+	*field = val;
+	if (changed && softpwm_snd->rate)
+		softpwm_build_lut(softpwm_snd);
+	spin_unlock_irqrestore(&softpwm_snd->lock, flags);
+
+	return changed;
+}
+
+static const struct snd_kcontrol_new softpwm_controls[] = {
+	{
+		.iface = SNDRV_CTL_ELEM_IFACE_MIXER,
+		.name = "Master Playback Volume",
+		.access = SNDRV_CTL_ELEM_ACCESS_READWRITE |
+			  SNDRV_CTL_ELEM_ACCESS_TLV_READ,
+		.info = softpwm_volume_info,
+		.get = softpwm_volume_get,
+		.put = softpwm_mixer_put,
+		.tlv.p = softpwm_volume_tlv,
+		.private_value = 1,
+	},
+	{
+		.iface = SNDRV_CTL_ELEM_IFACE_MIXER,
+		.name = "Master Playback Switch",
+		.info = snd_ctl_boolean_mono_info,
+		.get = softpwm_switch_get,
+		.put = softpwm_mixer_put,
+		.private_value = 0,
+	},
 };
 
+static void softpwm_proc_read(struct snd_info_entry *entry,
+			      struct snd_info_buffer *buffer)
+{
+	struct softpwm_sound *softpwm_snd = entry->private_data;
+	u32 queued = 0, load, load_max;
+	unsigned long flags;
+
+	spin_lock_irqsave(&softpwm_snd->lock, flags);
+	if (softpwm_snd->is_on)
+		queued = softpwm_ring_frames(softpwm_snd, softpwm_snd->ring.size - 1 -
+					     spsc_ring_space(&softpwm_snd->ring));
+	spin_unlock_irqrestore(&softpwm_snd->lock, flags);
+
+	snd_iprintf(buffer, "xruns: %u\n", softpwm_snd->xruns);
+	snd_iprintf(buffer, "underruns: %u\n",
+		    READ_ONCE(softpwm_snd->shm->underruns) - softpwm_snd->underruns_base);
+	snd_iprintf(buffer, "late_periods: %u\n", softpwm_snd->late_periods);
+	snd_iprintf(buffer, "max_lateness_us: %u\n", softpwm_snd->max_lateness_us);
+	snd_iprintf(buffer, "queued_frames: %u\n", queued);
+	snd_iprintf(buffer, "encoding: %s\n", softpwm_snd->adpcm ? "ima-adpcm" : "duty16");
+	load = READ_ONCE(softpwm_snd->shm->mcu_load);
+	load_max = READ_ONCE(softpwm_snd->shm->mcu_load_max);
+	snd_iprintf(buffer, "mcu_load: %u.%u%% (max %u.%u%%)\n",
+		    load / 10, load % 10, load_max / 10, load_max % 10);
+}
+
 static int softpwm_sound_dev_init(struct softpwm_sound *softpwm_snd)
 {
 	static const struct snd_device_ops ops = { NULL };
 	struct snd_card *card;
 	struct snd_pcm *pcm;
-	int ret;
+	int ret, i;
 
 	ret = snd_card_new(&softpwm_snd->pdev->dev, SNDRV_DEFAULT_IDX1,
 		SNDRV_DEFAULT_STR1, THIS_MODULE, 0, &card);
@@ -251,7 +888,16 @@ static int softpwm_sound_dev_init(struct softpwm_sound *softpwm_snd)
 	pcm->info_flags = 0;
 
 	snd_pcm_set_managed_buffer_all(pcm, SNDRV_DMA_TYPE_CONTINUOUS,
-				&softpwm_snd->pdev->dev, 8 * 1024, 8 * 1024);
+				&softpwm_snd->pdev->dev, 32 * 1024, 32 * 1024);
+
+	strlcpy(card->mixername, "softpwm", sizeof(card->mixername));
+	for (i = 0; i < ARRAY_SIZE(softpwm_controls); i++) {
+		ret = snd_ctl_add(card, snd_ctl_new1(&softpwm_controls[i], softpwm_snd));
+		if (ret)
+			goto error;
+	}
+
+	snd_card_ro_proc_new(card, "softpwm", softpwm_snd, softpwm_proc_read);
 
 	ret = snd_card_register(card);
 	if (ret == 0)
@@ -274,11 +920,9 @@ static int softpwm_sound_probe(struct platform_device *pdev)
 {
 	struct softpwm_sound *softpwm_snd;
     struct device *dev = &pdev->dev;
-	struct reserved_mem *rmem;
 	struct device_node *np = dev->of_node;
-	struct device_node *shmem_np;
-	u32 shmem_offset, shmem_length;	
-	volatile void __iomem *shmem_addr;
+	u32 shmem_length;
+	void *shmem_addr;
 	int ret;
 
     softpwm_snd = devm_kzalloc(dev, sizeof(*softpwm_snd), GFP_KERNEL);
@@ -290,38 +934,42 @@ static int softpwm_sound_probe(struct platform_device *pdev)
         return -ENODEV;
     }
 
-	shmem_np = of_parse_phandle(np, "memory-region", 0);
-	if (!shmem_np)
-		return -EINVAL;
-	rmem = of_reserved_mem_lookup(shmem_np);
-	of_node_put(shmem_np);
-	if (!rmem) {
-		dev_err(dev, "Unable to acquire memory-region\n");
-		return -EINVAL;
-	}
-
-	if (of_property_read_u32(np, "shmem-offset", &shmem_offset)) {
-    	dev_err(dev, "Failed to read 'shmem-offset' property\n");
-    	return -EINVAL;
-	}
-	if (of_property_read_u32(np, "shmem-length", &shmem_length)) {
-    	dev_err(dev, "Failed to read 'shmem-length' property\n");
-    	return -EINVAL;
-	}
-	if (shmem_length > rmem->size - shmem_offset) {
+	shmem_addr = picocalc_shm_get(PICOCALC_SHM_SOFTPWM, &shmem_length);
+	if (IS_ERR(shmem_addr))
+		return dev_err_probe(dev, PTR_ERR(shmem_addr), "No softpwm channel\n");
+	if (shmem_length <= SOFTPWM_SHM_HDR_SIZE) {
 		dev_err(dev, "Share memory is too small\n");
     	return -EINVAL;
 	}
-	shmem_addr = devm_memremap(dev, rmem->base, rmem->size, MEMREMAP_WC);
 	softpwm_snd->pdev = pdev;
-	softpwm_snd->softpwm = (struct softpwm_config*)(shmem_addr + shmem_offset);
+	softpwm_snd->shm = shmem_addr;
+	// Keep the ring a whole number of stereo frames
+	softpwm_snd->shm_length = SOFTPWM_SHM_HDR_SIZE +
+		round_down(shmem_length - SOFTPWM_SHM_HDR_SIZE, 2 * sizeof(softpwm_sample_t));
+	softpwm_disable(softpwm_snd);
+	softpwm_snd->underruns_base = READ_ONCE(softpwm_snd->shm->underruns);
+	softpwm_snd->volume = SOFTPWM_VOLUME_DEFAULT;
 
 	spin_lock_init(&softpwm_snd->lock);
 
+	softpwm_snd->mbox_cl.dev = dev;
+	softpwm_snd->mbox_cl.rx_callback = softpwm_doorbell;
+	softpwm_snd->mbox_msg.cmd = SOFTPWM_DOORBELL_STATE;
+	softpwm_snd->mbox = mbox_request_channel_byname(&softpwm_snd->mbox_cl, "doorbell");
+	if (IS_ERR(softpwm_snd->mbox)) {
+		ret = PTR_ERR(softpwm_snd->mbox);
+		if (ret == -EPROBE_DEFER)
+			return ret;
+		dev_info(dev, "No MCU doorbell, using the period timer\n");
+		softpwm_snd->mbox = NULL;
+	}
+
 	ret = softpwm_sound_dev_init(softpwm_snd);
 	if (ret)
 	{
         dev_err(dev, "softpwm_sound_dev_init failed!\n");
+		if (softpwm_snd->mbox)
+			mbox_free_channel(softpwm_snd->mbox);
 		return ret;
 	}
 
@@ -335,6 +983,9 @@ static int softpwm_sound_remove(struct platform_device *pdev)
 {
 	struct softpwm_sound *softpwm_snd = platform_get_drvdata(pdev);
     softpwm_disable(softpwm_snd);
+	hrtimer_cancel(&softpwm_snd->timer);
+	if (softpwm_snd->mbox)
+		mbox_free_channel(softpwm_snd->mbox);
 	snd_card_free(softpwm_snd->snd_card);
 	softpwm_snd->snd_card = NULL;
 	return 0;
@@ -344,6 +995,7 @@ static struct platform_driver picocalc_snd_pwm_driver = {
 	.driver		= {
 		.name	= "picocalc-softpwm",
 		.of_match_table = softpwm_sound_of_match,
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,
 	},
 	.probe		= softpwm_sound_probe,
 	.remove		= softpwm_sound_remove,